@@ -17,6 +17,10 @@
 
 #include <cstdint>
 #include <map>
+#include <mutex>
+#include <memory_resource>
+#include <optional>
+#include <expected>
 #include <set>
 #include <unordered_map>
 #include <vector>
@@ -25,1023 +29,2950 @@
 #include <memory>
 #include <utility>
 #include <cstdlib>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <initializer_list>
+#include <charconv>
+#include <system_error>
+#include <cmath>
+#include <limits>
+
+#if defined ( __SSE2__ ) || defined ( _M_X64 ) || (defined ( _M_IX86_FP ) && _M_IX86_FP >= 2)
+#define DAB_JSON_SSE2 1
+#include <immintrin.h>
+#if defined ( _MSC_VER )
+#include <intrin.h>
+#endif
+#elif defined ( __ARM_NEON ) || defined ( __ARM_NEON__ )
+#define DAB_JSON_NEON 1
+#include <arm_neon.h>
+#endif
 
 namespace DAB
 {
-    class jsonElement
+    // vectorized string scanning used by the json parser and serializer
+    // each scan returns a pointer to the first "interesting" byte in [p, end), or end if there is none.  Clean runs in between can then be copied with a single append.
+    //      findQuoteOrEscape   -   '"' or '\\'                                         (string parsing)
+    //      findEscapable       -   '"', '\\', or any byte outside of 32..127           (string serialization)
+    // on x86 the kernel is selected at runtime (AVX2 if the cpu supports it, otherwise SSE2 which all x86-64 cpu's have), on ARM NEON is used if enabled at compile time.   Anything else gets the scalar version.
+    class jsonStringScan
     {
-    public:
-        typedef std::map <std::string, jsonElement, std::less<>> objectType;
-        typedef std::vector <jsonElement> arrayType;
-        inline static struct
-        {
-        } array{};            // this is used to force an indeterminate { "a, "b" } to be processed as an array and not as an object
-
-    private:
-
-        std::variant<std::monostate, int64_t, double, std::string, objectType, arrayType, bool, decltype ( array )> value;
-
-        template< typename, typename >
-        struct is_associative_container
-        {
-            static constexpr bool value = false;
-        };
-
-        template< typename C >
-        struct is_associative_container<C, typename C::mapped_type>
-        {
-            static constexpr bool value = true;
-        };
+        using scanFunc = char const *(*) ( char const *, char const * );
 
-        template< typename, typename, typename >
-        struct is_sequence_container
+        static bool isEscapable ( char const c )
         {
-            static constexpr bool value = false;
-        };
+            // signed compare, so this also catches anything >= 0x80
+            return c == '"' || c == '\\' || (signed char) c < 32;
+        }
 
-        template< typename C >
-        struct is_sequence_container<C, typename C::value_type, decltype ( std::declval<C> ().clear ())>
+        static char const *findQuoteOrEscapeScalar ( char const *p, char const *end )
         {
-            static constexpr bool value = true;
-        };
-
-    public:
-        jsonElement ()
-        {}
+            while ( p < end && *p != '"' && *p != '\\' )
+            {
+                p++;
+            }
+            return p;
+        }
 
-        template< typename T >
-        jsonElement ( std::string const &name, T v )
+        static char const *findEscapableScalar ( char const *p, char const *end )
         {
-            if constexpr ( std::is_same_v < bool, T > )
-            {
-                value = objectType{{name, (bool) v}};
-            } else
+            while ( p < end && !isEscapable ( *p ))
             {
-                value = objectType{{name, v}};
+                p++;
             }
+            return p;
         }
 
-        // the constructor takes an initializer list
-        //     if it's a fundamental value (int64_t, bool, double, std::string} it simply creates a jsonElement that holds that type
-        //     if it's an object of type { "name", "value" } it interprets this as a name value pair and adds this to the surrounding object;
-        //     if it's a list of more than two values, it is interpreted as an array.   Alternately if it is two values exactly, an array
-        //     can be declared as { jsonElement::array(), "one", "two" }   If a jsonElement::array() is detected it is treated as a flag
-        //     and does not become part of the json data
-        jsonElement ( std::initializer_list <jsonElement> i )
+        static unsigned firstBit ( uint64_t mask )
         {
-            if ( i.size () == 2 )
+#if defined ( _MSC_VER ) && !defined ( __clang__ )
+            unsigned long index;
+            _BitScanForward64 ( &index, mask );
+            return (unsigned) index;
+#else
+            return (unsigned) __builtin_ctzll ( mask );
+#endif
+        }
+
+#if defined ( DAB_JSON_SSE2 )
+        static char const *findQuoteOrEscapeSSE2 ( char const *p, char const *end )
+        {
+            auto const quote = _mm_set1_epi8 ( '"' );
+            auto const backslash = _mm_set1_epi8 ( '\\' );
+            for ( ; end - p >= 16; p += 16 )
             {
-                if ( std::holds_alternative<std::string> ( i.begin ()->value ))
+                auto v = _mm_loadu_si128 ( (__m128i const *) p );
+                auto mask = (unsigned) _mm_movemask_epi8 ( _mm_or_si128 ( _mm_cmpeq_epi8 ( v, quote ), _mm_cmpeq_epi8 ( v, backslash )));
+                if ( mask )
                 {
-                    value = objectType{{std::get<std::string> ( i.begin ()->value ), std::next ( i.begin ())->value}};
-                    return;
+                    return p + firstBit ( mask );
                 }
             }
-            bool isObject = true;
-            for ( auto &it: i )
-            {
-                if ( !std::holds_alternative<objectType> ( it.value ))
+            return findQuoteOrEscapeScalar ( p, end );
+        }
+
+        static char const *findEscapableSSE2 ( char const *p, char const *end )
+        {
+            auto const quote = _mm_set1_epi8 ( '"' );
+            auto const backslash = _mm_set1_epi8 ( '\\' );
+            auto const space = _mm_set1_epi8 ( 32 );
+            for ( ; end - p >= 16; p += 16 )
+            {
+                auto v = _mm_loadu_si128 ( (__m128i const *) p );
+                // _mm_cmplt_epi8 is signed so bytes >= 0x80 compare as negative and are caught along with the control characters
+                auto special = _mm_or_si128 ( _mm_or_si128 ( _mm_cmpeq_epi8 ( v, quote ), _mm_cmpeq_epi8 ( v, backslash )), _mm_cmplt_epi8 ( v, space ));
+                auto mask = (unsigned) _mm_movemask_epi8 ( special );
+                if ( mask )
                 {
-                    isObject = false;
-                    break;
+                    return p + firstBit ( mask );
                 }
             }
+            return findEscapableScalar ( p, end );
+        }
 
-            if ( isObject )
+#if defined ( __GNUC__ ) || defined ( __clang__ )
+#define DAB_JSON_TARGET_AVX2 __attribute__ (( target ( "avx2" )))
+#else
+#define DAB_JSON_TARGET_AVX2
+#endif
+        DAB_JSON_TARGET_AVX2 static char const *findQuoteOrEscapeAVX2 ( char const *p, char const *end )
+        {
+            auto const quote = _mm256_set1_epi8 ( '"' );
+            auto const backslash = _mm256_set1_epi8 ( '\\' );
+            for ( ; end - p >= 32; p += 32 )
             {
-                if ( !std::holds_alternative<objectType> ( value ))
+                auto v = _mm256_loadu_si256 ( (__m256i const *) p );
+                auto mask = (unsigned) _mm256_movemask_epi8 ( _mm256_or_si256 ( _mm256_cmpeq_epi8 ( v, quote ), _mm256_cmpeq_epi8 ( v, backslash )));
+                if ( mask )
                 {
-                    value = objectType ();
+                    return p + firstBit ( mask );
                 }
-                auto &obj = std::get<objectType> ( value );
-                for ( auto &it: i )
-                {
-                    auto &elem = std::get<objectType> ( it.value );
+            }
+            return findQuoteOrEscapeSSE2 ( p, end );
+        }
 
-                    obj.insert ( elem.begin (), elem.end ());
-                }
-            } else
-            {
-                if ( !std::holds_alternative<arrayType> ( value ))
-                {
-                    value = arrayType ();
-                }
-                auto &arr = std::get<arrayType> ( value );
-                for ( auto &it: i )
+        DAB_JSON_TARGET_AVX2 static char const *findEscapableAVX2 ( char const *p, char const *end )
+        {
+            auto const quote = _mm256_set1_epi8 ( '"' );
+            auto const backslash = _mm256_set1_epi8 ( '\\' );
+            auto const space = _mm256_set1_epi8 ( 32 );
+            for ( ; end - p >= 32; p += 32 )
+            {
+                auto v = _mm256_loadu_si256 ( (__m256i const *) p );
+                // signed compare as with SSE2, space > v catches control characters and bytes >= 0x80
+                auto special = _mm256_or_si256 ( _mm256_or_si256 ( _mm256_cmpeq_epi8 ( v, quote ), _mm256_cmpeq_epi8 ( v, backslash )), _mm256_cmpgt_epi8 ( space, v ));
+                auto mask = (unsigned) _mm256_movemask_epi8 ( special );
+                if ( mask )
                 {
-                    // if it's of type array() ignore the value.  This is just to indicate that we process as an array and not as an object
-                    if ( !std::holds_alternative<decltype ( array )> ( it.value ))
-                    {
-                        arr.push_back ( it );
-                    }
+                    return p + firstBit ( mask );
                 }
             }
+            return findEscapableSSE2 ( p, end );
         }
+#undef DAB_JSON_TARGET_AVX2
 
-        // initializer for an associative container.
-        template< class T, typename std::enable_if_t<is_associative_container<T, T>::value> * = nullptr >
-        jsonElement ( T const &o ) : value ( objectType ( o.cbegin (), o.cend ()))
-        {}
-
-        // initializer for an array
-        template< class T, typename std::enable_if_t<is_sequence_container<T, T, T>::value> * = nullptr >
-        jsonElement ( T const &a ) : value ( arrayType ( a.cbegin (), a.cend ()))
-        {}
-
-        // for array... needs to have a vector type of <jsonElement>
-        template< class T, typename std::enable_if_t<!is_sequence_container<T, T, T>::value && !is_associative_container<T, T>::value> * = nullptr >
-        jsonElement ( T const &v )
+        static bool hasAVX2 ()
         {
-            if constexpr ( std::is_same_v<const char *, T> )
-            {
-                value = std::string ( v );
-            } else if constexpr ( std::is_same_v < bool, T > )
-            {
-                value = (bool) v;
-            } else if constexpr ((std::is_integral_v < T > || std::is_enum_v < T > ) && !std::is_same_v < bool, T > )
+#if defined ( _MSC_VER ) && !defined ( __clang__ )
+            int regs[4];
+            __cpuid ( regs, 0 );
+            if ( regs[0] < 7 )
             {
-                value = (int64_t) v;
-            } else if constexpr ( std::is_floating_point_v < T > )
-            {
-                value = (double) v;
-            } else
+                return false;
+            }
+            __cpuid ( regs, 1 );
+            // os must have enabled saving of the ymm registers (osxsave + xgetbv)
+            if ( !(regs[2] & (1 << 27)) || (_xgetbv ( 0 ) & 6) != 6 )
             {
-                value = v;
+                return false;
             }
+            __cpuidex ( regs, 7, 0 );
+            return (regs[1] & (1 << 5)) != 0;
+#else
+            return __builtin_cpu_supports ( "avx2" );
+#endif
         }
-
-        virtual ~jsonElement ()
-        {}
-
-        // this is the main parser for the jsonElement class
-        // it takes the pointer to a json string and returns a jsonObject as a result
-        // it is fully recursive
-        jsonElement ( char const **str )
+#elif defined ( DAB_JSON_NEON )
+        // narrow each 8-bit lane of the compare result to 4 bits, so the position of the first match can be found with a count of trailing zeros
+        static uint64_t neonMask ( uint8x16_t special )
         {
-            while ( isSpace ( **str ))
-                (*str)++;        // skip spaces and eol characters
+            return vget_lane_u64 ( vreinterpret_u64_u8 ( vshrn_n_u16 ( vreinterpretq_u16_u8 ( special ), 4 )), 0 );
+        }
 
-            // see if we're parsing an object
-            if ((*str)[0] == '{' )
+        static char const *findQuoteOrEscapeNEON ( char const *p, char const *end )
+        {
+            auto const quote = vdupq_n_u8 ( '"' );
+            auto const backslash = vdupq_n_u8 ( '\\' );
+            for ( ; end - p >= 16; p += 16 )
             {
-                // we're a json object
-                (*str)++;
+                auto v = vld1q_u8 ( (uint8_t const *) p );
+                auto mask = neonMask ( vorrq_u8 ( vceqq_u8 ( v, quote ), vceqq_u8 ( v, backslash )));
+                if ( mask )
+                {
+                    return p + (firstBit ( mask ) >> 2);
+                }
+            }
+            return findQuoteOrEscapeScalar ( p, end );
+        }
 
-                value = jsonElement::objectType ();
+        static char const *findEscapableNEON ( char const *p, char const *end )
+        {
+            auto const quote = vdupq_n_u8 ( '"' );
+            auto const backslash = vdupq_n_u8 ( '\\' );
+            auto const space = vdupq_n_u8 ( 32 );
+            auto const high = vdupq_n_u8 ( 0x80 );
+            for ( ; end - p >= 16; p += 16 )
+            {
+                auto v = vld1q_u8 ( (uint8_t const *) p );
+                auto special = vorrq_u8 ( vorrq_u8 ( vceqq_u8 ( v, quote ), vceqq_u8 ( v, backslash )), vorrq_u8 ( vcltq_u8 ( v, space ), vcgeq_u8 ( v, high )));
+                auto mask = neonMask ( special );
+                if ( mask )
+                {
+                    return p + (firstBit ( mask ) >> 2);
+                }
+            }
+            return findEscapableScalar ( p, end );
+        }
+#endif
 
-                auto &obj = std::get<jsonElement::objectType> ( value );
+        static scanFunc selectQuoteOrEscape ()
+        {
+#if defined ( DAB_JSON_SSE2 )
+            return hasAVX2 () ? findQuoteOrEscapeAVX2 : findQuoteOrEscapeSSE2;
+#elif defined ( DAB_JSON_NEON )
+            return findQuoteOrEscapeNEON;
+#else
+            return findQuoteOrEscapeScalar;
+#endif
+        }
 
-                bool first = true;
-                for ( ;; )
-                {
-                    // skip any whitespace
-                    while ( isSpace ( **str ))
-                        (*str)++;        // skip spaces and eol characters
+        static scanFunc selectEscapable ()
+        {
+#if defined ( DAB_JSON_SSE2 )
+            return hasAVX2 () ? findEscapableAVX2 : findEscapableSSE2;
+#elif defined ( DAB_JSON_NEON )
+            return findEscapableNEON;
+#else
+            return findEscapableScalar;
+#endif
+        }
 
-                    // are we one parsing the object?
-                    if ((*str)[0] == '}' )
-                    {
-                        (*str)++;
-                        break;
-                    }
+    public:
+        static char const *findQuoteOrEscape ( char const *p, char const *end )
+        {
+            static scanFunc const kernel = selectQuoteOrEscape ();
+            return kernel ( p, end );
+        }
 
-                    // if this isn't our first name/value pair we should have a , as the next character
-                    if ( !first )
-                    {
-                        if ((*str)[0] != ',' )
-                        {
-                            throw "missing comma";
-                        }
-                        (*str)++;
-                        while ( isSpace ( **str ))
-                            (*str)++;        // skip spaces and eol characters
-                        if ((*str)[0] == '}' )
-                        {
-                            (*str)++;
-                            break;
-                        }
-                    }
-                    first = false;
+        static char const *findEscapable ( char const *p, char const *end )
+        {
+            static scanFunc const kernel = selectEscapable ();
+            return kernel ( p, end );
+        }
+    };
 
-                    std::string name;
-                    // are we quoted name : values?   We can handle either
-                    if ((*str)[0] == '"' )
-                    {
-                        // quoted
-                        (*str)++;
-                        while ( **str && (*str)[0] != '"' )
-                        {
-                            name += *((*str)++);
-                        }
-                        if ( **str )
-                        {
-                            (*str)++;
-                        } else
-                        {
-                            throw "missing \"";
-                        }
-                    } else
-                    {
-                        // non-quoted
-                        if ( !isSymbol ( **str ))
-                        {
-                            throw "invalid json symbol value";
-                        }
-                        while ( isSymbolB ( **str ))
-                        {
-                            name += *((*str)++);
-                        }
-                    }
+    // optional per-thread arena for jsonElement containers
+    // while a jsonArena::scope is active on a thread, every object and array created on that thread takes its memory from the arena.
+    // nothing is freed individually, instead everything is released in one shot by reset () once all of the elements allocated from it have been destroyed.
+    // the arena remembers how much overflowed its initial buffer and grows to fit on the next reset, so steady-state requests never touch the heap.
+    //
+    //      DAB::jsonArena arena;
+    //      {
+    //          DAB::jsonArena::scope s ( arena );
+    //          ... parse, dispatch, serialize ...
+    //      }
+    //      arena.reset ();
+    //
+    // NOTE: anything built inside the scope must not outlive the reset.   A jsonArena::suspend can be used to build elements that need to be retained (for instance a copy
+    //       of the request stored by a handler) on the heap while a scope is active.
+    class jsonArena
+    {
+        // upstream for the monotonic resource... just tallies how much we needed beyond our own buffer
+        class overflowResource : public std::pmr::memory_resource
+        {
+        public:
+            size_t allocated = 0;
 
-                    // skip whitespace
-                    while ( isSpace ( **str ))
-                        (*str)++;        // skip spaces and eol characters
-                    // must have a :
-                    if ((*str)[0] != ':' )
-                    {
-                        throw "missing name/value separator";
-                    }
-                    (*str)++;
+        private:
+            void *do_allocate ( size_t bytes, size_t alignment ) override
+            {
+                allocated += bytes;
+                return std::pmr::new_delete_resource ()->allocate ( bytes, alignment );
+            }
 
-                    // skip space after :
-                    while ( isSpace ( **str ))
-                        (*str)++;        // skip spaces and eol characters
+            void do_deallocate ( void *p, size_t bytes, size_t alignment ) override
+            {
+                std::pmr::new_delete_resource ()->deallocate ( p, bytes, alignment );
+            }
 
-                    // recurse for the value and just call the assignment operator for objects to do the assignment
-                    obj[name] = jsonElement ( str );
-                }
-            } else if ((*str)[0] == '[' )
+            bool do_is_equal ( std::pmr::memory_resource const &other ) const noexcept override
             {
-                (*str)++;
-                // instantiate us as an array
-                value = jsonElement::arrayType ();
+                return this == &other;
+            }
+        };
 
-                // get a reference to our underlying array
-                auto &arr = std::get<jsonElement::arrayType> ( value );
+        inline static thread_local jsonArena *currentArena = nullptr;
 
-                bool first = true;
-                // start looping, loop will terminate when we hit the end ] character
-                for ( ;; )
-                {
-                    // eat any whitespace
-                    while ( isSpace ( **str ))
-                        (*str)++;        // skip spaces and eol characters
+        size_t capacity;
+        std::unique_ptr<std::byte[]> buffer;
+        overflowResource overflow;
+        std::optional<std::pmr::monotonic_buffer_resource> resource;
 
-                    // test to see if we're done with the array
-                    if ((*str)[0] == ']' )
-                    {
-                        (*str)++;
-                        break;
-                    }
-                    // if we're not the first element than we should have a , separator
-                    if ( !first )
-                    {
-                        if ((*str)[0] != ',' )
-                        {
-                            throw "missing comma";
-                        }
-                        (*str)++;
-                        while ( isSpace ( **str ))
-                            (*str)++;        // skip spaces and eol characters
-                    }
-                    first = false;
+    public:
+        explicit jsonArena ( size_t initialSize = 64 * 1024 ) : capacity ( initialSize ), buffer ( new std::byte[initialSize] )
+        {
+            resource.emplace ( buffer.get (), capacity, &overflow );
+        }
 
-                    // recurse and push to the back of the array the jsonElement value
-                    arr.push_back ( jsonElement ( str ));
-                }
-            } else if ((*str)[0] == '"' )
-            {
-                // we're a string
-                (*str)++;
+        jsonArena ( jsonArena const & ) = delete;
+        jsonArena &operator= ( jsonArena const & ) = delete;
 
-                std::string v;
-                while ( **str && (*str)[0] != '"' )
-                {
-                    // handle any quoted special values
-                    if ((*str)[0] == '\\' && (*str)[1] == '"' )
-                    {
-                        v += '"';
-                        (*str) += 2;
-                    } else if ((*str)[0] == '\\' && (*str)[1] == 'r' )
-                    {
-                        v += '\r';
-                        (*str) += 2;
-                    } else if ((*str)[0] == '\\' && (*str)[1] == 'n' )
-                    {
-                        v += '\n';
-                        (*str) += 2;
-                    } else if ((*str)[0] == '\\' && (*str)[1] == 't' )
-                    {
-                        v += '\t';
-                        (*str) += 2;
-                    } else if ((*str)[0] == '\\' && (*str)[1] )
-                    {
-                        v += (*str)[1];
-                        (*str) += 2;
-                    } else
-                    {
-                        v += *((*str)++);
-                    }
-                }
-                // skip  over the ending " character
-                if ( **str )
-                {
-                    (*str)++;
-                } else
-                {
-                    throw "missing \"";
-                }
-                // assign us the parsed string
-                value = std::move ( v );
-            } else if ( isNumB ( **str ))
-            {
-                std::string v;
-                bool isFloat = false;
-                // loop over and build a string of all our number characters
-                while ( isNum ( **str ))
-                {
-                    // if we see these we're a float
-                    if ( **str == '.' )
-                        isFloat = true;
-                    if ( **str == 'e' )
-                        isFloat = true;
-                    v += *((*str)++);
-                }
-                // convert from string and assign us, either a float or a long long
-                if ( isFloat )
-                {
-                    value = std::stod ( v.c_str ());
-                } else
-                {
-                    value = std::stoll ( v.c_str ());
-                }
-            } else if ( !memcmp ( *str, "true", 4 ))
-            {
-                // boolean true
-                value = true;
-                *str += 4;
-            } else if ( !memcmp ( *str, "false", 5 ))
-            {
-                // boolean false
-                value = false;
-                *str += 5;
-            } else if ( !memcmp ( *str, "null", 4 ))
-            {
-                // null which is indicated by std::monostate in the variant
-                value = std::monostate ();
-                *str += 4;
+        // releases everything allocated from the arena.   All elements allocated from it must have been destroyed before this is called
+        void reset ()
+        {
+            if ( overflow.allocated )
+            {
+                // we spilled out of our buffer, so grow it to cover what was needed and start over
+                resource.reset ();
+                capacity += overflow.allocated;
+                overflow.allocated = 0;
+                buffer.reset ( new std::byte[capacity] );
+                resource.emplace ( buffer.get (), capacity, &overflow );
             } else
             {
-                throw "missing \"";
+                resource->release ();
             }
         }
 
-        //move constructor
-        jsonElement ( jsonElement &&old )
-
-        noexcept
+        std::pmr::memory_resource *getResource ()
         {
-            *this = std::move ( old );
+            return &*resource;
         }
 
-        // copy constructor
-        jsonElement ( jsonElement const &old )
+        // the arena in use on the calling thread (nullptr if none)
+        static jsonArena *current ()
         {
-            value = old.value;
+            return currentArena;
         }
 
-        // copy operator
-        jsonElement &operator= ( jsonElement const &old )
+        // makes arena the active arena for the calling thread for the lifetime of the scope object
+        class scope
         {
-            value = old.value;
-            return *this;
-        }
+            jsonArena *previous;
+        public:
+            explicit scope ( jsonArena &arena ) : previous ( currentArena )
+            {
+                currentArena = &arena;
+            }
 
-        // move operator
-        jsonElement &operator= ( jsonElement &&old )
+            ~scope ()
+            {
+                currentArena = previous;
+            }
 
-        noexcept
+            scope ( scope const & ) = delete;
+            scope &operator= ( scope const & ) = delete;
+        };
+
+        // suspends any active arena on the calling thread for the lifetime of the suspend object, elements created while suspended use the heap.
+        class suspend
         {
-            // free it an initialize it to the old type and copy old into us
-            std::swap ( value, old.value );
-            return *this;
-        }
+            jsonArena *previous;
+        public:
+            suspend () : previous ( currentArena )
+            {
+                currentArena = nullptr;
+            }
 
-#if 1 // __cplusplus == 201703L
-         template <typename T>
-         using remove_cvref_t = typename std::remove_cv<typename std::remove_reference<T>::type>::type;
+            ~suspend ()
+            {
+                currentArena = previous;
+            }
 
-         template< class T, typename std::enable_if_t<((std::is_arithmetic_v<T> || std::is_enum_v<T>)) &&
-                     !std::is_same_v<jsonElement, remove_cvref_t<T>>>* = nullptr>
-#else
-        // assignment operator for arithmetic types (bool, int, double)
-        template< class T, typename std::enable_if_t<((std::is_arithmetic_v < T > || std::is_enum_v < T > )) && !std::is_same_v < jsonElement, typename std::remove_cvref_t<T>::type>> * = nullptr>
-#endif
+            suspend ( suspend const & ) = delete;
+            suspend &operator= ( suspend const & ) = delete;
+        };
+    };
 
-        jsonElement &operator= ( T const &v )
+    // allocator used by the jsonElement containers.  It captures the calling thread's arena (if any) when the container is created and uses the heap otherwise.
+    // the allocator travels with the container on move/swap, copies pick up whichever arena is active at the point of the copy.
+    template< typename T >
+    class jsonAllocator
+    {
+        template< typename > friend class jsonAllocator;
+
+        std::pmr::memory_resource *resource;
+
+    public:
+        using value_type = T;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+        using propagate_on_container_copy_assignment = std::false_type;
+        using is_always_equal = std::false_type;
+
+        jsonAllocator () noexcept : resource ( jsonArena::current () ? jsonArena::current ()->getResource () : nullptr )
+        {}
+
+        template< typename U >
+        jsonAllocator ( jsonAllocator<U> const &other ) noexcept : resource ( other.resource )
+        {}
+
+        T *allocate ( size_t n )
         {
-            if constexpr ( std::is_same_v < bool, T > )
-            {
-                value = v;
-            } else if constexpr ( std::is_integral_v < T > || std::is_enum_v < T > && !std::is_same_v < bool, T > )
+            if ( resource )
             {
-                value = (int64_t) v;
-            } else if constexpr ( std::is_floating_point_v < T > )
+                return static_cast<T *>(resource->allocate ( n * sizeof ( T ), alignof ( T )));
+            }
+            return std::allocator<T> ().allocate ( n );
+        }
+
+        void deallocate ( T *p, size_t n )
+        {
+            if ( resource )
             {
-                value = (double) v;
+                resource->deallocate ( p, n * sizeof ( T ), alignof ( T ));
             } else
             {
-                value = v;
+                std::allocator<T> ().deallocate ( p, n );
             }
-            return *this;
         }
 
-        // assignment operator for strings or string convertibles
-        template< class T, typename std::enable_if_t<!std::is_arithmetic_v < T> && !std::is_enum_v <T> > * = nullptr>
+        jsonAllocator select_on_container_copy_construction () const
+        {
+            return jsonAllocator ();
+        }
 
-        jsonElement &operator= ( T const &v )
+        template< typename U >
+        bool operator== ( jsonAllocator<U> const &other ) const noexcept
         {
-            value = std::string ( v );
-            return *this;
+            return resource == other.resource;
         }
+    };
 
-        // ----------------------------------------------- assignment methods
+    // flat storage for json objects.
+    // DAB objects almost always have a handful of members, so rather than a node based map we keep the name/value pairs contiguously, in insertion order.
+    // small objects are searched linearly (which for a few keys beats anything that has to chase pointers), once an object grows past hashThreshold
+    // members an open-addressed hash index of the entries is built and used for lookups.
+    // NOTE: the value type is recursive so true inline (small-buffer) storage isn't possible, instead the first insertion reserves room for
+    //       initialCapacity members so most objects cost exactly one allocation (none if an arena is active).
+    template< typename V >
+    class jsonObjectStorage
+    {
+    public:
+        using key_type = std::string;
+        using mapped_type = V;
+        using value_type = std::pair<std::string, V>;
+        using allocator_type = jsonAllocator<value_type>;
+        using iterator = typename std::vector<value_type, allocator_type>::iterator;
+        using const_iterator = typename std::vector<value_type, allocator_type>::const_iterator;
 
-        // this returns a reference to an object with property name.     obj[std::string("name")]
-        template< typename T, typename std::enable_if_t<std::is_same_v < T, std::string_view>> * = nullptr>
+        static constexpr size_t hashThreshold = 16;
+        static constexpr size_t initialCapacity = 8;
 
-        jsonElement &operator[] ( T const &name )
+    private:
+        std::vector<value_type, allocator_type> entries;
+        std::vector<uint32_t, jsonAllocator<uint32_t>> index;      // entry position + 1 for each slot, 0 for empty slots.   Empty until we pass hashThreshold
+
+        static size_t hash ( std::string_view name )
         {
-            if ( !std::holds_alternative<objectType> ( value ))
+            return std::hash<std::string_view>{} ( name );
+        }
+
+        size_t lookup ( std::string_view name ) const
+        {
+            if ( index.empty ())
             {
-                value = objectType ();
+                for ( size_t loop = 0; loop < entries.size (); loop++ )
+                {
+                    if ( entries[loop].first.size () == name.size () && !memcmp ( entries[loop].first.data (), name.data (), name.size ()))
+                    {
+                        return loop;
+                    }
+                }
+                return entries.size ();
             }
-            auto &obj = std::get<objectType> ( value );
-            return obj[name];
+            size_t mask = index.size () - 1;
+            for ( size_t slot = hash ( name ) & mask; index[slot]; slot = (slot + 1) & mask )
+            {
+                if ( entries[index[slot] - 1].first == name )
+                {
+                    return index[slot] - 1;
+                }
+            }
+            return entries.size ();
         }
 
-        // same as above except we take in a const char * as name rather than a std::string
-        template< typename T, typename std::enable_if_t<std::is_same_v<T, const char *>> * = nullptr >
-        jsonElement &operator[] ( T name )
+        void addToIndex ( size_t pos )
         {
-            if ( !std::holds_alternative<objectType> ( value ))
+            size_t mask = index.size () - 1;
+            size_t slot = hash ( entries[pos].first ) & mask;
+            while ( index[slot] )
             {
-                value = objectType ();
+                slot = (slot + 1) & mask;
             }
-            auto &obj = std::get<objectType> ( value );
-            return obj[std::string ( name )];
+            index[slot] = (uint32_t) (pos + 1);
         }
 
-        // array dereference operator, returns a reference to the <index> element (0-based).    obj[<index>]
-        template< typename T, typename std::enable_if_t<std::is_integral_v < T>> * = nullptr>
+        void rebuildIndex ()
+        {
+            // keep the index at most half full
+            size_t size = 1;
+            while ( size < entries.size () * 2 )
+            {
+                size <<= 1;
+            }
+            index.assign ( size, 0 );
+            for ( size_t loop = 0; loop < entries.size (); loop++ )
+            {
+                addToIndex ( loop );
+            }
+        }
 
-        jsonElement &operator[] ( T index )
+        // adds a new member, which must not already exist
+        template< typename K, typename ... Args >
+        size_t append ( K &&name, Args &&...args )
         {
-            if ( !std::holds_alternative<arrayType> ( value ))
+            if ( entries.capacity () == entries.size () && entries.capacity () < initialCapacity )
             {
-                value = arrayType ();
+                entries.reserve ( initialCapacity );
             }
-            auto &arr = std::get<arrayType> ( value );
-            if ((size_t) index == arr.size ())
+            entries.emplace_back ( std::piecewise_construct, std::forward_as_tuple ( std::forward<K> ( name )), std::forward_as_tuple ( std::forward<Args> ( args )... ));
+            auto pos = entries.size () - 1;
+            if ( !index.empty () && entries.size () * 2 <= index.size ())
             {
-                if ( arr.capacity () <= (size_t) index + 1 )
+                addToIndex ( pos );
+            } else if ( entries.size () > hashThreshold )
+            {
+                rebuildIndex ();
+            }
+            return pos;
+        }
+
+    public:
+        jsonObjectStorage () = default;
+
+        jsonObjectStorage ( std::initializer_list<value_type> init )
+        {
+            insert ( init.begin (), init.end ());
+        }
+
+        template< typename IT >
+        jsonObjectStorage ( IT first, IT last )
+        {
+            insert ( first, last );
+        }
+
+        // returns the value for name, creating a null value if it doesn't exist
+        V &operator[] ( std::string_view name )
+        {
+            auto pos = lookup ( name );
+            if ( pos == entries.size ())
+            {
+                pos = append ( name );
+            }
+            return entries[pos].second;
+        }
+
+        V &operator[] ( std::string const &name )
+        {
+            return (*this)[std::string_view ( name )];
+        }
+
+        V &operator[] ( char const *name )
+        {
+            return (*this)[std::string_view ( name )];
+        }
+
+        iterator find ( std::string_view name )
+        {
+            return entries.begin () + (std::ptrdiff_t) lookup ( name );
+        }
+
+        const_iterator find ( std::string_view name ) const
+        {
+            return entries.cbegin () + (std::ptrdiff_t) lookup ( name );
+        }
+
+        bool contains ( std::string_view name ) const
+        {
+            return lookup ( name ) != entries.size ();
+        }
+
+        // as with std::map, inserting an existing name leaves the existing value alone
+        std::pair<iterator, bool> insert ( value_type const &v )
+        {
+            auto pos = lookup ( v.first );
+            if ( pos != entries.size ())
+            {
+                return {entries.begin () + (std::ptrdiff_t) pos, false};
+            }
+            pos = append ( v.first, v.second );
+            return {entries.begin () + (std::ptrdiff_t) pos, true};
+        }
+
+        template< typename IT >
+        void insert ( IT first, IT last )
+        {
+            for ( ; first != last; ++first )
+            {
+                if ( lookup ( first->first ) == entries.size ())
                 {
-                    arr.reserve ((size_t) index + 256 );
+                    append ( first->first, first->second );
                 }
-                arr.resize ((size_t) index + 1 );
             }
-            return arr[index];
         }
 
-        // allows for emplacement of a new value for an array jsonElement
-        template< typename ...T >
-        void emplace_back ( T &&...t )
+        iterator begin ()
         {
-            if ( !std::holds_alternative<arrayType> ( value ))
+            return entries.begin ();
+        }
+
+        iterator end ()
+        {
+            return entries.end ();
+        }
+
+        const_iterator begin () const
+        {
+            return entries.cbegin ();
+        }
+
+        const_iterator end () const
+        {
+            return entries.cend ();
+        }
+
+        const_iterator cbegin () const
+        {
+            return entries.cbegin ();
+        }
+
+        const_iterator cend () const
+        {
+            return entries.cend ();
+        }
+
+        size_t size () const
+        {
+            return entries.size ();
+        }
+
+        bool empty () const
+        {
+            return entries.empty ();
+        }
+
+        void clear ()
+        {
+            entries.clear ();
+            index.clear ();
+        }
+    };
+
+    class jsonStreamParser;
+    class jsonCborParser;
+    class jsonTemplate;
+
+    class jsonElement
+    {
+        friend class jsonStreamParser;
+        friend class jsonCborParser;
+
+    public:
+        typedef jsonObjectStorage <jsonElement> objectType;
+        typedef std::vector <jsonElement, jsonAllocator<jsonElement>> arrayType;
+        inline static struct
+        {
+        } array{};            // this is used to force an indeterminate { "a, "b" } to be processed as an array and not as an object
+
+    private:
+
+        std::variant<std::monostate, int64_t, double, std::string, objectType, arrayType, bool, decltype ( array )> value;
+
+        template< typename, typename >
+        struct is_associative_container
+        {
+            static constexpr bool value = false;
+        };
+
+        template< typename C >
+        struct is_associative_container<C, typename C::mapped_type>
+        {
+            static constexpr bool value = true;
+        };
+
+        template< typename, typename, typename >
+        struct is_sequence_container
+        {
+            static constexpr bool value = false;
+        };
+
+        template< typename C >
+        struct is_sequence_container<C, typename C::value_type, decltype ( std::declval<C> ().clear ())>
+        {
+            static constexpr bool value = true;
+        };
+
+    public:
+        jsonElement ()
+        {}
+
+        template< typename T >
+        jsonElement ( std::string const &name, T v )
+        {
+            if constexpr ( std::is_same_v < bool, T > )
             {
-                value = arrayType ();
+                value = objectType{{name, (bool) v}};
+            } else
+            {
+                value = objectType{{name, v}};
             }
-            auto &arr = std::get<arrayType> ( value );
-            arr.emplace_back ( std::forward<T...> ( t... ));
         }
 
-        // reference accessors
-        operator bool & ()
+        // the constructor takes an initializer list
+        //     if it's a fundamental value (int64_t, bool, double, std::string} it simply creates a jsonElement that holds that type
+        //     if it's an object of type { "name", "value" } it interprets this as a name value pair and adds this to the surrounding object;
+        //     if it's a list of more than two values, it is interpreted as an array.   Alternately if it is two values exactly, an array
+        //     can be declared as { jsonElement::array(), "one", "two" }   If a jsonElement::array() is detected it is treated as a flag
+        //     and does not become part of the json data
+        jsonElement ( std::initializer_list <jsonElement> i )
         {
-            if ( std::holds_alternative<int64_t> ( value ))
+            if ( i.size () == 2 )
             {
-                value = std::get<int64_t> ( value ) ? true : false;
-            } else if ( !std::holds_alternative<bool> ( value ))
+                if ( std::holds_alternative<std::string> ( i.begin ()->value ))
+                {
+                    value = objectType{{std::get<std::string> ( i.begin ()->value ), std::next ( i.begin ())->value}};
+                    return;
+                }
+            }
+            bool isObject = true;
+            for ( auto &it: i )
             {
-                value = false;
+                if ( !std::holds_alternative<objectType> ( it.value ))
+                {
+                    isObject = false;
+                    break;
+                }
+            }
+
+            if ( isObject )
+            {
+                if ( !std::holds_alternative<objectType> ( value ))
+                {
+                    value = objectType ();
+                }
+                auto &obj = std::get<objectType> ( value );
+                for ( auto &it: i )
+                {
+                    auto &elem = std::get<objectType> ( it.value );
+
+                    obj.insert ( elem.begin (), elem.end ());
+                }
+            } else
+            {
+                if ( !std::holds_alternative<arrayType> ( value ))
+                {
+                    value = arrayType ();
+                }
+                auto &arr = std::get<arrayType> ( value );
+                for ( auto &it: i )
+                {
+                    // if it's of type array() ignore the value.  This is just to indicate that we process as an array and not as an object
+                    if ( !std::holds_alternative<decltype ( array )> ( it.value ))
+                    {
+                        arr.push_back ( it );
+                    }
+                }
+            }
+        }
+
+        // initializer for an associative container.
+        template< class T, typename std::enable_if_t<is_associative_container<T, T>::value> * = nullptr >
+        jsonElement ( T const &o ) : value ( objectType ( o.cbegin (), o.cend ()))
+        {}
+
+        // initializer for an array
+        template< class T, typename std::enable_if_t<is_sequence_container<T, T, T>::value> * = nullptr >
+        jsonElement ( T const &a ) : value ( arrayType ( a.cbegin (), a.cend ()))
+        {}
+
+        // for array... needs to have a vector type of <jsonElement>
+        template< class T, typename std::enable_if_t<!is_sequence_container<T, T, T>::value && !is_associative_container<T, T>::value> * = nullptr >
+        jsonElement ( T const &v )
+        {
+            if constexpr ( std::is_same_v<const char *, T> )
+            {
+                value = std::string ( v );
+            } else if constexpr ( std::is_same_v < bool, T > )
+            {
+                value = (bool) v;
+            } else if constexpr ((std::is_integral_v < T > || std::is_enum_v < T > ) && !std::is_same_v < bool, T > )
+            {
+                value = (int64_t) v;
+            } else if constexpr ( std::is_floating_point_v < T > )
+            {
+                value = (double) v;
+            } else
+            {
+                value = v;
+            }
+        }
+
+        virtual ~jsonElement ()
+        {}
+
+        //move constructor
+        jsonElement ( jsonElement &&old )
+
+        noexcept
+        {
+            *this = std::move ( old );
+        }
+
+        // copy constructor
+        jsonElement ( jsonElement const &old )
+        {
+            value = old.value;
+        }
+
+        // copy operator
+        jsonElement &operator= ( jsonElement const &old )
+        {
+            value = old.value;
+            return *this;
+        }
+
+        // move operator
+        jsonElement &operator= ( jsonElement &&old )
+
+        noexcept
+        {
+            // free it an initialize it to the old type and copy old into us
+            std::swap ( value, old.value );
+            return *this;
+        }
+
+#if 1 // __cplusplus == 201703L
+         template <typename T>
+         using remove_cvref_t = typename std::remove_cv<typename std::remove_reference<T>::type>::type;
+
+         template< class T, typename std::enable_if_t<((std::is_arithmetic_v<T> || std::is_enum_v<T>)) &&
+                     !std::is_same_v<jsonElement, remove_cvref_t<T>>>* = nullptr>
+#else
+        // assignment operator for arithmetic types (bool, int, double)
+        template< class T, typename std::enable_if_t<((std::is_arithmetic_v < T > || std::is_enum_v < T > )) && !std::is_same_v < jsonElement, typename std::remove_cvref_t<T>::type>> * = nullptr>
+#endif
+
+        jsonElement &operator= ( T const &v )
+        {
+            if constexpr ( std::is_same_v < bool, T > )
+            {
+                value = v;
+            } else if constexpr ( std::is_integral_v < T > || std::is_enum_v < T > && !std::is_same_v < bool, T > )
+            {
+                value = (int64_t) v;
+            } else if constexpr ( std::is_floating_point_v < T > )
+            {
+                value = (double) v;
+            } else
+            {
+                value = v;
+            }
+            return *this;
+        }
+
+        // assignment operator for strings or string convertibles
+        template< class T, typename std::enable_if_t<!std::is_arithmetic_v < T> && !std::is_enum_v <T> > * = nullptr>
+
+        jsonElement &operator= ( T const &v )
+        {
+            value = std::string ( v );
+            return *this;
+        }
+
+        // ----------------------------------------------- assignment methods
+
+        // this returns a reference to an object with property name.     obj[std::string("name")]
+        template< typename T, typename std::enable_if_t<std::is_same_v < T, std::string_view>> * = nullptr>
+
+        jsonElement &operator[] ( T const &name )
+        {
+            if ( !std::holds_alternative<objectType> ( value ))
+            {
+                value = objectType ();
+            }
+            auto &obj = std::get<objectType> ( value );
+            return obj[name];
+        }
+
+        // same as above except we take in a const char * as name rather than a std::string
+        template< typename T, typename std::enable_if_t<std::is_same_v<T, const char *>> * = nullptr >
+        jsonElement &operator[] ( T name )
+        {
+            if ( !std::holds_alternative<objectType> ( value ))
+            {
+                value = objectType ();
+            }
+            auto &obj = std::get<objectType> ( value );
+            return obj[name];
+        }
+
+        // array dereference operator, returns a reference to the <index> element (0-based).    obj[<index>]
+        template< typename T, typename std::enable_if_t<std::is_integral_v < T>> * = nullptr>
+
+        jsonElement &operator[] ( T index )
+        {
+            if ( !std::holds_alternative<arrayType> ( value ))
+            {
+                value = arrayType ();
+            }
+            auto &arr = std::get<arrayType> ( value );
+            if ((size_t) index == arr.size ())
+            {
+                if ( arr.capacity () <= (size_t) index + 1 )
+                {
+                    arr.reserve ((size_t) index + 256 );
+                }
+                arr.resize ((size_t) index + 1 );
+            }
+            return arr[index];
+        }
+
+        // allows for emplacement of a new value for an array jsonElement
+        template< typename ...T >
+        void emplace_back ( T &&...t )
+        {
+            if ( !std::holds_alternative<arrayType> ( value ))
+            {
+                value = arrayType ();
+            }
+            auto &arr = std::get<arrayType> ( value );
+            arr.emplace_back ( std::forward<T...> ( t... ));
+        }
+
+        // reference accessors
+        operator bool & ()
+        {
+            if ( std::holds_alternative<int64_t> ( value ))
+            {
+                value = std::get<int64_t> ( value ) ? true : false;
+            } else if ( !std::holds_alternative<bool> ( value ))
+            {
+                value = false;
+            }
+            return std::get<bool> ( value );
+        }
+
+        operator int64_t & ()
+        {
+            if ( std::holds_alternative<double> ( value ))
+            {
+                value = (int64_t) std::get<double> ( value );
+            }
+            if ( !std::holds_alternative<int64_t> ( value ))
+            {
+                value = (int64_t) 0;
+            }
+            return std::get<int64_t> ( value );
+        }
+
+        operator double & ()
+        {
+            if ( std::holds_alternative<int64_t> ( value ))
+            {
+                value = (double) std::get<int64_t> ( value );
+            } else if ( !std::holds_alternative<double> ( value ))
+            {
+                value = 0.0;
+            }
+            return std::get<double> ( value );
+        }
+
+        operator std::string & ()
+        {
+            if ( std::holds_alternative<int64_t> ( value ))
+            {
+                value = (double) std::get<int64_t> ( value );
+            } else if ( !std::holds_alternative<std::string> ( value ))
+            {
+                value = std::string ();
+            }
+            return std::get<std::string> ( value );
+        }
+
+        // resets the jsonElement to monostate (no valid state)
+        void clear ()
+        {
+            value = std::monostate ();
+        }
+
+        // turns the jsonElement into a 0-length array (we ended up with a [] being emitted upon serialization)
+        jsonElement &makeArray ()
+        {
+            if ( std::holds_alternative<arrayType> ( value ))
+            {
+            } else if ( std::holds_alternative<std::monostate> ( value ))
+            {
+                value = arrayType ();
+            } else
+            {
+                throw "cannot be made an array";
+            }
+            return *this;
+        }
+
+        // turns the jsonElement into an object with no elements (a {} will be emitted upon serialization)
+        jsonElement &makeObject ()
+        {
+            if ( std::holds_alternative<objectType> ( value ))
+            {
+            }
+            if ( std::holds_alternative<std::monostate> ( value ))
+            {
+                value = objectType ();
+            } else
+            {
+                throw "cannot be made an array";
+            }
+            return *this;
+        }
+
+        // ------------------------------------- reader functions
+
+        // used to test to see if an object contains a specific named element
+        bool has ( std::string_view const &name ) const
+        {
+            if ( std::holds_alternative<objectType> ( value ))
+            {
+                auto &obj = std::get<objectType> ( value );
+                auto it = obj.find ( name );
+                if ( it != obj.end ())
+                {
+                    if ( std::holds_alternative<std::monostate> ( it->second.value ))
+                    {
+                        return false;
+                    }
+                    return true;
+                }
+                return false;
+            }
+            return false;
+        }
+
+        // has () and operator [] in a single lookup.  returns the named value, or nullptr if there is none (as with has (), a null value counts as not being there)
+        jsonElement const *find ( std::string_view const &name ) const
+        {
+            if ( std::holds_alternative<objectType> ( value ))
+            {
+                auto &obj = std::get<objectType> ( value );
+                auto it = obj.find ( name );
+                if ( it != obj.end () && !std::holds_alternative<std::monostate> ( it->second.value ))
+                {
+                    return &it->second;
+                }
+            }
+            return nullptr;
+        }
+
+        // constant returned reference for the indexed value of a jsonElement array
+        template< typename T, typename std::enable_if_t<std::is_integral_v < T>> * = nullptr>
+
+        jsonElement const &operator[] ( T index ) const
+        {
+            if ( std::holds_alternative<arrayType> ( value ))
+            {
+                auto &arr = std::get<arrayType> ( value );
+                if ((size_t) index < arr.size ())
+                {
+                    return arr[(size_t) index];
+                }
+                throw "element not found";
+            }
+            throw "element not found";
+        }
+
+        // constant returned reference for the std::string(<named>) value of the jsonElement object
+        template< typename T, typename std::enable_if_t<std::is_same_v < T, std::string_view>> * = nullptr>
+
+        jsonElement const &operator[] ( T const &name ) const
+        {
+            if ( std::holds_alternative<objectType> ( value ))
+            {
+                auto &obj = std::get<objectType> ( value );
+                auto it = obj.find ( name );
+                if ( it != obj.end ())
+                {
+                    if ( std::holds_alternative<std::monostate> ( it->second.value ))
+                    {
+                        throw "element not found";
+                    }
+                    return it->second;
+                }
+                throw "element not found";
+            }
+            throw "element not found";
+        }
+
+        // constant returned reference for the (const char *)(<named>) value of the jsonElement object
+        template< typename T, typename std::enable_if_t<std::is_same_v < T, char const *>> * = nullptr>
+
+        auto &operator[] ( T name ) const
+        {
+            return (*this)[std::string_view ( name )];
+        }
+
+        // push a value to the back of a jsonElement array
+        void push_back ( jsonElement const &elem )
+        {
+            makeArray ();
+            auto &arr = std::get<arrayType> ( value );
+            arr.push_back ( elem );
+        }
+
+        // reserve size elements in the jsonElement array
+        jsonElement &reserve ( size_t size )
+        {
+            if ( std::holds_alternative<arrayType> ( value ))
+            {
+            } else if ( std::holds_alternative<std::monostate> ( value ))
+            {
+                value = arrayType ();
+            } else
+            {
+                throw "cannot be made an array";
+            }
+            auto &arr = std::get<arrayType> ( value );
+            arr.reserve ( size );
+
+            return *this;
+        }
+
+        // constant begin iterator for jsonElement object
+        auto cbeginObject () const
+        {
+            if ( std::holds_alternative<objectType> ( value ))
+            {
+                auto &obj = std::get<objectType> ( value );
+                return obj.cbegin ();
+            }
+            throw "json iterating over not object";
+        }
+
+        // constant end iterator for jsonElementObject
+        auto cendObject () const
+        {
+            if ( std::holds_alternative<objectType> ( value ))
+            {
+                auto &obj = std::get<objectType> ( value );
+                return obj.cend ();
+            }
+            throw "json iterating over not object";
+        }
+
+        // constant begin iterator for jsonElement array
+        auto cbeginArray () const
+        {
+            if ( std::holds_alternative<arrayType> ( value ))
+            {
+                auto &arr = std::get<arrayType> ( value );
+                return arr.cbegin ();
+            }
+            throw "json iterating over non array";
+        }
+
+        // constant end iterator for jsonElement array
+        auto cendArray () const
+        {
+            if ( std::holds_alternative<arrayType> ( value ))
+            {
+                auto &arr = std::get<arrayType> ( value );
+                return arr.cend ();
+            }
+            throw "json iterating over non array";
+        }
+
+        // prototype for the value accessors
+        operator int64_t const () const
+        {
+            if ( std::holds_alternative<int64_t> ( value ))
+            {
+                return std::get<int64_t> ( value );
+            }
+            throw "invalid json integer value";
+        }
+
+        operator bool const () const
+        {
+            if ( std::holds_alternative<bool> ( value ))
+            {
+                return std::get<bool> ( value );
+            }
+            throw "invalid json integer value";
+        }
+
+        operator double const () const
+        {
+            if ( std::holds_alternative<double> ( value ))
+            {
+                return std::get<double> ( value );
+            }
+            throw "invalid json double value";
+        }
+
+        operator std::string const & () const
+        {
+            if ( std::holds_alternative<std::string> ( value ))
+            {
+                return std::get<std::string> ( value );
+            }
+            throw "invalid json string value";
+        }
+
+        size_t size () const
+        {
+            if ( std::holds_alternative<objectType> ( value ))
+            {
+                auto &obj = std::get<objectType> ( value );
+                return obj.size ();
+            } else if ( std::holds_alternative<arrayType> ( value ))
+            {
+                auto &arr = std::get<arrayType> ( value );
+                return arr.size ();
+            } else if ( std::holds_alternative<std::monostate> ( value ))
+            {
+                return 0;
+            }
+            throw "invalid usage";
+        }
+
+        // testers.  pretty self-explanatory
+        bool isNull () const
+        {
+            if ( std::holds_alternative<std::monostate> ( value ))
+            {
+                return true;
+            } else
+            {
+                return false;
+            }
+        }
+
+        bool isArray () const
+        {
+            if ( std::holds_alternative<arrayType> ( value ))
+            {
+                return true;
+            } else
+            {
+                return false;
+            }
+        }
+
+        bool isObject () const
+        {
+            if ( std::holds_alternative<objectType> ( value ))
+            {
+                return true;
+            } else
+            {
+                return false;
+            }
+        }
+
+        bool isInteger () const
+        {
+            if ( std::holds_alternative<int64_t> ( value ))
+            {
+                return true;
+            } else
+            {
+                return false;
+            }
+        }
+
+        bool isDouble () const
+        {
+            if ( std::holds_alternative<double> ( value ))
+            {
+                return true;
+            } else
+            {
+                return false;
+            }
+        }
+
+        bool isString () const
+        {
+            if ( std::holds_alternative<std::string> ( value ))
+            {
+                return true;
+            } else
+            {
+                return false;
+            }
+        }
+
+        bool isBool () const
+        {
+            if ( std::holds_alternative<bool> ( value ))
+            {
+                return true;
+            } else
+            {
+                return false;
+            }
+        }
+
+        // ------------------------------- serialization
+        // turns jsonElement's into a json string.
+        // if quoteNames controls whether the name of an object value is quoted   ie.  "name" : value
+        // all of the serializers run write () twice, once with a writer that only counts so the output can be sized exactly, and then for real straight into the destination
+        size_t serializedSize ( bool quoteNames ) const
+        {
+            sizeWriter w;
+            write ( w, quoteNames );
+            return w.size;
+        }
+
+        // appends to buff, growing it once
+        void serialize ( std::string &buff, bool quoteNames ) const
+        {
+            auto start = buff.size ();
+            buff.resize ( start + serializedSize ( quoteNames ));
+            bufferWriter w{ buff.data () + start };
+            write ( w, quoteNames );
+        }
+
+        // serializes into a caller supplied buffer (for instance the memory that will become an mqtt message payload) and returns the number of bytes used.
+        // no terminating NUL is written.  Throws, without writing anything, if the output doesn't fit into len bytes
+        size_t serialize ( char *buff, size_t len, bool quoteNames ) const
+        {
+            auto size = serializedSize ( quoteNames );
+            if ( size > len )
+            {
+                throw "serialization buffer too small";
+            }
+            bufferWriter w{ buff };
+            write ( w, quoteNames );
+            return size;
+        }
+
+        // the same as CBOR (RFC 8949) rather than json text.   Values map directly onto CBOR's types, doubles that a float holds exactly are sent as floats and strings
+        // that aren't valid UTF-8 go as byte strings, so binary data is carried as is rather than escaped
+        size_t serializedSizeCBOR () const
+        {
+            sizeWriter w;
+            writeCBOR ( w );
+            return w.size;
+        }
+
+        // appends the CBOR encoding to buff, growing it once
+        void serializeCBOR ( std::string &buff ) const
+        {
+            auto start = buff.size ();
+            buff.resize ( start + serializedSizeCBOR ());
+            bufferWriter w{ buff.data () + start };
+            writeCBOR ( w );
+        }
+
+    private:
+        friend class jsonTemplate;
+
+        // writers used by write ()
+        struct sizeWriter
+        {
+            size_t size = 0;
+
+            void put ( char )
+            {
+                size++;
+            }
+
+            void append ( char const *, size_t len )
+            {
+                size += len;
+            }
+        };
+
+        // writes into memory already known to be large enough
+        struct bufferWriter
+        {
+            char *p;
+
+            void put ( char c )
+            {
+                *p++ = c;
+            }
+
+            void append ( char const *str, size_t len )
+            {
+                memcpy ( p, str, len );
+                p += len;
+            }
+        };
+
+        // numbers are formatted into a small stack buffer, so there's no temporary string per value
+        static constexpr size_t numberBufferSize = 32;
+
+        static size_t formatNumber ( char *buff, int64_t v )
+        {
+            return (size_t) (std::to_chars ( buff, buff + numberBufferSize, v ).ptr - buff);
+        }
+
+        static size_t formatNumber ( char *buff, double v )
+        {
+            // shortest representation that reads back as the same value
+            auto len = (size_t) (std::to_chars ( buff, buff + numberBufferSize - 2, v ).ptr - buff);
+            // keep a fractional part so the value parses back as a double rather than an integer (nan and inf have an 'n' and are left alone)
+            if ( !memchr ( buff, '.', len ) && !memchr ( buff, 'e', len ) && !memchr ( buff, 'n', len ))
+            {
+                buff[len++] = '.';
+                buff[len++] = '0';
+            }
+            return len;
+        }
+
+        template< typename W >
+        void write ( W &w, bool quoteNames ) const
+        {
+            if ( std::holds_alternative<objectType> ( value ))
+            {
+                auto &obj = std::get<objectType> ( value );
+                w.put ( '{' );
+                bool first = true;
+                for ( auto &&[name, v]: obj )
+                {
+                    if ( !first )
+                    {
+                        w.put ( ',' );
+                    }
+                    first = false;
+                    if ( quoteNames )
+                        w.put ( '\"' );
+                    w.append ( name.data (), name.size ());
+                    if ( quoteNames )
+                        w.put ( '\"' );
+                    w.put ( ':' );
+                    v.write ( w, quoteNames );
+                }
+                w.put ( '}' );
+            } else if ( std::holds_alternative<arrayType> ( value ))
+            {
+                auto &arr = std::get<arrayType> ( value );
+                w.put ( '[' );
+                bool first = true;
+                for ( auto &it: arr )
+                {
+                    if ( !first )
+                    {
+                        w.put ( ',' );
+                    }
+                    first = false;
+                    it.write ( w, quoteNames );
+                }
+                w.put ( ']' );
+            } else if ( std::holds_alternative<int64_t> ( value ))
+            {
+                char buff[numberBufferSize];
+                w.append ( buff, formatNumber ( buff, std::get<int64_t> ( value )));
+            } else if ( std::holds_alternative<double> ( value ))
+            {
+                char buff[numberBufferSize];
+                w.append ( buff, formatNumber ( buff, std::get<double> ( value )));
+            } else if ( std::holds_alternative<std::string> ( value ))
+            {
+                auto &v = std::get<std::string> ( value );
+                w.put ( '\"' );
+                char const *p = v.data ();
+                char const *end = v.data () + v.size ();
+                for ( ;; )
+                {
+                    // copy the run of characters that need no escaping in one go, then deal with the one that stopped us (if any)
+                    auto run = jsonStringScan::findEscapable ( p, end );
+                    w.append ( p, (size_t) (run - p));
+                    if ( run == end )
+                    {
+                        break;
+                    }
+                    p = run + 1;
+                    auto it = *run;
+                    switch ( it )
+                    {
+                        case '\"':
+                            w.append ( "\\\"", 2 );
+                            break;
+                        case '\\':
+                            w.append ( "\\\\", 2 );
+                            break;
+                        case '\r':
+                            w.append ( "\\r", 2 );
+                            break;
+                        case '\n':
+                            w.append ( "\\n", 2 );
+                            break;
+                        case '\t':
+                            w.append ( "\\t", 2 );
+                            break;
+                        default:
+                            if ( it < 32 || it > 127 )
+                            {
+                                w.put ( '%' );
+                                w.put ( "0123456789ABCDEF"[(it & 0xF0) >> 4] );
+                                w.put ( "0123456789ABCDEF"[(it & 0x0F)] );
+                            } else
+                            {
+                                w.put ( it );
+                            }
+                    }
+                }
+                w.put ( '\"' );
+            } else if ( std::holds_alternative<bool> ( value ))
+            {
+                if ( std::get<bool> ( value ))
+                {
+                    w.append ( "true", 4 );
+                } else
+                {
+                    w.append ( "false", 5 );
+                }
+            } else if ( std::holds_alternative<std::monostate> ( value ))
+            {
+                w.append ( "null", 4 );
+            }
+        }
+
+        // a CBOR data item's head: the major type and its argument in as few bytes as will hold it
+        template< typename W >
+        static void writeCBORHead ( W &w, uint8_t major, uint64_t arg )
+        {
+            char head[9];
+            size_t len;
+            major <<= 5;
+            if ( arg < 24 )
+            {
+                head[0] = (char) (major | arg);
+                len = 1;
+            } else
+            {
+                len = arg <= 0xFF ? 2 : arg <= 0xFFFF ? 3 : arg <= 0xFFFFFFFF ? 5 : 9;
+                head[0] = (char) (major | (len == 2 ? 24 : len == 3 ? 25 : len == 5 ? 26 : 27));
+                for ( size_t loop = len - 1; loop; loop-- )
+                {
+                    head[loop] = (char) (arg & 0xFF);
+                    arg >>= 8;
+                }
+            }
+            w.append ( head, len );
+        }
+
+        template< typename W >
+        static void writeCBORString ( W &w, std::string_view str )
+        {
+            writeCBORHead ( w, isUtf8 ( str ) ? 3 : 2, str.size ());
+            w.append ( str.data (), str.size ());
+        }
+
+        static bool isUtf8 ( std::string_view str )
+        {
+            auto const *p = (uint8_t const *) str.data ();
+            auto const *end = p + str.size ();
+            while ( p < end )
+            {
+                // skip ascii 8 bytes at a time
+                if ( end - p >= 8 )
+                {
+                    uint64_t chunk;
+                    memcpy ( &chunk, p, 8 );
+                    if ( !(chunk & 0x8080808080808080ull) )
+                    {
+                        p += 8;
+                        continue;
+                    }
+                }
+                if ( *p < 0x80 )
+                {
+                    p++;
+                    continue;
+                }
+                // lead byte, the number of continuation bytes and the lowest code point that may use that many (anything lower is overlong)
+                size_t count;
+                uint32_t cp;
+                uint32_t lowest;
+                if ( (*p & 0xE0) == 0xC0 )
+                {
+                    count = 1;
+                    cp = *p & 0x1F;
+                    lowest = 0x80;
+                } else if ( (*p & 0xF0) == 0xE0 )
+                {
+                    count = 2;
+                    cp = *p & 0x0F;
+                    lowest = 0x800;
+                } else if ( (*p & 0xF8) == 0xF0 )
+                {
+                    count = 3;
+                    cp = *p & 0x07;
+                    lowest = 0x10000;
+                } else
+                {
+                    return false;
+                }
+                if ( (size_t) (end - p) <= count )
+                {
+                    return false;
+                }
+                for ( size_t loop = 1; loop <= count; loop++ )
+                {
+                    if ( (p[loop] & 0xC0) != 0x80 )
+                    {
+                        return false;
+                    }
+                    cp = (cp << 6) | (p[loop] & 0x3F);
+                }
+                if ( cp < lowest || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF) )
+                {
+                    return false;
+                }
+                p += count + 1;
+            }
+            return true;
+        }
+
+        template< typename W >
+        void writeCBOR ( W &w ) const
+        {
+            if ( std::holds_alternative<objectType> ( value ))
+            {
+                auto &obj = std::get<objectType> ( value );
+                writeCBORHead ( w, 5, obj.size ());
+                for ( auto &&[name, v]: obj )
+                {
+                    writeCBORString ( w, name );
+                    v.writeCBOR ( w );
+                }
+            } else if ( std::holds_alternative<arrayType> ( value ))
+            {
+                auto &arr = std::get<arrayType> ( value );
+                writeCBORHead ( w, 4, arr.size ());
+                for ( auto &it: arr )
+                {
+                    it.writeCBOR ( w );
+                }
+            } else if ( std::holds_alternative<int64_t> ( value ))
+            {
+                auto v = std::get<int64_t> ( value );
+                // negative integers are encoded as -1 - n
+                writeCBORHead ( w, v < 0 ? 1 : 0, v < 0 ? ~(uint64_t) v : (uint64_t) v );
+            } else if ( std::holds_alternative<double> ( value ))
+            {
+                auto v = std::get<double> ( value );
+                auto f = (float) v;
+                char buff[9];
+                if ( (double) f == v || v != v )
+                {
+                    uint32_t bits;
+                    memcpy ( &bits, &f, 4 );
+                    buff[0] = (char) 0xFA;
+                    for ( size_t loop = 4; loop; loop-- )
+                    {
+                        buff[loop] = (char) (bits & 0xFF);
+                        bits >>= 8;
+                    }
+                    w.append ( buff, 5 );
+                } else
+                {
+                    uint64_t bits;
+                    memcpy ( &bits, &v, 8 );
+                    buff[0] = (char) 0xFB;
+                    for ( size_t loop = 8; loop; loop-- )
+                    {
+                        buff[loop] = (char) (bits & 0xFF);
+                        bits >>= 8;
+                    }
+                    w.append ( buff, 9 );
+                }
+            } else if ( std::holds_alternative<std::string> ( value ))
+            {
+                writeCBORString ( w, std::get<std::string> ( value ));
+            } else if ( std::holds_alternative<bool> ( value ))
+            {
+                w.put ( std::get<bool> ( value ) ? (char) 0xF5 : (char) 0xF4 );
+            } else
+            {
+                w.put ( (char) 0xF6 );
+            }
+        }
+
+    public:
+        // helper methods for the json parser
+        static bool isSpace ( char const c )
+        {
+            if ((c == ' ') || (c == '\t') or (c == '\r') or (c == '\n'))
+            {
+                return true;
+            }
+            return false;
+        }
+
+        static bool isSymbolB ( char const c )
+        {
+            if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (c == '_'))
+            {
+                return true;
+            }
+            return false;
+        }
+
+        static bool isNum ( char const c )
+        {
+            if (((c >= '0') && (c <= '9')) || (c == '+') || (c == '-'))
+            {
+                return true;
+            }
+            return false;
+        }
+
+        static bool isNumB ( char const c )
+        {
+            if ( isNum ( c ) || (c == 'e'))
+            {
+                return true;
+            }
+            return false;
+        }
+
+        static bool isSymbol ( char const c )
+        {
+            if ( isSymbolB ( c ) || ((c >= '0') && (c <= '9')))
+            {
+                return true;
+            }
+            return false;
+        }
+    };
+
+    // non-recursive, length-bounded json parser
+    // data may be fed in as many pieces as desired (for instance as it arrives off the wire), the parser keeps its place between feed() calls.
+    // nesting is tracked on an explicit stack so deep documents can not overflow the C stack.
+    //     jsonStreamParser parser;
+    //     parser.feed ( buff1, len1 );
+    //     parser.feed ( buff2, len2 );
+    //     if ( parser.finish () == jsonStreamParser::status::complete ) { jsonElement result = parser.take (); }
+    class jsonStreamParser
+    {
+    public:
+        enum class status
+        {
+            incomplete,         // more input is needed to complete the document
+            complete,           // a full document has been parsed, only trailing whitespace may follow
+            error               // the document is malformed, error () has the reason
+        };
+
+        explicit jsonStreamParser ( size_t maxDepth = 1024 ) : maxDepth ( maxDepth )
+        {}
+
+        // reset the parser so it can be re-used for a new document (this keeps any already allocated scratch space)
+        void reset ()
+        {
+            root.clear ();
+            target = &root;
+            stack.clear ();
+            token.clear ();
+            parseState = state::value;
+            highSurrogate = 0;
+            errorText = nullptr;
+        }
+
+        // parse len bytes of the document
+        status feed ( char const *data, size_t len )
+        {
+            char const *p = data;
+            char const *end = data + len;
+
+            while ( p < end && parseState != state::failed )
+            {
+                switch ( parseState )
+                {
+                    case state::value:
+                        p = skipSpace ( p, end );
+                        if ( p < end )
+                        {
+                            p = startValue ( p );
+                        }
+                        break;
+                    case state::objectFirst:
+                    case state::objectKey:
+                        p = skipSpace ( p, end );
+                        if ( p < end )
+                        {
+                            if ( *p == '"' )
+                            {
+                                token.clear ();
+                                parseState = state::key;
+                                p++;
+                            } else if ( *p == '}' )
+                            {
+                                // either an empty object or a trailing comma, both of which we accept
+                                p++;
+                                endContainer ();
+                            } else if ( jsonElement::isSymbol ( *p ))
+                            {
+                                token.clear ();
+                                parseState = state::unquotedKey;
+                            } else
+                            {
+                                fail ( "invalid json symbol value" );
+                            }
+                        }
+                        break;
+                    case state::objectNext:
+                        p = skipSpace ( p, end );
+                        if ( p < end )
+                        {
+                            if ( *p == ',' )
+                            {
+                                parseState = state::objectKey;
+                            } else if ( *p == '}' )
+                            {
+                                endContainer ();
+                            } else
+                            {
+                                fail ( "missing comma" );
+                            }
+                            p++;
+                        }
+                        break;
+                    case state::colon:
+                        p = skipSpace ( p, end );
+                        if ( p < end )
+                        {
+                            if ( *p == ':' )
+                            {
+                                // the value is parsed directly into its slot in the object
+                                target = &std::get<jsonElement::objectType> ( stack.back ()->value )[token];
+                                parseState = state::value;
+                                p++;
+                            } else
+                            {
+                                fail ( "missing name/value separator" );
+                            }
+                        }
+                        break;
+                    case state::arrayFirst:
+                        p = skipSpace ( p, end );
+                        if ( p < end )
+                        {
+                            if ( *p == ']' )
+                            {
+                                p++;
+                                endContainer ();
+                            } else
+                            {
+                                nextArrayElement ();
+                            }
+                        }
+                        break;
+                    case state::arrayNext:
+                        p = skipSpace ( p, end );
+                        if ( p < end )
+                        {
+                            if ( *p == ',' )
+                            {
+                                nextArrayElement ();
+                            } else if ( *p == ']' )
+                            {
+                                endContainer ();
+                            } else
+                            {
+                                fail ( "missing comma" );
+                            }
+                            p++;
+                        }
+                        break;
+                    case state::key:
+                    case state::string:
+                    {
+                        // copy everything up to the next quote or escape in one go
+                        auto runEnd = jsonStringScan::findQuoteOrEscape ( p, end );
+                        if ( runEnd != p )
+                        {
+                            unpairedSurrogate ();
+                        }
+                        token.append ( p, runEnd );
+                        p = runEnd;
+                        if ( p < end )
+                        {
+                            if ( *p == '"' )
+                            {
+                                unpairedSurrogate ();
+                                endString ();
+                            } else
+                            {
+                                escapeReturn = parseState;
+                                parseState = state::escape;
+                            }
+                            p++;
+                        }
+                        break;
+                    }
+                    case state::escape:
+                        p = escape ( p );
+                        break;
+                    case state::unicode:
+                        p = unicode ( p, end );
+                        break;
+                    case state::unquotedKey:
+                    {
+                        auto start = p;
+                        while ( p < end && jsonElement::isSymbol ( *p ))
+                        {
+                            p++;
+                        }
+                        token.append ( start, p );
+                        if ( p < end )
+                        {
+                            parseState = state::colon;
+                        }
+                        break;
+                    }
+                    case state::number:
+                    {
+                        auto start = p;
+                        while ( p < end && isNumberChar ( *p ))
+                        {
+                            p++;
+                        }
+                        token.append ( start, p );
+                        if ( p < end )
+                        {
+                            endNumber ();
+                        }
+                        break;
+                    }
+                    case state::literal:
+                    {
+                        auto start = p;
+                        while ( p < end && *p >= 'a' && *p <= 'z' )
+                        {
+                            p++;
+                        }
+                        token.append ( start, p );
+                        if ( p < end )
+                        {
+                            endLiteral ();
+                        }
+                        break;
+                    }
+                    case state::done:
+                        p = skipSpace ( p, end );
+                        if ( p < end )
+                        {
+                            fail ( "invalid json" );
+                        }
+                        break;
+                    case state::failed:
+                        break;
+                }
             }
-            return std::get<bool> ( value );
+            return getStatus ();
         }
 
-        operator int64_t & ()
+        // signal that there is no more input.  This terminates any number or literal that runs up to the end of the input
+        status finish ()
         {
-            if ( std::holds_alternative<double> ( value ))
+            switch ( parseState )
             {
-                value = (int64_t) std::get<double> ( value );
+                case state::number:
+                    endNumber ();
+                    break;
+                case state::literal:
+                    endLiteral ();
+                    break;
+                default:
+                    break;
             }
-            if ( !std::holds_alternative<int64_t> ( value ))
+            if ( parseState != state::done && parseState != state::failed )
             {
-                value = (int64_t) 0;
+                fail ( "unexpected end of json" );
             }
-            return std::get<int64_t> ( value );
+            return getStatus ();
         }
 
-        operator double & ()
+        status getStatus () const
         {
-            if ( std::holds_alternative<int64_t> ( value ))
-            {
-                value = (double) std::get<int64_t> ( value );
-            } else if ( !std::holds_alternative<double> ( value ))
-            {
-                value = 0.0;
+            switch ( parseState )
+            {
+                case state::done:
+                    return status::complete;
+                case state::failed:
+                    return status::error;
+                default:
+                    return status::incomplete;
             }
-            return std::get<double> ( value );
         }
 
-        operator std::string & ()
+        // reason the parse failed (nullptr if it hasn't)
+        char const *error () const
         {
-            if ( std::holds_alternative<int64_t> ( value ))
-            {
-                value = (double) std::get<int64_t> ( value );
-            } else if ( !std::holds_alternative<std::string> ( value ))
-            {
-                value = std::string ();
-            }
-            return std::get<std::string> ( value );
+            return errorText;
         }
 
-        // resets the jsonElement to monostate (no valid state)
-        void clear ()
+        // the parsed document.  Only valid once feed() or finish() has returned complete
+        jsonElement &result ()
         {
-            value = std::monostate ();
+            return root;
         }
 
-        // turns the jsonElement into a 0-length array (we ended up with a [] being emitted upon serialization)
-        jsonElement &makeArray ()
+        jsonElement take ()
         {
-            if ( std::holds_alternative<arrayType> ( value ))
-            {
-            } else if ( std::holds_alternative<std::monostate> ( value ))
-            {
-                value = arrayType ();
-            } else
+            auto r = std::move ( root );
+            reset ();
+            return r;
+        }
+
+    private:
+        enum class state : uint8_t
+        {
+            value,
+            objectFirst,
+            objectKey,
+            objectNext,
+            colon,
+            arrayFirst,
+            arrayNext,
+            key,
+            string,
+            escape,
+            unicode,
+            unquotedKey,
+            number,
+            literal,
+            done,
+            failed
+        };
+
+        size_t maxDepth;
+        jsonElement root;
+        jsonElement *target = &root;            // where the value currently being parsed will be stored
+        std::vector<jsonElement *> stack;       // the containers we're nested inside of
+        std::string token;                      // the string, key, number or literal currently being parsed
+        state parseState = state::value;
+        state escapeReturn = state::string;     // the string state we return to after an escape sequence
+        uint32_t codePoint = 0;                 // accumulator for unicode escapes
+        uint32_t highSurrogate = 0;
+        uint8_t hexDigits = 0;
+        char const *errorText = nullptr;
+
+        void fail ( char const *text )
+        {
+            errorText = text;
+            parseState = state::failed;
+        }
+
+        static char const *skipSpace ( char const *p, char const *end )
+        {
+            while ( p < end && jsonElement::isSpace ( *p ))
             {
-                throw "cannot be made an array";
+                p++;
             }
-            return *this;
+            return p;
         }
 
-        // turns the jsonElement into an object with no elements (a {} will be emitted upon serialization)
-        jsonElement &makeObject ()
+        static bool isNumberChar ( char const c )
         {
-            if ( std::holds_alternative<objectType> ( value ))
+            return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+        }
+
+        // called once a value (scalar or container) has been completely parsed
+        void endValue ()
+        {
+            if ( stack.empty ())
             {
-            }
-            if ( std::holds_alternative<std::monostate> ( value ))
+                parseState = state::done;
+            } else if ( stack.back ()->isObject ())
             {
-                value = objectType ();
+                parseState = state::objectNext;
             } else
             {
-                throw "cannot be made an array";
+                parseState = state::arrayNext;
             }
-            return *this;
         }
 
-        // ------------------------------------- reader functions
-
-        // used to test to see if an object contains a specific named element
-        bool has ( std::string_view const &name ) const
+        void endContainer ()
         {
-            if ( std::holds_alternative<objectType> ( value ))
-            {
-                auto &obj = std::get<objectType> ( value );
-                auto it = obj.find ( name );
-                if ( it != obj.end ())
-                {
-                    if ( std::holds_alternative<std::monostate> ( it->second.value ))
-                    {
-                        return false;
-                    }
-                    return true;
-                }
-                return false;
-            }
-            return false;
+            stack.pop_back ();
+            endValue ();
         }
 
-        // constant returned reference for the indexed value of a jsonElement array
-        template< typename T, typename std::enable_if_t<std::is_integral_v < T>> * = nullptr>
-
-        jsonElement const &operator[] ( T index ) const
+        void beginContainer ()
         {
-            if ( std::holds_alternative<arrayType> ( value ))
+            if ( stack.size () >= maxDepth )
             {
-                auto &arr = std::get<arrayType> ( value );
-                if ((size_t) index < arr.size ())
-                {
-                    return arr[(size_t) index];
-                }
-                throw "element not found";
+                fail ( "json nested too deeply" );
+                return;
             }
-            throw "element not found";
+            stack.push_back ( target );
         }
 
-        // constant returned reference for the std::string(<named>) value of the jsonElement object
-        template< typename T, typename std::enable_if_t<std::is_same_v < T, std::string_view>> * = nullptr>
+        void nextArrayElement ()
+        {
+            auto &arr = std::get<jsonElement::arrayType> ( stack.back ()->value );
+            arr.emplace_back ();
+            target = &arr.back ();
+            parseState = state::value;
+        }
 
-        jsonElement const &operator[] ( T const &name ) const
+        char const *startValue ( char const *p )
         {
-            if ( std::holds_alternative<objectType> ( value ))
+            switch ( *p )
             {
-                auto &obj = std::get<objectType> ( value );
-                auto it = obj.find ( name );
-                if ( it != obj.end ())
-                {
-                    if ( std::holds_alternative<std::monostate> ( it->second.value ))
+                case '{':
+                    target->value = jsonElement::objectType ();
+                    beginContainer ();
+                    if ( parseState != state::failed )
                     {
-                        throw "element not found";
+                        parseState = state::objectFirst;
                     }
-                    return it->second;
-                }
-                throw "element not found";
+                    return p + 1;
+                case '[':
+                    target->value = jsonElement::arrayType ();
+                    beginContainer ();
+                    if ( parseState != state::failed )
+                    {
+                        parseState = state::arrayFirst;
+                    }
+                    return p + 1;
+                case '"':
+                    token.clear ();
+                    parseState = state::string;
+                    return p + 1;
+                case 't':
+                case 'f':
+                case 'n':
+                    token.clear ();
+                    parseState = state::literal;
+                    return p;
+                default:
+                    if ( (*p >= '0' && *p <= '9') || *p == '-' || *p == '+' )
+                    {
+                        token.clear ();
+                        parseState = state::number;
+                        return p;
+                    }
+                    fail ( "invalid json value" );
+                    return p;
             }
-            throw "element not found";
-        }
-
-        // constant returned reference for the (const char *)(<named>) value of the jsonElement object
-        template< typename T, typename std::enable_if_t<std::is_same_v < T, char const *>> * = nullptr>
-
-        auto &operator[] ( T name ) const
-        {
-            return (*this)[std::string_view ( name )];
         }
 
-        // push a value to the back of a jsonElement array
-        void push_back ( jsonElement const &elem )
+        void endString ()
         {
-            makeArray ();
-            auto &arr = std::get<arrayType> ( value );
-            arr.push_back ( elem );
+            if ( parseState == state::key )
+            {
+                parseState = state::colon;
+            } else
+            {
+                target->value = std::move ( token );
+                token.clear ();
+                endValue ();
+            }
         }
 
-        // reserve size elements in the jsonElement array
-        jsonElement &reserve ( size_t size )
+        void endNumber ()
         {
-            if ( std::holds_alternative<arrayType> ( value ))
+            char const *first = token.data ();
+            char const *last = token.data () + token.size ();
+            if ( first != last && *first == '+' )
             {
-            } else if ( std::holds_alternative<std::monostate> ( value ))
+                first++;
+            }
+            bool isFloat = token.find_first_of ( ".eE" ) != std::string::npos;
+            if ( !isFloat )
             {
-                value = arrayType ();
+                int64_t v;
+                auto [ptr, ec] = std::from_chars ( first, last, v );
+                if ( ec == std::errc () && ptr == last )
+                {
+                    target->value = v;
+                    endValue ();
+                    return;
+                }
+                if ( ec != std::errc::result_out_of_range )
+                {
+                    fail ( "invalid json number" );
+                    return;
+                }
+                // too big for an integer, fall through and store as a double
+            }
+            double v;
+            auto [ptr, ec] = std::from_chars ( first, last, v );
+            if ( ec == std::errc () && ptr == last )
+            {
+                target->value = v;
+                endValue ();
             } else
             {
-                throw "cannot be made an array";
+                fail ( "invalid json number" );
             }
-            auto &arr = std::get<arrayType> ( value );
-            arr.reserve ( size );
-
-            return *this;
         }
 
-        // constant begin iterator for jsonElement object
-        auto cbeginObject () const
+        void endLiteral ()
         {
-            if ( std::holds_alternative<objectType> ( value ))
+            if ( token == "true" )
             {
-                auto &obj = std::get<objectType> ( value );
-                return obj.cbegin ();
+                target->value = true;
+            } else if ( token == "false" )
+            {
+                target->value = false;
+            } else if ( token == "null" )
+            {
+                target->value = std::monostate ();
+            } else
+            {
+                fail ( "invalid json literal" );
+                return;
             }
-            throw "json iterating over not object";
+            endValue ();
         }
 
-        // constant end iterator for jsonElementObject
-        auto cendObject () const
+        // a high surrogate not followed by a low one is replaced by U+FFFD.   Called when anything other than a unicode escape follows it
+        void unpairedSurrogate ()
         {
-            if ( std::holds_alternative<objectType> ( value ))
+            if ( highSurrogate )
             {
-                auto &obj = std::get<objectType> ( value );
-                return obj.cend ();
+                appendUtf8 ( 0xFFFD );
+                highSurrogate = 0;
             }
-            throw "json iterating over not object";
         }
 
-        // constant begin iterator for jsonElement array
-        auto cbeginArray () const
+        char const *escape ( char const *p )
         {
-            if ( std::holds_alternative<arrayType> ( value ))
+            parseState = escapeReturn;
+            if ( *p != 'u' )
             {
-                auto &arr = std::get<arrayType> ( value );
-                return arr.cbegin ();
+                unpairedSurrogate ();
             }
-            throw "json iterating over non array";
-        }
-
-        // constant end iterator for jsonElement array
-        auto cendArray () const
-        {
-            if ( std::holds_alternative<arrayType> ( value ))
+            switch ( *p )
             {
-                auto &arr = std::get<arrayType> ( value );
-                return arr.cend ();
+                case 'b':
+                    token.push_back ( '\b' );
+                    break;
+                case 'f':
+                    token.push_back ( '\f' );
+                    break;
+                case 'n':
+                    token.push_back ( '\n' );
+                    break;
+                case 'r':
+                    token.push_back ( '\r' );
+                    break;
+                case 't':
+                    token.push_back ( '\t' );
+                    break;
+                case 'u':
+                    codePoint = 0;
+                    hexDigits = 0;
+                    parseState = state::unicode;
+                    break;
+                default:
+                    // covers \" \\ and \/ and, as we always have, passes any other escaped character through as is
+                    token.push_back ( *p );
+                    break;
             }
-            throw "json iterating over non array";
+            return p + 1;
         }
 
-        // prototype for the value accessors
-        operator int64_t const () const
+        char const *unicode ( char const *p, char const *end )
         {
-            if ( std::holds_alternative<int64_t> ( value ))
+            while ( p < end && hexDigits < 4 )
             {
-                return std::get<int64_t> ( value );
+                auto c = *p;
+                uint32_t digit;
+                if ( c >= '0' && c <= '9' )
+                {
+                    digit = c - '0';
+                } else if ( c >= 'a' && c <= 'f' )
+                {
+                    digit = c - 'a' + 10;
+                } else if ( c >= 'A' && c <= 'F' )
+                {
+                    digit = c - 'A' + 10;
+                } else
+                {
+                    fail ( "invalid json unicode escape" );
+                    return p;
+                }
+                codePoint = (codePoint << 4) | digit;
+                hexDigits++;
+                p++;
             }
-            throw "invalid json integer value";
+            if ( hexDigits == 4 )
+            {
+                if ( codePoint >= 0xD800 && codePoint <= 0xDBFF )
+                {
+                    // first half of a surrogate pair, the second half must follow as another unicode escape
+                    unpairedSurrogate ();
+                    highSurrogate = codePoint;
+                } else if ( codePoint >= 0xDC00 && codePoint <= 0xDFFF && highSurrogate )
+                {
+                    appendUtf8 ( 0x10000 + ((highSurrogate - 0xD800) << 10) + (codePoint - 0xDC00));
+                    highSurrogate = 0;
+                } else
+                {
+                    unpairedSurrogate ();
+                    appendUtf8 ( codePoint >= 0xD800 && codePoint <= 0xDFFF ? 0xFFFD : codePoint );
+                }
+                parseState = escapeReturn;
+            }
+            return p;
         }
 
-        operator bool const () const
+        void appendUtf8 ( uint32_t cp )
         {
-            if ( std::holds_alternative<bool> ( value ))
+            if ( cp < 0x80 )
             {
-                return std::get<bool> ( value );
+                token.push_back ( (char) cp );
+            } else if ( cp < 0x800 )
+            {
+                token.push_back ( (char) (0xC0 | (cp >> 6)));
+                token.push_back ( (char) (0x80 | (cp & 0x3F)));
+            } else if ( cp < 0x10000 )
+            {
+                token.push_back ( (char) (0xE0 | (cp >> 12)));
+                token.push_back ( (char) (0x80 | ((cp >> 6) & 0x3F)));
+                token.push_back ( (char) (0x80 | (cp & 0x3F)));
+            } else
+            {
+                token.push_back ( (char) (0xF0 | (cp >> 18)));
+                token.push_back ( (char) (0x80 | ((cp >> 12) & 0x3F)));
+                token.push_back ( (char) (0x80 | ((cp >> 6) & 0x3F)));
+                token.push_back ( (char) (0x80 | (cp & 0x3F)));
             }
-            throw "invalid json integer value";
         }
+    };
 
-        operator double const () const
+    // parses len bytes of json starting at str.  str need not be NUL-terminated so this can be run directly against a received buffer
+    inline jsonElement jsonParser ( char const *str, size_t len )
+    {
+        jsonStreamParser parser;
+        parser.feed ( str, len );
+        if ( parser.finish () != jsonStreamParser::status::complete )
         {
-            if ( std::holds_alternative<double> ( value ))
-            {
-                return std::get<double> ( value );
-            }
-            throw "invalid json double value";
+            throw parser.error ();
         }
+        return parser.take ();
+    }
 
-        operator std::string const & () const
+    inline jsonElement jsonParser ( char const *str )
+    {
+        return jsonParser ( str, strlen ( str ));
+    }
+
+    // as jsonParser but a malformed document is reported by returning the parser's error rather than throwing it
+    inline std::expected<jsonElement, char const *> jsonTryParse ( char const *str, size_t len )
+    {
+        jsonStreamParser parser;
+        parser.feed ( str, len );
+        if ( parser.finish () != jsonStreamParser::status::complete )
         {
-            if ( std::holds_alternative<std::string> ( value ))
-            {
-                return std::get<std::string> ( value );
-            }
-            throw "invalid json string value";
+            return std::unexpected ( parser.error () );
         }
+        return parser.take ();
+    }
 
-        size_t size () const
+    // non-recursive, length-bounded CBOR (RFC 8949) decoder producing the same jsonElement's as the json parser.   Byte and text strings both become strings, tags are
+    // skipped, undefined and unassigned simple values become null, and integers beyond the range of an int64_t become doubles.   Map keys must be strings.
+    // indefinite length strings, arrays and maps are accepted.   Nesting is tracked on an explicit stack, as with jsonStreamParser
+    class jsonCborParser
+    {
+        struct frame
         {
-            if ( std::holds_alternative<objectType> ( value ))
-            {
-                auto &obj = std::get<objectType> ( value );
-                return obj.size ();
-            } else if ( std::holds_alternative<arrayType> ( value ))
-            {
-                auto &arr = std::get<arrayType> ( value );
-                return arr.size ();
-            } else if ( std::holds_alternative<std::monostate> ( value ))
-            {
-                return 0;
-            }
-            throw "invalid usage";
+            jsonElement *container;
+            uint64_t remaining;         // items (or for maps, pairs) still to come, unless indefinite
+            bool indefinite;
+            bool isMap;
+        };
+
+        size_t maxDepth;
+        std::vector<frame> stack;
+        std::string key;
+        uint8_t const *p = nullptr;
+        uint8_t const *end = nullptr;
+        char const *errorText = nullptr;
+
+        bool fail ( char const *text )
+        {
+            errorText = text;
+            return false;
         }
 
-        // testers.  pretty self-explanatory
-        bool isNull () const
+        bool readBigEndian ( size_t len, uint64_t &v )
         {
-            if ( std::holds_alternative<std::monostate> ( value ))
+            if ( (size_t) (end - p) < len )
             {
-                return true;
-            } else
+                return fail ( "cbor document truncated" );
+            }
+            v = 0;
+            for ( size_t loop = 0; loop < len; loop++ )
             {
-                return false;
+                v = (v << 8) | *p++;
             }
+            return true;
         }
 
-        bool isArray () const
+        // reads an item's head.  indefinite is set (and arg left 0) for an additional info of 31
+        bool readHead ( uint8_t &major, uint8_t &info, uint64_t &arg, bool &indefinite )
         {
-            if ( std::holds_alternative<arrayType> ( value ))
+            if ( p == end )
             {
+                return fail ( "cbor document truncated" );
+            }
+            major = *p >> 5;
+            info = *p & 0x1F;
+            p++;
+            arg = 0;
+            indefinite = false;
+            if ( info < 24 )
+            {
+                arg = info;
                 return true;
-            } else
-            {
-                return false;
+            }
+            switch ( info )
+            {
+                case 24:
+                case 25:
+                case 26:
+                case 27:
+                    return readBigEndian ( size_t ( 1 ) << (info - 24), arg );
+                case 31:
+                    indefinite = true;
+                    return true;
+                default:
+                    return fail ( "invalid cbor additional information" );
             }
         }
 
-        bool isObject () const
+        // reads a byte or text string (major type 2 or 3) whose head has already been read, appending it to out
+        bool readString ( uint8_t major, uint64_t len, bool indefinite, std::string &out )
         {
-            if ( std::holds_alternative<objectType> ( value ))
+            if ( !indefinite )
             {
+                if ( (uint64_t) (end - p) < len )
+                {
+                    return fail ( "cbor document truncated" );
+                }
+                out.append ( (char const *) p, (size_t) len );
+                p += len;
                 return true;
-            } else
+            }
+            // a series of definite length chunks of the same type, ended by a break
+            for ( ;; )
             {
-                return false;
+                if ( p == end )
+                {
+                    return fail ( "cbor document truncated" );
+                }
+                if ( *p == 0xFF )
+                {
+                    p++;
+                    return true;
+                }
+                uint8_t chunkMajor, info;
+                uint64_t chunkLen;
+                bool chunkIndefinite;
+                if ( !readHead ( chunkMajor, info, chunkLen, chunkIndefinite ) )
+                {
+                    return false;
+                }
+                if ( chunkMajor != major || chunkIndefinite )
+                {
+                    return fail ( "invalid cbor string chunk" );
+                }
+                if ( !readString ( major, chunkLen, false, out ) )
+                {
+                    return false;
+                }
             }
         }
 
-        bool isInteger () const
+        bool readKey ()
         {
-            if ( std::holds_alternative<int64_t> ( value ))
+            uint8_t major, info;
+            uint64_t arg;
+            bool indefinite;
+            do
             {
-                return true;
-            } else
+                if ( !readHead ( major, info, arg, indefinite ) )
+                {
+                    return false;
+                }
+            } while ( major == 6 );
+            if ( major != 2 && major != 3 )
             {
-                return false;
+                return fail ( "cbor map key is not a string" );
             }
+            key.clear ();
+            return readString ( major, arg, indefinite, key );
         }
 
-        bool isDouble () const
+        static double halfToDouble ( uint16_t half )
         {
-            if ( std::holds_alternative<double> ( value ))
+            int exponent = (half >> 10) & 0x1F;
+            double mantissa = half & 0x3FF;
+            double v;
+            if ( !exponent )
             {
-                return true;
+                v = std::ldexp ( mantissa, -24 );
+            } else if ( exponent == 31 )
+            {
+                v = mantissa ? std::numeric_limits<double>::quiet_NaN () : std::numeric_limits<double>::infinity ();
             } else
             {
-                return false;
+                v = std::ldexp ( mantissa + 1024, exponent - 25 );
             }
+            return half & 0x8000 ? -v : v;
         }
 
-        bool isString () const
+        // reads one item into target.  Arrays and maps with members are left on the stack to be filled
+        bool readItem ( jsonElement &target )
         {
-            if ( std::holds_alternative<std::string> ( value ))
+            uint8_t major, info;
+            uint64_t arg;
+            bool indefinite;
+            do
             {
-                return true;
-            } else
+                // tags only qualify the item that follows, which we take as is
+                if ( !readHead ( major, info, arg, indefinite ) )
+                {
+                    return false;
+                }
+            } while ( major == 6 );
+
+            if ( indefinite && (major < 2 || major > 5) )
             {
-                return false;
+                return fail ( major == 7 ? "unexpected cbor break" : "invalid cbor additional information" );
+            }
+
+            switch ( major )
+            {
+                case 0:
+                    if ( arg <= (uint64_t) INT64_MAX )
+                    {
+                        target.value = (int64_t) arg;
+                    } else
+                    {
+                        target.value = (double) arg;
+                    }
+                    return true;
+                case 1:
+                    // -1 - arg
+                    if ( arg <= (uint64_t) INT64_MAX )
+                    {
+                        target.value = -1 - (int64_t) arg;
+                    } else
+                    {
+                        target.value = -1.0 - (double) arg;
+                    }
+                    return true;
+                case 2:
+                case 3:
+                {
+                    std::string str;
+                    if ( !readString ( major, arg, indefinite, str ) )
+                    {
+                        return false;
+                    }
+                    target.value = std::move ( str );
+                    return true;
+                }
+                case 4:
+                case 5:
+                    if ( major == 4 )
+                    {
+                        target.value = jsonElement::arrayType ();
+                        if ( !indefinite )
+                        {
+                            // every item takes at least a byte, so a count beyond what's left is malformed and mustn't be reserved
+                            if ( arg > (uint64_t) (end - p) )
+                            {
+                                return fail ( "cbor document truncated" );
+                            }
+                            std::get<jsonElement::arrayType> ( target.value ).reserve ( (size_t) arg );
+                        }
+                    } else
+                    {
+                        target.value = jsonElement::objectType ();
+                    }
+                    if ( indefinite || arg )
+                    {
+                        if ( stack.size () >= maxDepth )
+                        {
+                            return fail ( "cbor nested too deeply" );
+                        }
+                        stack.push_back ( { &target, arg, indefinite, major == 5 } );
+                    }
+                    return true;
+                default:
+                    switch ( info )
+                    {
+                        case 20:
+                            target.value = false;
+                            return true;
+                        case 21:
+                            target.value = true;
+                            return true;
+                        case 25:
+                            target.value = halfToDouble ( (uint16_t) arg );
+                            return true;
+                        case 26:
+                        {
+                            auto bits = (uint32_t) arg;
+                            float f;
+                            memcpy ( &f, &bits, 4 );
+                            target.value = (double) f;
+                            return true;
+                        }
+                        case 27:
+                        {
+                            double d;
+                            memcpy ( &d, &arg, 8 );
+                            target.value = d;
+                            return true;
+                        }
+                        default:
+                            // null, undefined and the simple values we have no equivalent for
+                            target.value = std::monostate ();
+                            return true;
+                    }
             }
         }
 
-        bool isBool () const
+    public:
+        explicit jsonCborParser ( size_t maxDepth = 1024 ) : maxDepth ( maxDepth )
+        {}
+
+        // decodes the single CBOR data item in the len bytes at data.   Returns false on failure, with error () giving the reason
+        bool parse ( char const *data, size_t len, jsonElement &result )
         {
-            if ( std::holds_alternative<bool> ( value ))
+            p = (uint8_t const *) data;
+            end = p + len;
+            stack.clear ();
+            errorText = nullptr;
+            result.clear ();
+
+            jsonElement *target = &result;
+            for ( ;; )
             {
-                return true;
-            } else
+                if ( !stack.empty () )
+                {
+                    // find where the next item goes, closing any containers that are complete
+                    auto &f = stack.back ();
+                    bool ended;
+                    if ( f.indefinite )
+                    {
+                        if ( p == end )
+                        {
+                            return fail ( "cbor document truncated" );
+                        }
+                        ended = *p == 0xFF;
+                        p += ended;
+                    } else
+                    {
+                        ended = !f.remaining;
+                    }
+                    if ( ended )
+                    {
+                        stack.pop_back ();
+                        if ( stack.empty () )
+                        {
+                            break;
+                        }
+                        continue;
+                    }
+                    f.remaining -= !f.indefinite;
+
+                    if ( f.isMap )
+                    {
+                        if ( !readKey () )
+                        {
+                            return false;
+                        }
+                        target = &std::get<jsonElement::objectType> ( f.container->value )[std::string_view ( key )];
+                    } else
+                    {
+                        auto &arr = std::get<jsonElement::arrayType> ( f.container->value );
+                        arr.emplace_back ();
+                        target = &arr.back ();
+                    }
+                }
+                auto depth = stack.size ();
+                if ( !readItem ( *target ) )
+                {
+                    return false;
+                }
+                if ( stack.empty () && !depth )
+                {
+                    // the document was a single scalar (or an empty container)
+                    break;
+                }
+            }
+            if ( p != end )
             {
-                return false;
+                return fail ( "trailing data after cbor document" );
             }
+            return true;
         }
 
-        // ------------------------------- serialization
-        // turns jsonElement's into a json string.
-        // if quoteNames controls whether the name of an object value is quoted   ie.  "name" : value
-        void serialize ( std::string &buff, bool quoteNames ) const
+        char const *error () const
         {
-            if ( std::holds_alternative<objectType> ( value ))
+            return errorText;
+        }
+    };
+
+    // decodes the len bytes of CBOR at data (see jsonCborParser), throwing the parser's error if it's malformed
+    inline jsonElement cborParser ( char const *data, size_t len )
+    {
+        jsonCborParser parser;
+        jsonElement result;
+        if ( !parser.parse ( data, len, result ) )
+        {
+            throw parser.error ();
+        }
+        return result;
+    }
+
+    // as cborParser but a malformed document is reported by returning the parser's error rather than throwing it
+    inline std::expected<jsonElement, char const *> cborTryParse ( char const *data, size_t len )
+    {
+        jsonCborParser parser;
+        jsonElement result;
+        if ( !parser.parse ( data, len, result ) )
+        {
+            return std::unexpected ( parser.error () );
+        }
+        return result;
+    }
+
+    // a pre-serialized json shape.   The structure of an example element (braces, names and separators) is serialized once, after which only the values need serializing.
+    // any element with the same shape can be rendered: objects with the same names in the same order, arrays of the same length.   The values themselves (anything that isn't an object or array) may change freely, including their type.
+    class jsonTemplate
+    {
+        struct node
+        {
+            bool isObject;
+            bool isArray;
+            size_t count;           // number of members for objects and arrays
+            std::string name;       // name of this value in its parent object
+        };
+
+        // pre-order walk of the shape
+        std::vector<node> nodes;
+        // fixed[i] is the text preceding value i, the final entry is the text after the last value
+        std::vector<std::string> fixed;
+        bool quoteNames;
+
+        void build ( jsonElement const &elem, std::string &text )
+        {
+            auto &n = nodes.emplace_back ( elem.isObject (), elem.isArray (), 0 );
+            if ( n.isObject )
             {
-                auto &obj = std::get<objectType> ( value );
-                buff.push_back ( '{' );
+                auto &obj = std::get<jsonElement::objectType> ( elem.value );
+                nodes.back ().count = obj.size ();
+                text.push_back ( '{' );
                 bool first = true;
                 for ( auto &&[name, v]: obj )
                 {
                     if ( !first )
                     {
-                        buff.push_back ( ',' );
+                        text.push_back ( ',' );
                     }
                     first = false;
                     if ( quoteNames )
-                        buff.push_back ( '\"' );
-                    buff.append ( name );
+                        text.push_back ( '\"' );
+                    text.append ( name );
                     if ( quoteNames )
-                        buff.push_back ( '\"' );
-                    buff.push_back ( ':' );
-                    v.serialize ( buff, quoteNames );
+                        text.push_back ( '\"' );
+                    text.push_back ( ':' );
+                    auto index = nodes.size ();
+                    build ( v, text );
+                    nodes[index].name = name;
                 }
-                buff.push_back ( '}' );
-            } else if ( std::holds_alternative<arrayType> ( value ))
+                text.push_back ( '}' );
+            } else if ( n.isArray )
             {
-                auto &arr = std::get<arrayType> ( value );
-                buff.push_back ( '[' );
+                auto &arr = std::get<jsonElement::arrayType> ( elem.value );
+                nodes.back ().count = arr.size ();
+                text.push_back ( '[' );
                 bool first = true;
                 for ( auto &it: arr )
                 {
                     if ( !first )
                     {
-                        buff.push_back ( ',' );
+                        text.push_back ( ',' );
                     }
                     first = false;
-                    it.serialize ( buff, quoteNames );
+                    build ( it, text );
                 }
-                buff.push_back ( ']' );
-            } else if ( std::holds_alternative<int64_t> ( value ))
-            {
-                auto v = std::get<int64_t> ( value );
-                buff.append ( std::to_string ( v ));
-            } else if ( std::holds_alternative<double> ( value ))
+                text.push_back ( ']' );
+            } else
             {
-                auto v = std::get<double> ( value );
-                buff.append ( std::to_string ( v ));
-            } else if ( std::holds_alternative<std::string> ( value ))
+                fixed.push_back ( std::move ( text ));
+                text.clear ();
+            }
+        }
+
+        // walks elem alongside the shape, writing the fixed text preceding each value and then the value.   Returns false as soon as elem departs from the shape
+        template< typename W >
+        bool write ( W &w, jsonElement const &elem, size_t &nodeNum, size_t &valueNum ) const
+        {
+            auto &n = nodes[nodeNum++];
+            if ( n.isObject )
             {
-                auto &v = std::get<std::string> ( value );
-                buff.push_back ( '\"' );
-                for ( auto &it: v )
+                if ( !elem.isObject () )
                 {
-                    switch ( it )
+                    return false;
+                }
+                auto &obj = std::get<jsonElement::objectType> ( elem.value );
+                if ( obj.size () != n.count )
+                {
+                    return false;
+                }
+                for ( auto &&[name, v]: obj )
+                {
+                    if ( name != nodes[nodeNum].name || !write ( w, v, nodeNum, valueNum ))
                     {
-                        case '\"':
-                            buff.append ( "\\\"", 2 );
-                            break;
-                        case '\\':
-                            buff.append ( "\\\\", 2 );
-                            break;
-                        case '\r':
-                            buff.append ( "\\r", 2 );
-                            break;
-                        case '\n':
-                            buff.append ( "\\n", 2 );
-                            break;
-                        case '\t':
-                            buff.append ( "\\t", 2 );
-                            break;
-                        default:
-                            if ( it < 32 || it > 127 )
-                            {
-                                buff.push_back ( '%' );
-                                buff.push_back ( "0123456789ABCDEF"[(it & 0xF0) >> 4] );
-                                buff.push_back ( "0123456789ABCDEF"[(it & 0x0F)] );
-                            } else
-                            {
-                                buff.push_back ( it );
-                            }
+                        return false;
                     }
                 }
-                buff.push_back ( '\"' );
-            } else if ( std::holds_alternative<bool> ( value ))
+            } else if ( n.isArray )
             {
-                if ( std::get<bool> ( value ))
+                if ( !elem.isArray () )
                 {
-                    buff.append ( "true", 4 );
-                } else
+                    return false;
+                }
+                auto &arr = std::get<jsonElement::arrayType> ( elem.value );
+                if ( arr.size () != n.count )
                 {
-                    buff.append ( "false", 5 );
+                    return false;
                 }
-            } else if ( std::holds_alternative<std::monostate> ( value ))
+                for ( auto &it: arr )
+                {
+                    if ( !write ( w, it, nodeNum, valueNum ))
+                    {
+                        return false;
+                    }
+                }
+            } else
             {
-                buff.append ( "null", 4 );
+                if ( elem.isObject () || elem.isArray () )
+                {
+                    return false;
+                }
+                auto &text = fixed[valueNum++];
+                w.append ( text.data (), text.size ());
+                elem.write ( w, quoteNames );
             }
+            return true;
         }
 
-        // helper methods for the json parser
-        static bool isSpace ( char const c )
+    public:
+        explicit jsonTemplate ( jsonElement const &shape, bool quoteNames = true ) : quoteNames ( quoteNames )
         {
-            if ((c == ' ') || (c == '\t') or (c == '\r') or (c == '\n'))
-            {
-                return true;
-            }
-            return false;
+            std::string text;
+            build ( shape, text );
+            fixed.push_back ( std::move ( text ));
         }
 
-        static bool isSymbolB ( char const c )
+        // size of elem rendered through this template, or nothing if elem doesn't have the template's shape
+        std::optional<size_t> renderedSize ( jsonElement const &elem ) const
         {
-            if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (c == '_'))
+            jsonElement::sizeWriter w;
+            size_t nodeNum = 0;
+            size_t valueNum = 0;
+            if ( !write ( w, elem, nodeNum, valueNum ))
             {
-                return true;
+                return {};
             }
-            return false;
+            return w.size + fixed.back ().size ();
         }
 
-        static bool isNum ( char const c )
+        // appends elem, serialized, to buff growing it once.   Returns false, leaving buff untouched, if elem doesn't have the template's shape
+        bool render ( jsonElement const &elem, std::string &buff ) const
         {
-            if (((c >= '0') && (c <= '9')) || (c == '+') || (c == '-'))
+            auto size = renderedSize ( elem );
+            if ( !size )
             {
-                return true;
+                return false;
             }
-            return false;
+            auto start = buff.size ();
+            buff.resize ( start + *size );
+            jsonElement::bufferWriter w{ buff.data () + start };
+            size_t nodeNum = 0;
+            size_t valueNum = 0;
+            write ( w, elem, nodeNum, valueNum );
+            w.append ( fixed.back ().data (), fixed.back ().size ());
+            return true;
         }
+    };
 
-        static bool isNumB ( char const c )
+    // templates for repeatedly serialized elements, keyed by (for instance) the topic they're published on.
+    // the template for a key is built from the first element serialized with it.   A key whose elements then change shape is serialized normally from then on,
+    // rebuilding a template every time would cost more than it saves.   Keys should be erased once they're no longer used (a telemetry stream stopping, say),
+    // and past MAX_TEMPLATES new keys aren't given templates
+    class jsonTemplateCache
+    {
+        constexpr static size_t MAX_TEMPLATES = 1024;
+
+        std::mutex access;
+        // nullptr for a key whose shape isn't stable
+        std::map<std::string, std::shared_ptr<jsonTemplate const>, std::less<>> templates;
+
+    public:
+        void serialize ( std::string_view key, jsonElement const &elem, std::string &buff )
         {
-            if ( isNum ( c ) || (c == 'e'))
+            std::shared_ptr<jsonTemplate const> tmpl;
+            bool known = false;
             {
-                return true;
+                std::lock_guard l1 ( access );
+                auto it = templates.find ( key );
+                if ( it != templates.end () )
+                {
+                    tmpl = it->second;
+                    known = true;
+                }
             }
-            return false;
-        }
+            if ( tmpl && tmpl->render ( elem, buff ))
+            {
+                return;
+            }
+            elem.serialize ( buff, true );
 
-        static bool isSymbol ( char const c )
-        {
-            if ( isSymbolB ( c ) || ((c >= '0') && (c <= '9')))
+            if ( tmpl )
             {
-                return true;
+                // the shape changed, stop using a template for this key
+                std::lock_guard l1 ( access );
+                if ( auto it = templates.find ( key ); it != templates.end () )
+                {
+                    it->second.reset ();
+                }
+            } else if ( !known )
+            {
+                tmpl = std::make_shared<jsonTemplate const> ( elem );
+                std::lock_guard l1 ( access );
+                if ( templates.size () < MAX_TEMPLATES )
+                {
+                    templates.try_emplace ( std::string ( key ), std::move ( tmpl ));
+                }
             }
-            return false;
         }
-    };
 
-    jsonElement jsonParser ( char const *str )
-    {
-        auto tmpStr = &str;
-        auto result = jsonElement ( tmpStr );
-        while ( jsonElement::isSpace ( **tmpStr ))
-            (*tmpStr)++;        // skip spaces and eol characters
-        if ( **tmpStr )
+        void erase ( std::string_view key )
         {
-            throw "invalid json";
+            std::lock_guard l1 ( access );
+            if ( auto it = templates.find ( key ); it != templates.end () )
+            {
+                templates.erase ( it );
+            }
         }
-        return result;
-    }
+    };
 };
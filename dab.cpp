@@ -60,40 +60,10 @@ public:
         DAB::jsonElement rsp;
 
         rsp["applications"].makeArray ();           // rsp will be an object with "applications" : []
-#ifdef _WIN32
-        std::string output = execCmd ( "taskList /NH /Fo CSV" );
-
-        for ( auto it = output.cbegin (); it != output.cend (); )
+        for ( auto const &process : DAB::listProcesses () )
         {
-            if ( *it == '"' )
-            {
-                it++;
-                std::string taskName;
-                while ( it != output.cend () && *it != '"' )
-                {
-                    taskName += *it;
-                    it++;
-                }
-                if ( it != output.cend () )
-                {
-                    it++;
-                }
-                rsp["applications"].push_back ( taskName );     // push our task name to the end of the applications array
-                while ( it != output.cend () && *it != '\n' )
-                {
-                    it++;
-                }
-                if ( it != output.cend () )
-                {
-                    it++;
-                }
-            } else
-            {
-                it++;
-            }
+            rsp["applications"].push_back ( process.name );     // push our task name to the end of the applications array
         }
-#else
-#endif
         return rsp;
     }
 
@@ -215,6 +185,11 @@ int main ( int argc, char *argv[] )
         // this creates the mqtt interface.  It takes the bridge and the ip address of the mqtt broker
         auto mqtt = DAB::dabMQTTInterface ( mqttBridge, argv[1] );
 
+        // if the broker goes away, keep trying to get back to it (after up to 1 second, backing off to a minute between attempts).   The broker holds on to
+        // our session for 5 minutes, so reconnecting within that time doesn't need to subscribe again
+        mqtt.setReconnect ( std::chrono::seconds ( 1 ), std::chrono::minutes ( 1 ) );
+        mqtt.setSessionExpiry ( std::chrono::minutes ( 5 ) );
+
         // this connects the mqtt interface to the mqtt broker
         mqtt.connect ();
 
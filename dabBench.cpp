@@ -0,0 +1,301 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+// microbenchmarks for the pieces every request passes through: parsing, serializing, routing a request to its device and binding its parameters, plus the
+// telemetry scheduler with many streams.   Built as dab_bench when DAB_BUILD_BENCHMARKS is on.   Run with --benchmark_filter=<regex> to select a subset.
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <benchmark/benchmark.h>
+#include "dabBridge.h"
+
+namespace
+{
+    // a request as received from the broker, and a typical response
+    constexpr char const *launchRequest = R"({"appId":"YouTube","contentId":"dQw4w9WgXcQ","parameters":["--start","42"]})";
+
+    DAB::jsonElement settingsResponse ()
+    {
+        return {{"status",                200},
+                {"language",              "en-US"},
+                {"outputResolution",      {{"width", 3840}, {"height", 2160}, {"frequency", 60}}},
+                {"memc",                  false},
+                {"cec",                   true},
+                {"lowLatencyMode",        true},
+                {"matchContentFrameRate", "EnabledSeamlessOnly"},
+                {"hdrOutputMode",         "AlwaysHdr"},
+                {"pictureMode",           "Other"},
+                {"audioOutputMode",       "Auto"},
+                {"audioOutputSource",     "HDMI"},
+                {"videoInputSource",      "Other"},
+                {"audioVolume",           20},
+                {"mute",                  false},
+                {"textToSpeech",          true}};
+    }
+
+    // handlers that do as little as possible, so that what's measured is the library
+    class bench_panel : public DAB::dabClient<bench_panel>
+    {
+    public:
+        bench_panel ( std::string const &deviceId, std::string const &ipAddress ) : dabClient ( deviceId, ipAddress )
+        {}
+
+        static bool isCompatible ( char const * )
+        {
+            return true;
+        }
+
+        DAB::jsonElement systemSettingsGet ()
+        {
+            return settingsResponse ();
+        }
+
+        DAB::jsonElement appLaunchWithContent ( std::string const &, std::string const &, DAB::jsonElement const & )
+        {
+            return {{"status", 200}};
+        }
+
+        DAB::jsonElement deviceInfo ()
+        {
+            return {{"status",  200},
+                    {"version", "2.0"}};
+        }
+    };
+
+    std::string deviceName ( int64_t num )
+    {
+        return "bench-" + std::to_string ( num );
+    }
+
+    // a bridge with devices bench-0 to bench-<count - 1>
+    std::unique_ptr<DAB::dabBridge<bench_panel>> makeBridge ( int64_t count )
+    {
+        auto bridge = std::make_unique<DAB::dabBridge<bench_panel>> ();
+        std::vector<std::pair<std::string, std::string>> devices;
+        for ( int64_t loop = 0; loop < count; loop++ )
+        {
+            devices.emplace_back ( deviceName ( loop ), "127.0.0.1" );
+        }
+        bridge->makeDeviceInstances ( devices );
+        return bridge;
+    }
+}
+
+static void BM_parseRequest ( benchmark::State &state )
+{
+    auto len = strlen ( launchRequest );
+    for ( auto _ : state )
+    {
+        benchmark::DoNotOptimize ( DAB::jsonParser ( launchRequest, len ) );
+    }
+    state.SetBytesProcessed ( (int64_t) (state.iterations () * len) );
+}
+BENCHMARK ( BM_parseRequest );
+
+static void BM_parseResponse ( benchmark::State &state )
+{
+    std::string text;
+    settingsResponse ().serialize ( text, true );
+    for ( auto _ : state )
+    {
+        benchmark::DoNotOptimize ( DAB::jsonParser ( text.data (), text.size () ) );
+    }
+    state.SetBytesProcessed ( (int64_t) (state.iterations () * text.size ()) );
+}
+BENCHMARK ( BM_parseResponse );
+
+static void BM_serialize ( benchmark::State &state )
+{
+    auto rsp = settingsResponse ();
+    std::string buff;
+    for ( auto _ : state )
+    {
+        buff.clear ();
+        rsp.serialize ( buff, true );
+        benchmark::DoNotOptimize ( buff.data () );
+    }
+    state.SetBytesProcessed ( (int64_t) (state.iterations () * buff.size ()) );
+}
+BENCHMARK ( BM_serialize );
+
+static void BM_serializeCBOR ( benchmark::State &state )
+{
+    auto rsp = settingsResponse ();
+    std::string buff;
+    for ( auto _ : state )
+    {
+        buff.clear ();
+        rsp.serializeCBOR ( buff );
+        benchmark::DoNotOptimize ( buff.data () );
+    }
+    state.SetBytesProcessed ( (int64_t) (state.iterations () * buff.size ()) );
+}
+BENCHMARK ( BM_serializeCBOR );
+
+static void BM_parseCBOR ( benchmark::State &state )
+{
+    std::string encoded;
+    settingsResponse ().serializeCBOR ( encoded );
+    for ( auto _ : state )
+    {
+        benchmark::DoNotOptimize ( DAB::cborParser ( encoded.data (), encoded.size () ) );
+    }
+    state.SetBytesProcessed ( (int64_t) (state.iterations () * encoded.size ()) );
+}
+BENCHMARK ( BM_parseCBOR );
+
+// as telemetry is published, through a template built from the first element
+static void BM_serializeTemplate ( benchmark::State &state )
+{
+    auto rsp = settingsResponse ();
+    DAB::jsonTemplateCache cache;
+    std::string buff;
+    for ( auto _ : state )
+    {
+        buff.clear ();
+        cache.serialize ( "dab/bench/telemetry", rsp, buff );
+        benchmark::DoNotOptimize ( buff.data () );
+    }
+    state.SetBytesProcessed ( (int64_t) (state.iterations () * buff.size ()) );
+}
+BENCHMARK ( BM_serializeTemplate );
+
+// routing a parameterless request to one of N devices, round robin so the lookup doesn't always hit the same entry
+static void BM_bridgeDispatch ( benchmark::State &state )
+{
+    auto bridge = makeBridge ( state.range ( 0 ) );
+
+    std::vector<DAB::jsonElement> requests;
+    for ( int64_t loop = 0; loop < state.range ( 0 ); loop++ )
+    {
+        DAB::jsonElement req;
+        req["topic"] = "dab/" + deviceName ( loop ) + "/device/info";
+        req["payload"].makeObject ();
+        requests.push_back ( std::move ( req ) );
+    }
+
+    size_t next = 0;
+    for ( auto _ : state )
+    {
+        benchmark::DoNotOptimize ( bridge->dispatch ( requests[next] ) );
+        next = next + 1 == requests.size () ? 0 : next + 1;
+    }
+    state.SetItemsProcessed ( state.iterations () );
+}
+BENCHMARK ( BM_bridgeDispatch )->Arg ( 1 )->Arg ( 64 )->Arg ( 1024 );
+
+// a request whose parameters have to be extracted and converted for the handler
+static void BM_parameterBinding ( benchmark::State &state )
+{
+    auto bridge = makeBridge ( 1 );
+
+    DAB::jsonElement req;
+    req["topic"] = "dab/" + deviceName ( 0 ) + "/applications/launch-with-content";
+    req["payload"] = DAB::jsonParser ( launchRequest );
+
+    for ( auto _ : state )
+    {
+        benchmark::DoNotOptimize ( bridge->dispatch ( req ) );
+    }
+    state.SetItemsProcessed ( state.iterations () );
+}
+BENCHMARK ( BM_parameterBinding );
+
+// the whole of a request short of mqtt: parse, route, handle and serialize
+static void BM_requestRoundTrip ( benchmark::State &state )
+{
+    auto bridge = makeBridge ( 1 );
+    auto topic = "dab/" + deviceName ( 0 ) + "/system/settings/get";
+    std::string payload;
+
+    for ( auto _ : state )
+    {
+        DAB::jsonElement req;
+        req["payload"] = DAB::jsonParser ( "{}", 2 );
+        req["topic"] = topic;
+        payload.clear ();
+        bridge->dispatch ( req ).serialize ( payload, true );
+        benchmark::DoNotOptimize ( payload.data () );
+    }
+    state.SetItemsProcessed ( state.iterations () );
+}
+BENCHMARK ( BM_requestRoundTrip );
+
+// registering and removing N telemetry streams.   Their first collection is an hour away, so the scheduler only ever reschedules them and nothing is collected
+// or published, which would otherwise be timed along with removeAll waiting for it
+static void BM_telemetryAddRemove ( benchmark::State &state )
+{
+    DAB::dabTelemetryScheduler scheduler;
+    int owner;
+    std::atomic<int64_t> fired = 0;
+
+    std::vector<std::string> ids;
+    for ( int64_t loop = 0; loop < state.range ( 0 ); loop++ )
+    {
+        ids.push_back ( "stream-" + std::to_string ( loop ) );
+    }
+
+    for ( auto _ : state )
+    {
+        for ( auto const &id : ids )
+        {
+            scheduler.add ( &owner, id, id, "dab/bench/telemetry", std::chrono::hours ( 1 ), [&fired] { fired.fetch_add ( 1, std::memory_order_relaxed ); return DAB::jsonElement{}; },
+                            [] ( DAB::jsonElement const & ) {}, std::chrono::hours ( 1 ) );
+        }
+        scheduler.removeAll ( &owner );
+    }
+    state.SetItemsProcessed ( state.iterations () * state.range ( 0 ) );
+    // should always be 0, anything else means collections were timed too
+    state.counters["collections"] = (double) fired.load ();
+}
+BENCHMARK ( BM_telemetryAddRemove )->Arg ( 100 )->Arg ( 10000 );
+
+// N streams firing every 10ms for a second, reporting how many collections were published and how late they were
+static void BM_telemetryFiring ( benchmark::State &state )
+{
+    for ( auto _ : state )
+    {
+        DAB::dabTelemetryScheduler scheduler ( 4 );
+        int owner;
+        std::atomic<int64_t> published = 0;
+
+        for ( int64_t loop = 0; loop < state.range ( 0 ); loop++ )
+        {
+            auto id = "stream-" + std::to_string ( loop );
+            scheduler.add ( &owner, id, id, "dab/bench/telemetry", std::chrono::milliseconds ( 10 ), [] { return DAB::jsonElement{ { "status", 200 } }; },
+                            [&published] ( DAB::jsonElement const & ) { published.fetch_add ( 1, std::memory_order_relaxed ); } );
+        }
+        std::this_thread::sleep_for ( std::chrono::seconds ( 1 ) );
+
+        int64_t late = 0;
+        int64_t maxLatenessUs = 0;
+        auto streams = scheduler.getStatistics ();
+        for ( auto it = streams.cbeginArray (); it != streams.cendArray (); it++ )
+        {
+            late += (int64_t) (*it)["lateFirings"];
+            maxLatenessUs = std::max ( maxLatenessUs, (int64_t) (*it)["maxLatenessUs"] );
+        }
+        scheduler.removeAll ( &owner );
+
+        state.counters["published"] = (double) published.load ();
+        state.counters["expected"] = (double) (state.range ( 0 ) * 100);
+        state.counters["late"] = (double) late;
+        state.counters["maxLatenessUs"] = (double) maxLatenessUs;
+    }
+}
+BENCHMARK ( BM_telemetryFiring )->Arg ( 100 )->Arg ( 1000 )->Iterations ( 1 )->UseRealTime ()->Unit ( benchmark::kMillisecond );
+
+BENCHMARK_MAIN ();
@@ -17,7 +17,13 @@
 
 #include <string>
 #include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <shared_mutex>
+#include <tuple>
+#include <variant>
 #include "dabClient.h"
+#include "dabWorkerPool.h"
 #include <cassert>
 
 namespace DAB
@@ -30,11 +36,55 @@ namespace DAB
     // the <ipAddress> is optional in this call.  If it is left out, the first type on in the type list will be instantiated.  This is the "on-device" mode.   If multiple
     // on-device classes are possible, simply pass in a value to be call their isCompatible method.
     // <ipAddress> and <params...> are type agnostic, however isCompatible is defined in bridge mode to take a string containing the ipAddress of the end-device.
+    // makeDeviceInstances( <devices> ) does the same for a whole list of devices, probing and building them in parallel.  deferDeviceInstance() and the deferred startup option
+    // leave the probe and construction of a device until something first needs it (usually its first request).
 
 	// type list should be a list of types inheriting from dabClient (which itself inherits from dabInterface which is the base class we're interested in)
 	template<typename ... C>
 	class dabBridge {
-        std::map<std::string, std::unique_ptr<dabInterface>, std::less<>> instances;
+        // shared by all of our instances.  Declared ahead of instances so that it outlives them
+        dabTelemetryScheduler telemetryScheduler;
+
+        // timing of the request stages common to all of our devices
+        dabPipelineMetrics pipelineMetrics;
+
+        // each instance is held as its concrete type so that requests are dispatched without going through dabInterface's vtable.   With a single client type
+        // (the on-device case) there's nothing to select at all and the compiler can inline the request path from the mqtt interface down into the user's handler
+        using instanceType = std::variant<std::unique_ptr<C>...>;
+
+        // looked up directly from a string_view into the topic
+        std::unordered_map<std::string, instanceType, dabStringHash, std::equal_to<>> instances;
+
+        // a device whose instance is built the first time it's needed
+        struct deferredInstance
+        {
+            // held while the instance is built so that concurrent requests for the device build it only once
+            std::mutex access;
+            std::function<instanceType ()> build;
+        };
+        std::unordered_map<std::string, std::shared_ptr<deferredInstance>, dabStringHash, std::equal_to<>> deferred;
+
+        // guards instances, deferred and publishCallback.   Instances are never removed so a pointer to one remains usable once the lock is released
+        std::shared_mutex instanceAccess;
+
+        // the dab/discovery response of every device in each form it's sent in
+        struct discoveryResponseSet
+        {
+            std::vector<std::string> json;
+            std::vector<std::string> cbor;
+            // the first device's response, returned by dispatch
+            jsonElement first;
+        };
+
+        // built on the first discovery and kept until generation moves on
+        std::mutex discoveryAccess;
+        std::shared_ptr<discoveryResponseSet const> discoveryResponses;
+        // bumped whenever the discovery responses are invalidated (including by a device being added).   A set of responses built while it changed is out of date before it's stored
+        std::atomic<uint64_t> discoveryGeneration = 0;
+
+        // applied to devices as they're added, guarded by instanceAccess
+        bool metricsEnabled = false;
+        std::chrono::milliseconds metricsInterval{ 0 };         // 0 if metrics telemetry isn't running
 
         // type list for our meta-program below
         template<class ...>
@@ -43,30 +93,140 @@ namespace DAB
 
     public:
 
-        virtual ~dabBridge() = default;
+        virtual ~dabBridge() {
+            // stop all telemetry while every instance is still fully constructed, a callback must never run against a partially destroyed client
+            for ( auto &it : instances ) {
+                telemetryScheduler.removeAll ( asInterface ( it.second ) );
+            }
+            telemetryScheduler.removeAll ( this );
+        }
 
         std::function< void(jsonElement const &) > publishCallback;
 
+        // startup options for makeDeviceInstances
+        struct startupOptions
+        {
+            // number of devices probed and built at once, 0 does them one after another on the calling thread
+            size_t workers = 16;
+            // register each device without probing or building it.  The instance is built the first time the device is needed
+            bool deferred = false;
+        };
+
+        // the scheduler used for all telemetry published by this bridge's devices
+        dabTelemetryScheduler &getTelemetryScheduler ()
+        {
+            return telemetryScheduler;
+        }
+
+        // periodically publish the timing statistics (firings, late firings, skipped firings, lateness and callback duration) of every active telemetry stream
+        void startTelemetryStatistics ( std::chrono::milliseconds interval, std::string const &topic = "dab/adapter/telemetry-statistics" )
+        {
+            telemetryScheduler.add ( this, "", "statistics", topic, interval,
+                                     [this] () -> jsonElement { return { { "streams", telemetryScheduler.getStatistics () } }; },
+                                     [this] ( jsonElement const &elem ) { if ( publishCallback ) publishCallback ( elem ); } );
+        }
+
+        void stopTelemetryStatistics ()
+        {
+            telemetryScheduler.remove ( this, "statistics" );
+        }
+
+        // the request stage timings shared by all devices.   The mqtt interfaces record their parse, serialize and publish times here
+        dabPipelineMetrics &getMetrics ()
+        {
+            return pipelineMetrics;
+        }
+
+        // start (or stop) recording request metrics, for the pipeline and for every device including those added later
+        void setMetricsEnabled ( bool enable )
+        {
+            std::unique_lock l1 ( instanceAccess );
+            metricsEnabled = enable;
+            pipelineMetrics.setEnabled ( enable );
+            for ( auto &it : instances ) {
+                deviceMetrics ( it.second ).setEnabled ( enable );
+            }
+        }
+
+        // { pipeline, devices: { <deviceId>: { requests, errors, handlers } } }.  Times are in microseconds
+        jsonElement getMetricsSnapshot ()
+        {
+            jsonElement rsp;
+            rsp["pipeline"] = pipelineMetrics.snapshot ();
+            auto &devices = rsp["devices"];
+            devices.makeObject ();
+
+            std::shared_lock l1 ( instanceAccess );
+            for ( auto const &it : instances ) {
+                devices[std::string_view ( it.first )] = deviceMetrics ( it.second ).snapshot ();
+            }
+            return rsp;
+        }
+
+        // { pipeline, device } for a single device, which is null if it doesn't exist
+        jsonElement getMetricsSnapshot ( std::string_view deviceId )
+        {
+            jsonElement rsp;
+            rsp["pipeline"] = pipelineMetrics.snapshot ();
+            auto &device = rsp["device"];
+            if ( auto *instance = findInstance ( deviceId ) ) {
+                device = deviceMetrics ( *instance ).snapshot ();
+            }
+            return rsp;
+        }
+
+        // enables metrics and periodically publishes each device's snapshot on dab/<deviceId>/adapter/metrics
+        void startMetricsTelemetry ( std::chrono::milliseconds interval )
+        {
+            stopMetricsTelemetry ();
+            setMetricsEnabled ( true );
+
+            std::unique_lock l1 ( instanceAccess );
+            metricsInterval = interval;
+            for ( auto const &it : instances ) {
+                addMetricsTelemetry ( it.first, it.second, interval );
+            }
+        }
+
+        // stops the metrics telemetry, metrics carry on being recorded
+        void stopMetricsTelemetry ()
+        {
+            std::unique_lock l1 ( instanceAccess );
+            if ( metricsInterval.count() ) {
+                for ( auto const &it : instances ) {
+                    telemetryScheduler.remove ( this, "metrics/" + it.first );
+                }
+                metricsInterval = std::chrono::milliseconds ( 0 );
+            }
+        }
+
         // main topic dispatch entry point.   It extracts the topic, removes the dab/<device_id>/ portion and tries to find it in our map.  If it is there
         // it will dispatch against the stored dispatcher (which will build the parameter lists from the passed in json and then call the specified class method
         virtual jsonElement dispatch( jsonElement const &json ) {
+            return route ( json, nullptr );
+        }
+
+        // as dispatch, but the body of a streamed response is left in stream for the caller to send and only the header response is returned
+        virtual jsonElement dispatch( jsonElement const &json, std::optional<dabStream> &stream ) {
+            return route ( json, &stream );
+        }
+
+    private:
+        jsonElement route( jsonElement const &json, std::optional<dabStream> *stream ) {
             if (json.has("topic")) {
                 std::string const &topic = json["topic"];
                 const char *topic_cstr = topic.c_str();    
 
                 if ( topic == "dab/discovery")
                 {
-                    // we may have multiple devices and each one needs to send a response.   However, we can only return one response.
-                    // so we'll instead, iterate through the second device and call publishCallback
-                    auto it = instances.begin();
-                    it++;
-                    for ( ; it != instances.end(); it++ )
+                    // every device answers a discovery, but only one response can be returned.   The mqtt interfaces send them all from getDiscoveryResponses ()
+                    // themselves, anyone else dispatching a discovery gets the first device's (cached) response
+                    auto responses = getDiscoveryResponses ();
+                    if ( responses->json.empty () )
                     {
-                        auto &[name, value] = *it;
-                        publishCallback ( it->second->dispatch ( json ) );
+                        throw DAB::dabException ( 404, "no devices" );
                     }
-                    // return as a response our first class's response
-                    return instances.begin()->second->dispatch ( json );
+                    return responses->first;
                 } else if (starts_with(topic_cstr, "dab/"))
                 {
                     // auto slashPos = std::string_view(topic.begin() + 4, topic.end()).find_first_of('/');
@@ -77,14 +237,13 @@ namespace DAB
                     }
 
                     // the deviceId is extracted from "dab/<deviceId>/<method>"
-                    // auto deviceId = std::string_view(topic.begin() + 4, topic.begin() + 4 + (int)slashPos);
-                    std::string deviceIdStr(topic.begin() + 4, topic.begin() + 4 + static_cast<std::ptrdiff_t>(slashPos));
-                    auto deviceId = std::string_view(deviceIdStr.c_str(), deviceIdStr.size());
-
-                    auto it = instances.find(deviceId);
-                    if (it != instances.end()) {
-                        // now call the dabInterface associated with the deviceId;
-                        return it->second->dispatch(json);
+                    auto deviceId = std::string_view(topic.c_str() + 4, slashPos);
+
+                    dabPipelineMetrics::timer routeTimer ( pipelineMetrics, dabMetricStage::route );
+                    if (auto *instance = getInstance(deviceId)) {
+                        routeTimer.stop ();
+                        // now call the client associated with the deviceId;
+                        return std::visit ( [&json, stream] ( auto &client ) { return dispatchTo ( *client, json, stream ); }, *instance );
                     } else {
                         throw DAB::dabException ( 400, "deviceId does not exist" );
                     }
@@ -96,19 +255,238 @@ namespace DAB
             }
         }
 
+        // calls dispatch of the client's own type rather than the virtual
+        template <class T>
+        static jsonElement dispatchTo ( T &client, jsonElement const &json, std::optional<dabStream> *stream ) {
+            return stream ? client.T::dispatch ( json, *stream ) : client.T::dispatch ( json );
+        }
+
+        // for everything off the request path
+        static dabInterface *asInterface ( instanceType const &instance ) {
+            return std::visit ( [] ( auto const &client ) -> dabInterface * { return client.get(); }, instance );
+        }
+
+        static dabDeviceMetrics &deviceMetrics ( instanceType const &instance ) {
+            return std::visit ( [] ( auto const &client ) -> dabDeviceMetrics & { return client->getMetrics(); }, instance );
+        }
+
+        // publishes a device's metrics on dab/<deviceId>/adapter/metrics
+        void addMetricsTelemetry ( std::string const &deviceId, instanceType const &instance, std::chrono::milliseconds interval ) {
+            auto &device = deviceMetrics ( instance );
+            telemetryScheduler.add ( this, deviceId, "metrics/" + deviceId, "dab/" + deviceId + "/adapter/metrics", interval,
+                                     [this, &device] () -> jsonElement { return { { "pipeline", pipelineMetrics.snapshot () }, { "device", device.snapshot () } }; },
+                                     [this] ( jsonElement const &elem ) { if ( publishCallback ) publishCallback ( elem ); } );
+        }
+
+        // the instance for deviceId if it has been built, nullptr otherwise
+        instanceType *findInstance ( std::string_view deviceId ) {
+            std::shared_lock l1 ( instanceAccess );
+            auto it = instances.find ( deviceId );
+            return it != instances.end() ? &it->second : nullptr;
+        }
+
+        // the instance for deviceId, building it first if it was deferred.  nullptr if there is no such device.   Throws if a deferred device fails to build,
+        // in which case it stays deferred and the next request for it tries again
+        instanceType *getInstance ( std::string_view deviceId ) {
+            std::shared_ptr<deferredInstance> pending;
+            {
+                std::shared_lock l1 ( instanceAccess );
+                if ( auto it = instances.find ( deviceId ); it != instances.end() ) {
+                    return &it->second;
+                }
+                auto it = deferred.find ( deviceId );
+                if ( it == deferred.end() ) {
+                    return nullptr;
+                }
+                pending = it->second;
+            }
+
+            std::lock_guard l1 ( pending->access );
+            // someone else may have built it while we waited
+            if ( auto *instance = findInstance ( deviceId ) ) {
+                return instance;
+            }
+            // the instance outlives the request that happened to build it, so nothing it makes may come from that request's arena
+            jsonArena::suspend noArena;
+            return addInstance ( deviceId, pending->build () );
+        }
+
+        // every instance, building any that were deferred.  Deferred devices that fail to build are left out.  generation receives the discovery generation the list is current for
+        std::vector<dabInterface *> getAllInstances ( uint64_t *generation = nullptr ) {
+            std::vector<std::string> pending;
+            {
+                std::shared_lock l1 ( instanceAccess );
+                for ( auto const &it : deferred ) {
+                    pending.push_back ( it.first );
+                }
+            }
+            jsonArena::suspend noArena;
+            for ( auto const &deviceId : pending ) {
+                try {
+                    getInstance ( deviceId );
+                } catch ( ... ) {
+                }
+            }
+
+            std::vector<dabInterface *> all;
+            std::shared_lock l1 ( instanceAccess );
+            if ( generation ) {
+                *generation = discoveryGeneration;
+            }
+            all.reserve ( instances.size() );
+            for ( auto const &it : instances ) {
+                all.push_back ( asInterface ( it.second ) );
+            }
+            return all;
+        }
+
+        // takes ownership of a newly built instance.  If the device already has one the new instance is discarded and the existing one returned
+        instanceType *addInstance ( std::string_view deviceId, instanceType instance ) {
+            asInterface ( instance )->setTelemetryScheduler ( telemetryScheduler );
+
+            std::unique_lock l1 ( instanceAccess );
+            // devices made after the publish callback was set still need it
+            if ( publishCallback ) {
+                asInterface ( instance )->setPublishCallback ( publishCallback );
+            }
+            deviceMetrics ( instance ).setEnabled ( metricsEnabled );
+            auto [it, inserted] = instances.try_emplace ( std::string ( deviceId ), std::move ( instance ) );
+            if ( auto def = deferred.find ( deviceId ); def != deferred.end() ) {
+                deferred.erase ( def );
+            }
+            if ( inserted && metricsInterval.count() ) {
+                addMetricsTelemetry ( it->first, it->second, metricsInterval );
+            }
+            l1.unlock ();
+
+            if ( inserted ) {
+                // the new device has to answer discoveries too
+                invalidateDiscovery ();
+            }
+            return &it->second;
+        }
+
+    public:
+        // the dab/discovery response of every device, serialized as both json and CBOR, starting with the one dispatch would have returned.   These only change when devices
+        // do, so they are built on the first discovery and kept until a device is added or invalidateDiscovery () is called.   The mqtt interfaces publish them as a single batch
+        std::shared_ptr<discoveryResponseSet const> getDiscoveryResponses () {
+            {
+                std::lock_guard l1 ( discoveryAccess );
+                if ( discoveryResponses ) {
+                    return discoveryResponses;
+                }
+            }
+
+            uint64_t generation;
+            auto all = getAllInstances ( &generation );
+
+            // kept across requests, so none of it may come from the arena of the request that asked for it
+            jsonArena::suspend noArena;
+            jsonElement req = { { "topic", "dab/discovery" } };
+            auto responses = std::make_shared<discoveryResponseSet> ();
+            responses->json.resize ( all.size() );
+            responses->cbor.resize ( all.size() );
+            for ( size_t loop = 0; loop < all.size(); loop++ ) {
+                auto rsp = all[loop]->dispatch ( req );
+                rsp.serialize ( responses->json[loop], true );
+                rsp.serializeCBOR ( responses->cbor[loop] );
+                if ( !loop ) {
+                    responses->first = std::move ( rsp );
+                }
+            }
+
+            std::lock_guard l1 ( discoveryAccess );
+            if ( generation == discoveryGeneration ) {
+                discoveryResponses = responses;
+            }
+            return responses;
+        }
+
+        // discard the cached discovery responses, for instance if a device's ip address has changed
+        void invalidateDiscovery () {
+            std::lock_guard l1 ( discoveryAccess );
+            discoveryGeneration++;
+            discoveryResponses.reset ();
+        }
+
         // return a list of all operations supported by the specified class.   This is solely determined by implementation of the handler method.
-        std::vector<std::string> getTopics() {
-            std::vector<std::string> topics;
+        // if deviceWildcards is set, a single dab/<deviceId>/# filter is returned per device instead.   isRequestTopic() must then be used to filter what arrives.
+        // without deviceWildcards any deferred devices are built, their operations are only known once they are.
+        std::vector<std::string> getTopics( bool deviceWildcards = false ) {
+            std::vector<std::string> deviceIds;
+            {
+                std::shared_lock l1 ( instanceAccess );
+                deviceIds.reserve ( instances.size() + deferred.size() );
+                for ( auto const &instance: instances ) {
+                    deviceIds.push_back ( instance.first );
+                }
+                for ( auto const &instance: deferred ) {
+                    deviceIds.push_back ( instance.first );
+                }
+            }
 
-            topics.reserve(instances.size());
-            for (auto const &instance: instances) {
-                auto newTopics = instance.second->getTopics();
+            std::vector<std::string> topics;
+            topics.reserve(deviceIds.size() + 1);
+            for ( auto const &deviceId: deviceIds ) {
+                auto newTopics = getDeviceTopics ( deviceId, deviceWildcards );
                 topics.insert ( topics.end(), newTopics.begin(), newTopics.end() );
             }
             topics.push_back( "dab/discovery");
             return topics;
         }
 
+        // as getTopics, for a single device and without dab/discovery.   Used to subscribe a device added after connecting
+        std::vector<std::string> getDeviceTopics( std::string_view deviceId, bool deviceWildcards = false ) {
+            if ( deviceWildcards ) {
+                return { std::string ( "dab/" ) + std::string ( deviceId ) + "/#" };
+            }
+            if ( auto *instance = getInstance ( deviceId ) ) {
+                return asInterface ( *instance )->getTopics();
+            }
+            return {};
+        }
+
+        // if the device the topic is addressed to has a cached response for it, copy the serialized response into response and return true
+        bool getCachedResponse ( std::string_view topic, std::string &response ) {
+            if ( !topic.starts_with ( "dab/" ) ) {
+                return false;
+            }
+            auto slashPos = topic.find ( '/', 4 );
+            if ( slashPos == std::string_view::npos ) {
+                return false;
+            }
+            // a deferred device can't have cached anything yet
+            auto *instance = findInstance ( topic.substr ( 4, slashPos - 4 ) );
+            return instance && std::visit ( [topic, &response] ( auto &client ) {
+                using T = std::remove_reference_t<decltype ( *client )>;
+                return client->T::getCachedResponse ( topic, response );
+            }, *instance );
+        }
+
+        // returns true if topic is a request we should respond to.  Anything else arriving on a wildcard subscription (our own telemetry, other traffic under dab/<deviceId>/) is to be ignored
+        bool isRequestTopic ( std::string_view topic ) {
+            if ( topic == "dab/discovery" ) {
+                return true;
+            }
+            if ( !topic.starts_with ( "dab/" ) ) {
+                return false;
+            }
+            auto slashPos = topic.find ( '/', 4 );
+            if ( slashPos == std::string_view::npos ) {
+                return false;
+            }
+            try {
+                auto *instance = getInstance ( topic.substr ( 4, slashPos - 4 ) );
+                return instance && std::visit ( [topic] ( auto &client ) {
+                    using T = std::remove_reference_t<decltype ( *client )>;
+                    return client->T::isRequestTopic ( topic );
+                }, *instance );
+            } catch ( ... ) {
+                // a deferred device that failed to build.  Let the request through so that dispatching it reports the error
+                return true;
+            }
+        }
+
     	bool starts_with(const char*string, const char* pattern)
     	{
     		while (*pattern && *string == *pattern)
@@ -124,9 +502,10 @@ namespace DAB
         template<typename F>
         void setPublishCallback(F f)
         {
+            std::unique_lock l1 ( instanceAccess );
             for ( auto &it : instances )
             {
-                it.second->setPublishCallback( f );
+                asInterface ( it.second )->setPublishCallback( f );
             }
             publishCallback = f;
         }
@@ -136,10 +515,78 @@ namespace DAB
         template <typename ...VS>
         dabInterface *makeDeviceInstance ( char const *deviceId, VS  &&...vs )
         {
-            return makeInstances<0> ( deviceId, types<C...>{}, std::forward<VS>(vs)... );
+            return asInterface ( *addInstance ( deviceId, makeInstances<0> ( deviceId, types<C...>{}, std::forward<VS>(vs)... ) ) );
+        }
+
+        // registers deviceId without probing or building it.  That's done the first time the device is needed, typically when its first request arrives,
+        // with the same parameters makeDeviceInstance would have been given.   If no class is compatible, requests to the device are answered with the error.
+        template <typename ...VS>
+        void deferDeviceInstance ( char const *deviceId, VS  &&...vs )
+        {
+            auto pending = std::make_shared<deferredInstance> ();
+            pending->build = [this, id = std::string ( deviceId ), params = std::make_tuple ( std::decay_t<VS> ( std::forward<VS> ( vs ) )... )] () {
+                return std::apply ( [this, &id] ( auto const &...ps ) { return makeInstances<0> ( id.c_str(), types<C...>{}, ps... ); }, params );
+            };
+
+            std::unique_lock l1 ( instanceAccess );
+            if ( !instances.contains ( std::string_view ( deviceId ) ) ) {
+                deferred.try_emplace ( deviceId, std::move ( pending ) );
+            }
+        }
+
+        // makeDeviceInstance for every entry of devices, several at a time.   Each entry is either a deviceId or a tuple (or pair) of the deviceId followed by the parameters
+        // makeDeviceInstance would take, e.g. a std::vector<std::pair<std::string, std::string>> of deviceIds and ipAddresses.
+        // onReady is called for each device as soon as it's ready, from whichever thread built it, with its instance (nullptr for a deferred device).  This allows each to be
+        // subscribed to (see dabMQTTInterface::subscribeDevice) without waiting for the rest.   Returns the deviceIds that no class was compatible with or failed to build
+        template <typename R>
+        std::vector<std::string> makeDeviceInstances ( R const &devices, startupOptions const &options = {}, std::function<void ( std::string const &, dabInterface * )> onReady = {} )
+        {
+            std::mutex failureAccess;
+            std::vector<std::string> failures;
+
+            auto start = [&] ( auto const &deviceId, auto const &...params ) {
+                std::string id ( deviceId );
+                try {
+                    dabInterface *instance = nullptr;
+                    if ( options.deferred ) {
+                        deferDeviceInstance ( id.c_str(), asParameter ( params )... );
+                    } else {
+                        instance = makeDeviceInstance ( id.c_str(), asParameter ( params )... );
+                    }
+                    if ( onReady ) {
+                        onReady ( id, instance );
+                    }
+                } catch ( ... ) {
+                    std::lock_guard l1 ( failureAccess );
+                    failures.push_back ( std::move ( id ) );
+                }
+            };
+
+            {
+                // each device has its own key, so they all run in parallel up to the number of workers.  The pool finishes everything submitted before it's destroyed.
+                dabWorkerPool pool ( options.deferred ? 0 : options.workers );
+                for ( auto const &device : devices ) {
+                    if constexpr ( requires { std::tuple_size<std::remove_cvref_t<decltype ( device )>>::value; } ) {
+                        pool.submit ( std::get<0> ( device ), [&start, &device] { std::apply ( start, device ); } );
+                    } else {
+                        pool.submit ( device, [&start, &device] { start ( device ); } );
+                    }
+                }
+            }
+            return failures;
         }
 		private:
 
+        // device lists usually hold std::strings but isCompatible takes a char const *, so those are passed as one
+        template <typename T>
+        static auto const &asParameter ( T const &param ) {
+            return param;
+        }
+
+        static char const *asParameter ( std::string const &param ) {
+            return param.c_str();
+        }
+
         template <typename FIRST, typename ...VS>
         FIRST &getFirstParameter ( FIRST &&first, VS &&... ) {
             return first;
@@ -149,27 +596,25 @@ namespace DAB
         //
         // alternately, if no parameters to isCompatible() have been passed, the first class in the list will always be instantiated.  This is the on-device mode.
 		template<int dummy, class HEAD, class ... Tail, class ...VS>
-		dabInterface *makeInstances ( char const *deviceId, types<HEAD, Tail...>, VS &&...vs )
+		instanceType makeInstances ( char const *deviceId, types<HEAD, Tail...>, VS &&...vs )
 		{
             if ( sizeof... ( VS ) ) {
                 // check the name of type HEAD and see if it's the one we want to instantiate
                 if ( HEAD::isCompatible ( getFirstParameter(std::forward<VS>(vs)... ) ) ) {
-                    // it is, so instantiate HEAD and save a unique pointer to it in our map.  The key is the UUID
-                    instances.insert(std::move(std::make_pair(std::move(std::string(deviceId)), std::move(std::make_unique<HEAD>(deviceId, std::forward<VS>(vs)...)))));
-                    return instances.find(std::string_view(deviceId))->second.get();
+                    // it is, so instantiate HEAD.  The caller saves it in our map, keyed by the UUID
+                    return instanceType ( std::in_place_type<std::unique_ptr<HEAD>>, std::make_unique<HEAD>(deviceId, std::forward<VS>(vs)...) );
                 } else {
                     return makeInstances<dummy>(deviceId, types<Tail...>{}, std::forward<VS>(vs)...);
                 }
             } else {
-                instances.insert(std::move(std::make_pair(std::move(std::string(deviceId)), std::move(std::make_unique<HEAD>(deviceId, std::forward<VS>(vs)...)))));
-                return instances.find(std::string_view(deviceId))->second.get();
+                return instanceType ( std::in_place_type<std::unique_ptr<HEAD>>, std::make_unique<HEAD>(deviceId, std::forward<VS>(vs)...) );
             }
 		}
 
 		// we need dummy here otherwise, once HEAD and ...TAIL are exhausted, the template argument list is <> which becomes an invalid specialization.
         // this case is reached when all passed in classes have been exhausted and all have returned false on their respective isCompatible() calls
 		template< int , typename ...VS >
-		dabInterface *makeInstances ( char const *, types<>, VS &&... ) {
+		instanceType makeInstances ( char const *, types<>, VS &&... ) {
             // if we ever got here, then we never found the proper class name to instantiate
             throw DAB::dabException ( 400, "no compatible devices found" );
         }
@@ -26,9 +26,19 @@
 #include <memory>
 #include <utility>
 #include <atomic>
+#include <array>
+#include <string_view>
+#include <expected>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
 
 
 #include "Json.h"
+#include "dabTelemetry.h"
+#include "dabStream.h"
+#include "dabProcess.h"
+#include "dabMetrics.h"
 
 namespace DAB
 {
@@ -43,63 +53,257 @@ namespace DAB
         }
     };
 
-    class dabInterface;
+    // the error half of dabResult.   Handlers may return a dabResult instead of a jsonElement and report failures by returning std::unexpected ( DAB::dabError{ 404, "not found" } ) rather than throwing
+    // throwing a dabException from a handler returning a plain jsonElement still works, returning is just much cheaper than unwinding
+    struct dabError
+    {
+        int64_t errorCode;
+        std::string errorText;
+    };
 
-    // our dispatcher base class.  This serves as the polymorphic interface to allow us to dispatch against specialized instances
-    template< typename T >
-    struct dispatcher
+    using dabResult = std::expected<jsonElement, dabError>;
+
+    // this is an XMACRO list of def() macro's.   It contains the dab method name, the name of the method to call and to arrays of fixed and optional parameters defined as string literals
+    // NOTE: multiple fixed or optional parameters need to be enclosed in ()   this is a preprocessor limitation, it will work just fine if you do this
+#define METHODS \
+        def( "/operations/list", opList, opList, {}, {} )                                                                                       \
+        def( "/applications/list", appList, appList, {}, {} )                                                                                   \
+        def( "/applications/launch", appLaunch, appLaunch, {"appId"}, {"parameters"} )                                                          \
+        def( "/applications/launch-with-content", appLaunchWithContent, appLaunchWithContent, ({ "appId", "contentId" }), { "parameters" } )    \
+        def( "/applications/get-state", appGetState, appGetState, { "appId" }, {} )                                                             \
+        def( "/applications/exit", appExit, appExit, {"appId"}, {"background"} )                                                                \
+        def( "/device/info", deviceInfo, deviceInfo, {}, {} )                                                                                   \
+        def( "/system/restart", systemRestart, systemRestart, {}, {} )                                                                          \
+        def( "/system/settings/list", systemSettingsList, systemSettingsList, {}, {} )                                                          \
+        def( "/system/settings/get", systemSettingsGet, systemSettingsGet, {}, {} )                                                             \
+        def( "/system/settings/set", systemSettingsSet, systemSettingsSet, { "*" }, {} )                                                 \
+        def( "/input/key/list", inputKeyList, inputKeyList, {}, {} )                                                                            \
+        def( "/input/key-press", inputKeyPress, inputKeyPress, { "keyCode"}, {} )                                                               \
+        def( "/input/long-key-press", inputKeyLongPress, inputKeyLongPress, ({ "keyCode", "durationMs" }), {} )                                \
+        def( "/output/image", outputImage, outputImage, {}, {} )                                                                                \
+        def( "/device-telemetry/start", deviceTelemetry, deviceTelemetryStartInternal, ({ "duration" }), {} )                          \
+        def( "/device-telemetry/stop", deviceTelemetry, deviceTelemetryStopInternal, {}, {} )                                                   \
+        def( "/app-telemetry/start", appTelemetry, appTelemetryStartInternal, ({ "appId", "duration" }), {} )                          \
+        def( "/app-telemetry/stop", appTelemetry, appTelemetryStopInternal, {"appId"}, {} )                                                     \
+        def( "/health-check/get", healthCheckGet, healthCheckGet, { }, {} )                                                                     \
+        def( "/voice/list", voiceList, voiceList, { }, {} )                                                                                     \
+        def( "/voice/set", voiceSet, voiceSet, { "voiceSystem" }, {} )                                                                         \
+        def( "/voice/send-audio", voiceSendAudio, voiceSendAudio, { "fileLocation" }, {"voiceSystem" } )                                       \
+        def( "/voice/send-text", voiceSendText, voiceSendText, { "requestText" }, {"voiceSystem" } )                                           \
+        def( "/version", version, version, { }, {} )
+
+    // the operations we know how to route, one per METHODS entry in METHODS order.   discovery goes at the end as it's the one topic that isn't device specific
+    enum class dabOperation : uint8_t
+    {
+#define def( methName, detectFunc, callFunc, fixedParams, optionalParams ) callFunc,
+        METHODS
+#undef def
+        discovery,
+        unknown
+    };
+
+    struct dabOperationInfo
+    {
+        static constexpr size_t count = (size_t) dabOperation::unknown;
+
+        // the topic suffix (following dab/<deviceId>) for each operation.  discovery holds its entire topic
+        static constexpr std::string_view names[count] = {
+#define def( methName, detectFunc, callFunc, fixedParams, optionalParams ) methName,
+            METHODS
+#undef def
+            "dab/discovery"
+        };
+
+        // number of parameters (fixed and optional) each operation takes
+        static constexpr size_t paramCounts[count] = {
+#define def( methName, detectFunc, callFunc, fixedParams, optionalParams ) std::initializer_list<char const *>fixedParams.size () + std::initializer_list<char const *>optionalParams.size (),
+            METHODS
+#undef def
+            0
+        };
+
+        // the fixed (must be present) and optional parameter counts of each operation
+        static constexpr size_t fixedCounts[count] = {
+#define def( methName, detectFunc, callFunc, fixedParams, optionalParams ) std::initializer_list<char const *>fixedParams.size (),
+            METHODS
+#undef def
+            0
+        };
+
+        static constexpr size_t optionalCounts[count] = {
+#define def( methName, detectFunc, callFunc, fixedParams, optionalParams ) std::initializer_list<char const *>optionalParams.size (),
+            METHODS
+#undef def
+            0
+        };
+
+        // an operation's parameter names are paramNames[paramOffsets[op]] onwards, fixed parameters first followed by the optional ones
+        static constexpr auto paramOffsets = [] {
+            std::array<size_t, count + 1> offsets{};
+            for ( size_t op = 0; op < count; op++ )
+            {
+                offsets[op + 1] = offsets[op] + paramCounts[op];
+            }
+            return offsets;
+        } ();
+
+        static constexpr auto paramNames = [] {
+            std::array<std::string_view, paramOffsets[count]> params{};
+            size_t pos = 0;
+            auto add = [&] ( std::initializer_list<char const *> list ) {
+                for ( auto name: list )
+                {
+                    params[pos++] = name;
+                }
+            };
+#define def( methName, detectFunc, callFunc, fixedParams, optionalParams ) add ( std::initializer_list<char const *>fixedParams ); add ( std::initializer_list<char const *>optionalParams );
+            METHODS
+#undef def
+            return params;
+        } ();
+
+        // FNV-1a with the high bits folded into the low ones, seed perturbs the offset basis so we can search for a collision free seed
+        static constexpr uint32_t hash ( std::string_view name, uint32_t seed )
+        {
+            uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+            for ( auto c: name )
+            {
+                h ^= (uint8_t) c;
+                h *= 16777619u;
+            }
+            return h ^ (h >> 16);
+        }
+
+        static constexpr size_t tableSize = 64;
+
+        // find a seed for which every device operation hashes to its own slot
+        static constexpr uint32_t findSeed ()
+        {
+            for ( uint32_t seed = 0; seed < 100000; seed++ )
+            {
+                bool used[tableSize] = {};
+                bool collision = false;
+                for ( size_t op = 0; op < (size_t) dabOperation::discovery && !collision; op++ )
+                {
+                    auto slot = hash ( names[op], seed ) & (tableSize - 1);
+                    collision = used[slot];
+                    used[slot] = true;
+                }
+                if ( !collision )
+                {
+                    return seed;
+                }
+            }
+            return ~0u;
+        }
+    };
+
+    // compile time generated perfect hash from an operation's topic suffix to its dabOperation
+    // a lookup is a hash, one table read, and a single string compare to reject anything that isn't actually one of ours
+    class dabOperationRouter
+    {
+        static constexpr uint32_t seed = dabOperationInfo::findSeed ();
+        static_assert ( seed != ~0u, "no perfect hash seed found for METHODS, increase dabOperationInfo::tableSize" );
+
+        // slot -> operation + 1 (0 for an unused slot)
+        static constexpr auto table = [] {
+            std::array<uint8_t, dabOperationInfo::tableSize> t{};
+            for ( size_t op = 0; op < (size_t) dabOperation::discovery; op++ )
+            {
+                t[dabOperationInfo::hash ( dabOperationInfo::names[op], seed ) & (dabOperationInfo::tableSize - 1)] = (uint8_t) (op + 1);
+            }
+            return t;
+        } ();
+
+    public:
+        // suffix is the portion of the topic following dab/<deviceId>, e.g. "/applications/launch"
+        static constexpr dabOperation find ( std::string_view suffix )
+        {
+            auto entry = table[dabOperationInfo::hash ( suffix, seed ) & (dabOperationInfo::tableSize - 1)];
+            if ( entry && dabOperationInfo::names[entry - 1] == suffix )
+            {
+                return (dabOperation) (entry - 1);
+            }
+            return dabOperation::unknown;
+        }
+    };
+
+    // response caching.   A client enables caching of an operation's response by providing a static policy table, e.g.
+    //      static constexpr DAB::dabCachePolicy responseCache[] = { { DAB::dabOperation::deviceInfo, std::chrono::minutes ( 5 ) }, { DAB::dabOperation::voiceList, DAB::dabCachePolicy::forever } };
+    // only operations that take no parameters can be cached.   opList and version are always cached as they can never change once the client is constructed
+    struct dabCachePolicy
     {
-        virtual ~dispatcher () = default;
+        static constexpr auto forever = std::chrono::milliseconds::max ();
+
+        dabOperation op;
+        std::chrono::milliseconds ttl;
+    };
+
+    // a successful first invalidates any cached response of second.  a successful systemRestart invalidates everything
+    static constexpr std::pair<dabOperation, dabOperation> dabCacheInvalidations[] = {
+        { dabOperation::systemSettingsSet, dabOperation::systemSettingsGet },
+        { dabOperation::voiceSet, dabOperation::voiceList },
+    };
 
-        virtual jsonElement operator() ( T *cls, jsonElement const &elem ) = 0;
+    // operations that only read state.  Identical requests for one of these can be answered with the same response (see dabIngressGate)
+    static constexpr dabOperation dabReadOnlyOperations[] = {
+        dabOperation::opList, dabOperation::appList, dabOperation::appGetState, dabOperation::deviceInfo, dabOperation::systemSettingsList,
+        dabOperation::systemSettingsGet, dabOperation::inputKeyList, dabOperation::healthCheckGet, dabOperation::voiceList, dabOperation::version,
     };
 
+    class dabInterface;
+
     // this is the template for our dispatcher.  It itself is never instantiated, but allows us to specialize the actual templates we need
-    template< size_t, size_t, class T, class F >
-    struct nativeDispatch : public dispatcher<T>
+    // dispatchers are not polymorphic.  dabClient selects one with a switch over the operation, so the compiler sees the whole path from dispatch into the handler and can inline it
+    template< dabOperation, class T, class F >
+    struct nativeDispatch
     {
         nativeDispatch ()
         {
             assert ( false );
         }
 
-        nativeDispatch ( F, std::vector<std::string> const &, std::vector<std::string> const & )
+        explicit nativeDispatch ( F )
         {}
 
         ~nativeDispatch () = default;
 
-        jsonElement operator() ( T *, jsonElement const & ) override
+        dabResult operator() ( T *, jsonElement const &, std::optional<dabStream> * ) const
         {
-            throw dabException{500, "server error"};
+            return std::unexpected ( dabError{ 500, "server error" } );
         }
     };
 
     // this is our actual dispatcher.
     // Its purpose is to take call a c++ method, but call it with parameters that are extracted from the json parameter being passed in.
-    // there are two types of parameter arrays.  fixedParams whose value MUST be present in the json, and optionalParams whose value need not be present in the json, and if not there a default constructed version is passed in
-    // template takes the number of fixed and optional parameters, the type of class used to dispatch against and the R ( C:: * )(Args...)  prototype for the method to call
-    template< size_t nFixed, size_t nOptional, typename T, class R, class C, class ... Args >
-    struct nativeDispatch<nFixed, nOptional, T, R ( C::* ) ( Args... )> : public dispatcher<T>
+    // there are two types of parameters.  fixed parameters whose value MUST be present in the json, and optional parameters whose value need not be present in the json, and if not there a default constructed version is passed in
+    // template takes the operation being dispatched (its METHODS entry supplies the parameter names), the type of class used to dispatch against and the R ( C:: * )(Args...)  prototype for the method to call
+    // the names are all compile time constants, so binding costs a single lookup per parameter and no copies for string and json parameters
+    // the method may return a jsonElement, a dabResult, a dabStream or nothing.   Missing or mistyped parameters are reported without throwing
+    template< dabOperation op, typename T, class R, class C, class ... Args >
+    struct nativeDispatch<op, T, R ( C::* ) ( Args... )>
     {
+        static constexpr size_t nFixed = dabOperationInfo::fixedCounts[(size_t) op];
+        static constexpr size_t nOptional = dabOperationInfo::optionalCounts[(size_t) op];
+        static_assert ( sizeof... ( Args ) == nFixed + nOptional, "method parameters don't match its METHODS entry" );
+
         nativeDispatch ()
         {
             // should never be called
             assert ( false );
         }
 
-        // the constructor takes the function pointer of the method to call, and a vector of fixed and a vector of optional parameters
-        nativeDispatch ( R ( C::*func ) ( Args... ), std::vector<std::string_view> const &fixedParams, std::vector<std::string_view> const &optionalParams ) : fixedParams ( fixedParams ), optionalParams ( optionalParams )
+        // the constructor takes the function pointer of the method to call
+        explicit nativeDispatch ( R ( C::*func ) ( Args... ) ) : funcPtr ( func )
         {
-            funcPtr = func;
         }
 
-        virtual ~nativeDispatch () = default;
-
         // this is the main dispatch entry point.  It takes a pointer to the class of the method to call, and the jsonElement containing any fixed and/or optional parameters to extract and call the method with
-        jsonElement operator() ( T *cls, jsonElement const &elem ) override
+        // stream receives the body of a streamed response, if it's nullptr a streamed response is collected and returned in full
+        dabResult operator() ( T *cls, jsonElement const &elem, std::optional<dabStream> *stream ) const
         {
-            // call the fixed position of our dispatcher.   This is
-            return callFixed<0, 0> ( cls, elem, types < Args... > {} );
+            // payload is only looked up the once
+            return call ( cls, elem, elem.find ( "payload" ), stream, std::index_sequence_for<Args...> {} );
         }
 
     private:
@@ -107,104 +311,146 @@ namespace DAB
         // this is the actual function we wish to dispatch against
         R ( C::*funcPtr ) ( Args... );
 
-        // these are the names of the fixed parameters we
-        std::vector<std::string_view> fixedParams;
-        std::vector<std::string_view> optionalParams;
-
-        // type-list for our meta-program below   This struct is blank and only servers to specialize functions based on the type parameter pack being passed in.
-        template< class ... >
-        struct types
+        static constexpr std::string_view paramName ( size_t param )
         {
-        };
+            return dabOperationInfo::paramNames[dabOperationInfo::paramOffsets[(size_t) op] + param];
+        }
 
-        // start iterating through any fixed parameters.   We look up the element in the jsonElement class and recurse
-        //     into the function again with the looked up element at the end of the parameter list
-        //     this results in a function call with the jsonElements automatically discovered
-        //     the first two parameters are which fixed and optional parameters to extract
-        template< size_t fixed, size_t optional, class Head, class ... Tail, class ...Vs >
-        jsonElement callFixed ( T *cls, jsonElement const &elem, types<Head, Tail ...>, Vs &&...vs )
+        // what a * parameter receives: the request with the members of its payload at the top level, alongside topic and payload themselves
+        static jsonElement wholeRequest ( jsonElement const &elem, jsonElement const *payload )
         {
-            if constexpr ( fixed < nFixed )
+            jsonElement whole = elem;
+            if ( payload && payload->isObject () )
             {
-                // extract the fixedParams (the one we're current extracting is passed in by the first template parameter
-                // then recurse but call the next template parameter,  the extracted parameters are appended onto the end as a VS...vs parameter pack
-                // we check first in "payload" and second in the base json to allow us to pass in either type of value as the parameter (for instance context)
-                if ( elem["payload"].has ( fixedParams[fixed] ))
-                {
-                    return callFixed<fixed + 1, optional> ( cls, elem, types<Tail...>{}, std::forward<Vs> ( vs )..., elem["payload"][fixedParams[fixed]] );
-                } else if ( elem.has ( fixedParams[fixed] ))
-                {
-                    return callFixed<fixed + 1, optional> ( cls, elem, types<Tail...>{}, std::forward<Vs> ( vs )..., elem[fixedParams[fixed]] );
-                } else if ( fixedParams[fixed] == "*" )
-                {
-                    // you can use the * to receive the entire json object without being parsed into parameters
-                    return callFixed<fixed + 1, optional> ( cls, elem, types<Tail...>{}, std::forward<Vs> ( vs )..., elem );
-                } else
+                for ( auto it = payload->cbeginObject (); it != payload->cendObject (); it++ )
                 {
-                    throw dabException{400, std::string ( "missing parameter \"" ) + fixedParams[fixed].data () + "\""};
+                    // topic and payload win over payload members of the same name
+                    if ( !whole.has ( it->first ) )
+                    {
+                        whole[std::string_view ( it->first )] = it->second;
+                    }
                 }
+            }
+            return whole;
+        }
+
+        // find the value of a parameter, nullptr if it's missing
+        // we check first in "payload" and second in the base json to allow us to pass in either type of value as the parameter (for instance context)
+        template< size_t param >
+        static jsonElement const *lookup ( jsonElement const &elem, jsonElement const *payload, [[maybe_unused]] jsonElement const &whole )
+        {
+            constexpr auto name = paramName ( param );
+            if constexpr ( name == "*" )
+            {
+                // you can use the * to receive the entire json object without being parsed into parameters
+                return &whole;
             } else
             {
-                // we have extracted all the fixed parameters, no call start extracting any optional parameters
-                return callOptional<fixed, optional> ( cls, elem, types<Head, Tail...>{}, std::forward<Vs> ( vs )... );
+                auto value = payload ? payload->find ( name ) : nullptr;
+                if ( !value )
+                {
+                    value = elem.find ( name );
+                }
+                return value;
             }
         }
 
-        // for cases with NO optional parameters - type list has been exhausted and there are no optional parameters
-        template< size_t fixed, size_t optional, class ...Vs >
-        jsonElement callFixed ( T *cls, jsonElement const &, types<>, Vs &&...vs )
+        // true if value has the json type the method's parameter is converted from (which would otherwise throw on conversion)
+        template< class V >
+        static bool holds ( jsonElement const &value )
         {
-            static_assert ( fixed == nFixed );
-            static_assert ( !optional );
-
-            if constexpr ( std::is_same_v<R, void> )
+            if constexpr ( std::is_same_v<V, std::string> )
+            {
+                return value.isString ();
+            } else if constexpr ( std::is_same_v<V, int64_t> )
+            {
+                return value.isInteger ();
+            } else if constexpr ( std::is_same_v<V, double> )
+            {
+                return value.isDouble ();
+            } else if constexpr ( std::is_same_v<V, bool> )
             {
-                (cls->*funcPtr) ( std::forward<Vs> ( vs )... );
-                return {};
+                return value.isBool ();
             } else
             {
-                return (cls->*funcPtr) ( std::forward<Vs> ( vs )... );
+                return true;
             }
         }
 
-        // start extracting the optional parameters and looking them up in the jsonElement.
-        //     If the desired element isn't present in the passed in json object, then we just
-        //     create a default-initialized value of type HEAD
-        template< size_t fixed, size_t optional, class Head, class ... Tail, class ...Vs >
-        jsonElement callOptional ( T *cls, jsonElement const &elem, types<Head, Tail ...>, Vs &&...vs )
+        // checks a looked up parameter can be bound, setting error if it can't
+        template< size_t param, class Arg >
+        static bool check ( jsonElement const *value, std::optional<dabError> &error )
         {
-            // see if the desired element is present
-            if ( elem["payload"].has ( optionalParams[optional] ))
+            if ( !value )
             {
-                // it is, so extract and call it
-                return callOptional<fixed, optional + 1> ( cls, elem, types<Tail...>{}, std::forward<Vs> ( vs )..., elem["payload"][optionalParams[optional]] );
-            } else if ( elem.has ( optionalParams[optional] ))
+                if constexpr ( param < nFixed )
+                {
+                    error = dabError{ 400, std::string ( "missing parameter \"" ) + std::string ( paramName ( param )) + "\"" };
+                    return false;
+                }
+                return true;
+            }
+            if ( !holds<std::remove_cvref_t<Arg>> ( *value ))
+            {
+                error = dabError{ 400, std::string ( "invalid parameter \"" ) + std::string ( paramName ( param )) + "\"" };
+                return false;
+            }
+            return true;
+        }
+
+        // convert a parameter's value to the type the method takes.   strings and json are passed as references into the request
+        // missing optional parameters are passed a default constructed value
+        template< class Arg >
+        static decltype ( auto ) bind ( jsonElement const *value )
+        {
+            using V = std::remove_cvref_t<Arg>;
+            if constexpr ( std::is_same_v<V, jsonElement> || std::is_same_v<V, std::string> )
             {
-                // it is, so extract and call it
-                return callOptional<fixed, optional + 1> ( cls, elem, types<Tail...>{}, std::forward<Vs> ( vs )..., elem[optionalParams[optional]] );
+                static V const empty{};
+                return value ? static_cast<V const &> ( *value ) : empty;
             } else
             {
-                // it's not so create a default initialized value of the desired type
-                return callOptional<fixed, optional + 1> ( cls, elem, types<Tail...>{}, std::forward<Vs> ( vs )..., Head{} );
+                return value ? static_cast<V> ( *value ) : V{};
             }
         }
 
-        // we've now generated function parameters (vs) for all our specified fixed and optional parameters, and it's now time to call the function
-        template< size_t fixed, size_t optional, class ...Vs >
-        jsonElement callOptional ( T *cls, jsonElement const &, types<>, Vs &&...vs )
+        template< size_t ... params >
+        dabResult call ( T *cls, [[maybe_unused]] jsonElement const &elem, [[maybe_unused]] jsonElement const *payload, [[maybe_unused]] std::optional<dabStream> *stream, std::index_sequence<params...> ) const
         {
-            static_assert ( fixed == nFixed );
-            static_assert ( optional == nOptional );
+            // only built for methods that take a *, the rest bind straight into the request
+            [[maybe_unused]] jsonElement whole;
+            if constexpr ( ((paramName ( params ) == "*") || ... || false) )
+            {
+                whole = wholeRequest ( elem, payload );
+            }
+            [[maybe_unused]] std::array<jsonElement const *, sizeof... ( Args )> values{ lookup<params> ( elem, payload, whole )... };
+
+            // checked in order, so if several parameters are bad it's the first that's reported
+            std::optional<dabError> error;
+            if ( !(check<params, Args> ( values[params], error ) && ...))
+            {
+                return std::unexpected ( std::move ( *error ));
+            }
 
             // test to see if the function's return type is void, if it is, than just create a jsonElement as a return type
             if constexpr ( std::is_same_v<R, void> )
             {
-                (cls->*funcPtr) ( std::forward<Vs> ( vs )... );
-                return {};
+                (cls->*funcPtr) ( bind<Args> ( values[params] )... );
+                return jsonElement{};
+            } else if constexpr ( std::is_same_v<R, dabStream> )
+            {
+                auto body = (cls->*funcPtr) ( bind<Args> ( values[params] )... );
+                if ( !stream )
+                {
+                    return body.collect ();
+                }
+                auto rsp = body.header ();
+                stream->emplace ( std::move ( body ));
+                return rsp;
             } else
             {
                 // already returning desired return value so just call the function
-                return (cls->*funcPtr) ( std::forward<Vs> ( vs )... );
+                return (cls->*funcPtr) ( bind<Args> ( values[params] )... );
             }
         }
     };
@@ -216,11 +462,35 @@ namespace DAB
     {
         std::function< void(jsonElement const &) > publishCallback;
 
+        // nullptr uses the process wide default scheduler
+        dabTelemetryScheduler *telemetryScheduler = nullptr;
+
     public:
         virtual ~dabInterface () = default;
 
+        // set the scheduler to run our telemetry on.  Any telemetry running on the previous scheduler is stopped
+        void setTelemetryScheduler ( dabTelemetryScheduler &scheduler )
+        {
+            if ( &scheduler != &getTelemetryScheduler () )
+            {
+                getTelemetryScheduler ().removeAll ( this );
+                telemetryScheduler = &scheduler;
+            }
+        }
+
+        dabTelemetryScheduler &getTelemetryScheduler ()
+        {
+            return telemetryScheduler ? *telemetryScheduler : dabTelemetryScheduler::getDefault ();
+        }
+
         virtual jsonElement dispatch ( jsonElement const &json ) = 0;
 
+        // as dispatch, but the body of a streamed response is left in stream for the caller to send and only the header response is returned
+        virtual jsonElement dispatch ( jsonElement const &json, std::optional<dabStream> & )
+        {
+            return dispatch ( json );
+        }
+
         // set the callback for publishing (sending out telemetry)
         void setPublishCallback ( decltype ( publishCallback) cb )
         {
@@ -238,6 +508,18 @@ namespace DAB
         {
             return {};
         }
+
+        // if we have a cached response for this request topic, copy the already serialized response into response and return true
+        virtual bool getCachedResponse ( std::string_view, std::string & )
+        {
+            return false;
+        }
+
+        // returns true if the topic is one of the request topics we route.  When subscribed by wildcard this filters out everything else (such as our own telemetry)
+        virtual bool isRequestTopic ( std::string_view )
+        {
+            return false;
+        }
     };
 
     template< typename T >
@@ -246,207 +528,198 @@ namespace DAB
         const std::string protocolVersion = "2.0";          // version of the DAB protocol being implemented
         std::string ipAddress;                              // ip address for dab/discovery response
 
-        // this is an XMACRO list of def() macro's.   It contains the dab method name, the name of the method to call and to arrays of fixed and optional parameters defined as string literals
-        // NOTE: multiple fixed or optional parameters need to be enclosed in ()   this is a preprocessor limitation, it will work just fine if you do this
-#define METHODS \
-            def( "/operations/list", opList, opList, {}, {} )                                                                                       \
-            def( "/applications/list", appList, appList, {}, {} )                                                                                   \
-            def( "/applications/launch", appLaunch, appLaunch, {"appId"}, {"parameters"} )                                                          \
-            def( "/applications/launch-with-content", appLaunchWithContent, appLaunchWithContent, ({ "appId", "contentId" }), { "parameters" } )    \
-            def( "/applications/get-state", appGetState, appGetState, { "appId" }, {} )                                                             \
-            def( "/applications/exit", appExit, appExit, {"appId"}, {"background"} )                                                                \
-            def( "/device/info", deviceInfo, deviceInfo, {}, {} )                                                                                   \
-            def( "/system/restart", systemRestart, systemRestart, {}, {} )                                                                          \
-            def( "/system/settings/list", systemSettingsList, systemSettingsList, {}, {} )                                                          \
-            def( "/system/settings/get", systemSettingsGet, systemSettingsGet, {}, {} )                                                             \
-            def( "/system/settings/set", systemSettingsSet, systemSettingsSet, { "*" }, {} )                                                 \
-            def( "/input/key/list", inputKeyList, inputKeyList, {}, {} )                                                                            \
-            def( "/input/key-press", inputKeyPress, inputKeyPress, { "keyCode"}, {} )                                                               \
-            def( "/input/long-key-press", inputKeyLongPress, inputKeyLongPress, ({ "keyCode", "durationMs" }), {} )                                \
-            def( "/output/image", outputImage, outputImage, {}, {} )                                                                                \
-            def( "/device-telemetry/start", deviceTelemetry, deviceTelemetryStartInternal, ({ "duration" }), {} )                          \
-            def( "/device-telemetry/stop", deviceTelemetry, deviceTelemetryStopInternal, {}, {} )                                                   \
-            def( "/app-telemetry/start", appTelemetry, appTelemetryStartInternal, ({ "appId", "duration" }), {} )                          \
-            def( "/app-telemetry/stop", appTelemetry, appTelemetryStopInternal, {"appId"}, {} )                                                     \
-            def( "/health-check/get", healthCheckGet, healthCheckGet, { }, {} )                                                                     \
-            def( "/voice/list", voiceList, voiceList, { }, {} )                                                                                     \
-            def( "/voice/set", voiceSet, voiceSet, { "voiceSystem" }, {} )                                                                         \
-            def( "/voice/send-audio", voiceSendAudio, voiceSendAudio, { "fileLocation" }, {"voiceSystem" } )                                       \
-            def( "/voice/send-text", voiceSendText, voiceSendText, { "requestText" }, {"voiceSystem" } )                                           \
-            def( "/version", version, version, { }, {} )
-
-        // map by operation storing a pointer to the dispatcher and a bool if it has been implemented by the user
-        std::map<std::string, std::pair<std::unique_ptr<dispatcher<T>>, bool>> dispatchMap;
-
-        // telemetry mutex and condition variable for scheduling
-        std::mutex telemetryAccess;
-        std::condition_variable telemetryCondition;
-
-        // base telemetry Executor class.   This will be specialized and should never be called directly.
-        // we need this as the executor is polymorphic based on passed in types
-        class telemetryExecutor
-        {
-        public:
-            virtual ~telemetryExecutor () = default;
-
-            virtual std::chrono::time_point<std::chrono::steady_clock> getNextScheduledTime ()
-            {
-                return std::chrono::steady_clock::now ();
-            }
-
-            virtual jsonElement getTelemetry ()
-            {
-                return {};
-            }
-
-            virtual void setInterval ( std::chrono::milliseconds newInterval )
-            {}
-        };
-
-        // this is the actual specialized telemetry executor
-        // it stores:
-        //      the callback to handle the telemetry
-        //      the interval between callbacks
-        template< typename F >
-        class telemetry : public telemetryExecutor
+        // table indexed by dabOperation of whether the operation has been implemented by the user.  It depends only on T, so it's built once (on construction of the first instance)
+        // and shared by all of them
+        static std::array<bool, dabOperationInfo::count> const &getImplemented ()
         {
-            std::chrono::milliseconds interval;
-            F callback;
-        public:
-            virtual ~telemetry () = default;
+            static std::array<bool, dabOperationInfo::count> const table = [] {
+                std::array<bool, dabOperationInfo::count> built{};
+
+                // XMACRO instantiation of our list of method names and methods.  A method counts as implemented if it was overridden by the instantiating class (must be done using CRTP)
+#define def( methName, detectFunc, callFunc, fixedParams, optionalParams )                                                                                                                                                                                            \
+                built[(size_t) dabOperation::callFunc] = !std::is_same_v<decltype(&dabClient::detectFunc), decltype(&T::detectFunc)> || !strcmp ( "/operations/list", (methName) ) || !strcmp ( "/version", (methName) );
+                METHODS
+#undef def
+
+                // dab/discovery.   special as it doesn't have deviceID
+                built[(size_t) dabOperation::discovery] = false;
+                return built;
+            } ();
+            return table;
+        }
 
-            telemetry ( std::chrono::milliseconds interval, F getTelemetryCallback ) : interval ( interval ), callback ( getTelemetryCallback )
+        std::array<bool, dabOperationInfo::count> const &implemented = getImplemented ();
+
+        // calls the method for op.   Each case binds its parameters and calls T's method directly, so none of this goes through a function pointer the compiler can't see through
+        dabResult callOperation ( dabOperation op, jsonElement const &elem, std::optional<dabStream> *stream )
+        {
+            switch ( op )
             {
+#define def( methName, detectFunc, callFunc, fixedParams, optionalParams )                                                                                                                                                                                            \
+                case dabOperation::callFunc:                                                                                                            \
+                    return nativeDispatch<dabOperation::callFunc, T, decltype(&T::callFunc)> ( &T::callFunc ) ( static_cast<T *>(this), elem, stream );
+                METHODS
+#undef def
+                case dabOperation::discovery:
+                    return nativeDispatch<dabOperation::discovery, T, decltype(&T::discovery)> ( &T::discovery ) ( static_cast<T *>(this), elem, stream );
+                default:
+                    return std::unexpected ( dabError{ 400, "unknown operation" } );
             }
+        }
+
+        // serialized response cache, indexed by dabOperation.  Entries with a 0 ttl are not cached
+        struct cacheEntry
+        {
+            std::chrono::milliseconds ttl{ 0 };
+            std::chrono::steady_clock::time_point expires{};
+            std::string response;       // empty if nothing is cached
+        };
+        std::mutex cacheAccess;
+        std::array<cacheEntry, dabOperationInfo::count> cachedResponses;
 
-            std::chrono::time_point<std::chrono::steady_clock> getNextScheduledTime () override
+        // request counts and handler times, recorded once enabled
+        dabDeviceMetrics metrics{ dabOperationInfo::count, dabOperationInfo::names };
+
+        // callOperation, timing the handler if metrics are enabled.  Anything the handler throws is counted as an error
+        dabResult timedOperation ( dabOperation op, jsonElement const &elem, std::optional<dabStream> *stream )
+        {
+            if ( !metrics.isEnabled () )
             {
-                return std::chrono::steady_clock::now () + interval;
+                return callOperation ( op, elem, stream );
             }
 
-            jsonElement getTelemetry () override
+            auto start = dabDeviceMetrics::clock::now ();
+            try
+            {
+                auto result = callOperation ( op, elem, stream );
+
+                int64_t status = 200;
+                if ( !result )
+                {
+                    status = result.error ().errorCode;
+                } else if ( auto *value = result->find ( "status" ); value && value->isInteger () )
+                {
+                    status = (int64_t) *value;
+                }
+                metrics.record ( (size_t) op, dabDeviceMetrics::clock::now () - start, status );
+                return result;
+            } catch ( ... )
             {
-                return callback ();
+                metrics.record ( (size_t) op, dabDeviceMetrics::clock::now () - start, 500 );
+                throw;
             }
-            void setInterval ( std::chrono::milliseconds newInterval ) override
+        }
+
+        void setCachePolicy ( dabCachePolicy const &policy )
+        {
+            if ( policy.op < dabOperation::discovery && !dabOperationInfo::paramCounts[(size_t) policy.op] )
             {
-                interval = newInterval;
+                cachedResponses[(size_t) policy.op].ttl = policy.ttl;
             }
-        };
+        }
 
-        // this is the structure used to schedule our telemetry callbacks.  Fundamentally it is a map with the index value being the next time for a callback
-        // we use a wait_until condition variable based on the front of the map (the next time something needs to be triggered).
-        // we can add things in at any time by simply doing a notify on the condition variable if we add additional telemetry slots in the future
-        std::map<std::chrono::time_point<std::chrono::steady_clock>, std::tuple<std::string, std::string, std::unique_ptr<telemetryExecutor> >> telemetryScheduler;
+        void storeCachedResponse ( dabOperation op, jsonElement const &rsp )
+        {
+            auto &entry = cachedResponses[(size_t) op];
+
+            std::string response;
+            rsp.serialize ( response, true );
+
+            std::lock_guard l1 ( cacheAccess );
+            entry.response = std::move ( response );
+            entry.expires = entry.ttl == dabCachePolicy::forever ? std::chrono::steady_clock::time_point::max () : std::chrono::steady_clock::now () + entry.ttl;
+        }
 
         // callback to add data to telemetry
         template< typename F >
         void addTelemetry ( std::chrono::milliseconds interval, std::string const &id, std::string const &topic, F getTelemetryCallback )
         {
-            std::lock_guard l1 ( telemetryAccess );
-
-            // iterate through our telemetry to see if the app(or device) already exists, if so, just update the interval
-            for ( auto it = telemetryScheduler.begin(); it != telemetryScheduler.end(); it++ )
-            {
-                if ( std::get<0>(it->second) == id )
-                {
-                    std::get<2>(it->second).get()->setInterval ( interval );
-                    telemetryCondition.notify_all ();
-                    return;
-                }
-            }
-            // schedule for NOW so we send one immediately
-            telemetryScheduler.insert ( std::move ( std::pair ( std::chrono::steady_clock::now (), std::move(std::tuple(id, topic, std::make_unique<telemetry<F>> ( interval, getTelemetryCallback ) )) )));
-            telemetryCondition.notify_all ();
+            getTelemetryScheduler ().add ( this, deviceId, id, topic, interval, std::move ( getTelemetryCallback ), [this] ( jsonElement const &elem ) { publish ( elem ); } );
         }
 
         // pretty self-explanatory, if it exists delete it
         void deleteTelemetry ( std::string const &id )
         {
-            std::lock_guard l1 ( telemetryAccess );
+            getTelemetryScheduler ().remove ( this, id );
+        }
 
-            for ( auto it = telemetryScheduler.begin(); it != telemetryScheduler.end(); it++ )
+    protected:
+        // the deviceID for this client
+        std::string deviceId;
+
+    public:
+
+        explicit dabClient ( std::string const &deviceId, std::string const &ipAddress ) : deviceId ( deviceId ), ipAddress ( ipAddress )
+        {
+            setCachePolicy ( { dabOperation::opList, dabCachePolicy::forever } );
+            setCachePolicy ( { dabOperation::version, dabCachePolicy::forever } );
+            if constexpr ( requires { std::size ( T::responseCache ); } )
             {
-                if ( std::get<0>(it->second) == id )
+                for ( auto const &policy : T::responseCache )
                 {
-                    /* already exists, so update the scheduled time */
-                    telemetryScheduler.erase ( it );
-                    telemetryCondition.notify_all ();
-                    return;
+                    setCachePolicy ( policy );
                 }
             }
         }
 
-        // telemetryTask is a worker thread, we use the exiting boolean to allow us to exit cleanly
-        std::atomic<bool> exiting = false;
+        // this device's request counts and handler times.   They're only recorded once enabled with getMetrics ().setEnabled ( true )
+        dabDeviceMetrics &getMetrics ()
+        {
+            return metrics;
+        }
 
-        // this is our main scheduling thread
-        void telemetryTask ()
+        // drop any cached response for op
+        void invalidateCache ( dabOperation op )
         {
-            // keep going so long as our exiting boolean has not been set to true
-            while ( !exiting )
+            std::lock_guard l1 ( cacheAccess );
+            cachedResponses[(size_t) op].response.clear ();
+        }
+
+        // drop all cached responses
+        void invalidateCache ()
+        {
+            std::lock_guard l1 ( cacheAccess );
+            for ( auto &entry : cachedResponses )
             {
-                std::unique_lock l1 ( telemetryAccess );
-                if ( telemetryScheduler.empty() )
-                {
-                    // nothing to schedule so just wait until our condition variable gets notified
-                    telemetryCondition.wait ( l1 );
-                } else
-                {
-                    // wait until either our condition variable gets notified (something added or deleted or exiting)
-                    //    or until our next-scheduled telemetry time is exceeded
-                    telemetryCondition.wait_until( l1, telemetryScheduler.begin ()->first );
-                }
-                if ( !telemetryScheduler.empty ())
-                {
-                    // check to see if our next to fire event time has been passed, if so get the telemetry data and publish it
-                    if ( telemetryScheduler.begin ()->first < std::chrono::steady_clock::now ())
-                    {
-                        // get the telemetry data (calling the callback passed in during addTelemetry)
-                        auto rsp = std::get<2>(telemetryScheduler.begin ()->second).get()->getTelemetry ();
-                        // call the publish callback to send the telemetry data to any subscribers
-                        publish ( { { "topic", std::get<1>(telemetryScheduler.begin ()->second) }, {"payload", rsp} } );
-
-                        // extract the node entry, calculate a new key value (execution time) and reinsert (no reallocation or copying, just some pointer manipulation so this is fast
-                        auto nodeHandle = telemetryScheduler.extract ( telemetryScheduler.begin ()->first );
-                        nodeHandle.key () = std::get<2>(nodeHandle.mapped()).get()->getNextScheduledTime ();
-                        telemetryScheduler.insert ( std::move(nodeHandle) );
-                    }
-                }
+                entry.response.clear ();
             }
         }
 
-    protected:
-        // the deviceID for this client
-        std::string deviceId;
-
-    public:
+        bool getCachedResponse ( std::string_view topic, std::string &response ) override
+        {
+            auto op = findOperation ( topic );
+            if ( op >= dabOperation::discovery || !cachedResponses[(size_t) op].ttl.count () )
+            {
+                return false;
+            }
+            auto &entry = cachedResponses[(size_t) op];
 
-        std::thread  telemetryThreadId;
+            std::lock_guard l1 ( cacheAccess );
+            if ( entry.response.empty () || std::chrono::steady_clock::now () >= entry.expires )
+            {
+                return false;
+            }
+            response = entry.response;
+            return true;
+        }
 
-        explicit dabClient ( std::string const &deviceId, std::string const &ipAddress ) : deviceId ( deviceId ), ipAddress ( ipAddress )
+        // maps a request topic onto our operation.  device topics must be dab/<deviceId> followed by one of the METHODS suffixes
+        dabOperation findOperation ( std::string_view topic ) const
         {
-            // XMACRO instantiation of our list of method names, methods and fixed and optional parameters
-            // this is resolved into a map of method name and a pair of unique pointers to a nativeDispatcher
-            //     instance and a bool indicating if the method was overridden by the instantiating class (must be done using CRTP)
-#define def( methName, detectFunc, callFunc, fixedParams, optionalParams )                                                                                                                                                                                            \
-                {                                                                                                       \
-                    auto disp = std::make_unique<nativeDispatch<std::initializer_list<char const *>fixedParams.size (), std::initializer_list<char const *>optionalParams.size (), T, decltype(&T::callFunc)>> ( &T::callFunc, std::vector<std::string_view> fixedParams, std::vector<std::string_view> optionalParams );   \
-                    auto p1 = std::make_pair ( std::move ( disp ), !std::is_same_v<decltype(&dabClient::detectFunc), decltype(&T::detectFunc)> || !strcmp ( "/operations/list", (methName) ) || !strcmp ( "/version", (methName) ) );                                    \
-                    auto p2 = std::make_pair ( std::string ( "dab/" ) + deviceId + (methName), std::move ( p1 ) );                                                                                                                                            \
-                    dispatchMap.insert ( std::move ( p2) );                                                                                                                                                                                                    \
-                }
-            METHODS
-
-            // dab/discovery.   special as it doesn't have deviceID
-            {                                                                                                       \
-                    auto disp = std::make_unique<nativeDispatch<0, 0, T, decltype(&T::discovery)>> ( &T::discovery, std::vector<std::string_view> {}, std::vector<std::string_view> {} );   \
-                    auto p1 = std::make_pair ( std::move ( disp ), false );                                    \
-                    auto p2 = std::make_pair ( std::string ( "dab/discovery" ), std::move ( p1 ) );                                                                                                                                            \
-                    dispatchMap.insert ( std::move ( p2) );                                                                                                                                                                                                    \
+            if ( topic == dabOperationInfo::names[(size_t) dabOperation::discovery] )
+            {
+                return dabOperation::discovery;
             }
+            if ( topic.size () > deviceId.size () + 4 && topic.starts_with ( "dab/" ) && topic.substr ( 4, deviceId.size () ) == deviceId )
+            {
+                return dabOperationRouter::find ( topic.substr ( 4 + deviceId.size () ) );
+            }
+            return dabOperation::unknown;
+        }
 
-            telemetryThreadId = std::thread ( &dabClient::telemetryTask, this );
+        bool isRequestTopic ( std::string_view topic ) override
+        {
+            return findOperation ( topic ) != dabOperation::unknown;
         }
 
         // this is the getTopics instantiation.  It returns a list of all the operations we support so that we subscribe to them
@@ -454,12 +727,11 @@ namespace DAB
         std::vector<std::string> getTopics () override
         {
             std::vector<std::string> topics;
-            for ( auto const &it: dispatchMap )
+            for ( size_t op = 0; op < dabOperationInfo::count; op++ )
             {
-                if ( it.second.second )
+                if ( implemented[op] )
                 {
-                    // return operation, but trim off leading dab/<deviceId>/
-                   topics.push_back ( it.first );
+                    topics.push_back ( std::string ( "dab/" ) + deviceId + std::string ( dabOperationInfo::names[op] ) );
                 }
             }
             return topics;
@@ -467,22 +739,20 @@ namespace DAB
 
         ~dabClient () override
         {
-            // set exiting, notify our telemetry worker thread and wait for it to exit
-            exiting = true;
-            telemetryCondition.notify_all();
-            telemetryThreadId.join();
+            // stop our telemetry and wait for any callback that's currently running
+            getTelemetryScheduler ().removeAll ( this );
         }
 
         // this is our implementation of opList.   It uses the overridden bool to specify if the operation is supported and only returns operations that the client supports
         jsonElement opList ()
         {
             jsonElement elem;
-            for ( auto const &it: dispatchMap )
+            for ( size_t op = 0; op < dabOperationInfo::count; op++ )
             {
-                if ( it.second.second )
+                if ( implemented[op] )
                 {
-                    // return operation, but trim off leading dab/<deviceId>/
-                    elem["operations"].push_back ( std::string ( it.first.c_str() + it.first.find ( '/', it.first.find ( '/' ) + 1 ) + 1 ) );
+                    // return operation, but trim off leading /
+                    elem["operations"].push_back ( std::string ( dabOperationInfo::names[op].substr ( 1 ) ) );
                 }
             }
             return elem;
@@ -504,16 +774,16 @@ namespace DAB
         // this is the internal implementation for deviceTelemetryStart.  This is NOT the override for the users telemetry call
         //    this function takes the duration and sets up the calls to the appropriate telemetry method.  That method id described
         //    lower down in the codebase
-        jsonElement deviceTelemetryStartInternal ( int64_t durationMs )
+        dabResult deviceTelemetryStartInternal ( int64_t durationMs )
         {
             if constexpr ( std::is_member_function_pointer_v<decltype ( &T::deviceTelemetry )> )
             {
                 // construct the topic to publish on and add the telemetry with the lambda that calls the deviceTelemetry() method (which is what the user needs to implement)
                 addTelemetry ( std::chrono::milliseconds ( durationMs ), "", std::string ( "dab/" ) + deviceId + "/device-telemetry/metrics" , [this] () { return (static_cast<T*>(this)->*(&T::deviceTelemetry )) (  ); } );
-                return {{"duration", durationMs}};
+                return jsonElement{{"duration", durationMs}};
             } else
             {
-                throw dabException ( 400, "device telemetry not supported" );
+                return std::unexpected ( dabError{ 400, "device telemetry not supported" } );
             }
         }
 
@@ -527,16 +797,16 @@ namespace DAB
         // this is the internal implementation for applicationTelemetryStart.  This is NOT the override for the users telemetry call
         //    this function takes the duration and sets up the calls to the appropriate telemetry method.  That method id described
         //    lower down in the codebase
-        jsonElement appTelemetryStartInternal ( std::string const &appId, int64_t durationMs )
+        dabResult appTelemetryStartInternal ( std::string const &appId, int64_t durationMs )
         {
             if constexpr ( std::is_member_function_pointer_v<decltype ( &T::appTelemetry )> )
             {
                 // construct the topic to publish on and add the telemetry with the lambda that calls the appTelemetry() method (which is what the user needs to implement)
                 addTelemetry ( std::chrono::milliseconds ( durationMs ), appId, std::string ( "dab/" ) + deviceId + "/app-telemetry/metrics/" + appId , [this, appId] () { return (static_cast<T*>(this)->*(&T::appTelemetry )) ( appId ); } );
-                return {{"duration", durationMs}};
+                return jsonElement{{"duration", durationMs}};
             } else
             {
-                throw dabException ( 400, "app telemetry not supported" );
+                return std::unexpected ( dabError{ 400, "app telemetry not supported" } );
             }
         }
 
@@ -551,75 +821,102 @@ namespace DAB
         // this function takes in the json, extracts the topic, response topic, any correlation data
         // it then calls the proper user handler, takes the payload response, builds the full response and
         // publishes it using the response topic.
-        // it catches any exceptions and builds appropriate dab error responses should a failure occur
+        // errors we detect, and those returned by handlers as a dabResult, are turned into responses directly.   It catches any exceptions thrown by handlers and builds appropriate dab error responses for those
         jsonElement dispatch ( jsonElement const &elem ) override
+        {
+            return dispatchRequest ( elem, nullptr );
+        }
+
+        // a handler returning a dabStream leaves its body in stream, the response returned is the stream's header
+        jsonElement dispatch ( jsonElement const &elem, std::optional<dabStream> &stream ) override
+        {
+            return dispatchRequest ( elem, &stream );
+        }
+
+    private:
+        jsonElement dispatchRequest ( jsonElement const &elem, std::optional<dabStream> *stream )
         {
             jsonElement rsp;
             try
             {
-                std::string topic = elem["topic"];
+                auto topic = elem.find ( "topic" );
 
-                auto it = dispatchMap.find ( topic );
-                if ( it != dispatchMap.end ())
+                auto op = topic && topic->isString () ? findOperation ( static_cast<std::string const &> ( *topic )) : dabOperation::unknown;
+                if ( op == dabOperation::unknown )
+                {
+                    return { { "status", 400 }, { "error", "unknown operation" } };
+                }
+                // with wildcard subscriptions we can be sent operations the device doesn't implement
+                if ( op != dabOperation::discovery && !implemented[(size_t) op] )
+                {
+                    return { { "status", 501 }, { "error", "operation not supported" } };
+                }
+                auto result = timedOperation ( op, elem, stream );
+                if ( !result )
                 {
-                    rsp = (*it->second.first) ( static_cast<T *>(this), elem );
+                    return { { "status", result.error ().errorCode }, { "error", std::move ( result.error ().errorText ) } };
                 }
+                rsp = std::move ( *result );
                 if ( !rsp.has ( "status" ))
                 {
                     rsp["status"] = 200;
+
+                    // only responses that are plain successes (and not the header of a stream) are cached
+                    if ( op < dabOperation::discovery && cachedResponses[(size_t) op].ttl.count () && !(stream && *stream) )
+                    {
+                        storeCachedResponse ( op, rsp );
+                    }
+                }
+
+                if ( op == dabOperation::systemRestart )
+                {
+                    invalidateCache ();
+                }
+                for ( auto const &[changed, invalidated] : dabCacheInvalidations )
+                {
+                    if ( changed == op )
+                    {
+                        invalidateCache ( invalidated );
+                    }
                 }
             } catch ( std::pair<int, std::string> &e )
             {
-                rsp = { { "status", e.first, "error", e.second } };
+                rsp = { { "status", e.first }, { "error", e.second } };
             } catch ( std::pair<int, char const *> &e )
             {
-                rsp = { { "status", e.first, "error", e.second } };
+                rsp = { { "status", e.first }, { "error", e.second } };
             } catch ( dabException &e )
             {
-                rsp = { { "status", e.errorCode, "error", e.errorText } };
+                rsp = { { "status", e.errorCode }, { "error", e.errorText } };
             } catch ( ... )
             {
-                rsp = { { "status", 400, "error", "unable to parse request" } };
+                rsp = { { "status", 400 }, { "error", "unable to parse request" } };
             }
             return rsp;
         }
 
+    public:
         /* support function to execute a system command and return the results */
         std::string execCmd ( std::string const &cmd )
         {
-            try
+            // no timeout and no limit on the output, use the overload below to bound either
+            auto result = runProcess ( cmd, { std::chrono::milliseconds ( 0 ), SIZE_MAX } );
+            if ( !result )
             {
-                int retCode = 0;
-                std::string output;
-
-                auto close = [&retCode] ( FILE *file ) {
-#ifdef _WIN32
-                    retCode = _pclose ( file );
-#else
-                    retCode = pclose ( file );
-#endif
-                };
-
-#ifdef _WIN32
-                std::unique_ptr<FILE, decltype(close)> pipe ( _popen ( cmd.c_str (), "r" ), close );
-#else
-                std::unique_ptr<FILE, decltype ( close )> pipe ( popen ( cmd.c_str (), "r" ), close );
-#endif
-                if ( !pipe )
-                {
-                    throw std::runtime_error ( "popen() failed!" );
-                }
+                throw dabException{500, std::string ( "executing command \"" ) + cmd + "\" returned error " + std::to_string ( result.error () )};
+            }
+            return std::move ( result->output );
+        }
 
-                char tmpBuff[4096];
-                while ( fgets ( tmpBuff, sizeof (tmpBuff), pipe.get ()) != nullptr )
-                {
-                    output += tmpBuff;
-                }
-                return output;
-            } catch ( ... )
+        /* as above but with a timeout and an output limit, the exit code and whether it was cut short are returned along with the output */
+        dabProcessResult execCmd ( std::string const &cmd, dabProcessOptions const &options )
+        {
+            auto result = runProcess ( cmd, options );
+            if ( !result )
             {
-                throw dabException{500, std::string ( "executing command \"" ) + cmd + "\" returned error " + std::to_string (errno)};
+                throw dabException{500, std::string ( "executing command \"" ) + cmd + "\" returned error " + std::to_string ( result.error () )};
             }
+            return std::move ( *result );
         }
 
         /*
@@ -0,0 +1,188 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dabClient.h"
+#include "dabMetrics.h"
+#include "dabWorkerPool.h"
+
+// admission control between the mqtt interfaces and their request pool.
+// every request handed to the pool is counted against its device (the dab/<deviceId> portion of its topic) until it has been handled.  Once a device has
+// its limit of requests waiting or running, further requests for it are refused, and answered with a 503, rather than queued.   A device being flooded
+// therefore can't build an unbounded backlog, and since the pool serves devices round robin, other devices carry on as before.
+// read only requests can also be coalesced: a request identical (same topic, format and payload) to one that is still waiting or running is not queued
+// but is given the earlier request's response when it completes.
+
+namespace DAB
+{
+    class dabIngressGate
+    {
+    public:
+        // where a coalesced request's response is to go
+        struct waiter
+        {
+            std::string topic;
+            std::string correlationData;
+            bool hasCorrelationData = false;
+        };
+
+        enum class admission
+        {
+            run,            // queue the request
+            coalesced,      // an identical request is pending, this one will get its response
+            rejected        // the device's queue is full, answer with a 503
+        };
+
+    private:
+        dabPipelineMetrics &metrics;
+
+        std::mutex access;
+        size_t limit = 0;
+        bool coalescing = false;
+        int64_t queued = 0;
+
+        // requests waiting or running for each device with any
+        std::unordered_map<std::string, size_t, dabStringHash, std::equal_to<>> depths;
+
+        // coalescing key of each pending read only request -> the requests waiting on its response
+        std::unordered_map<std::string, std::vector<waiter>, dabStringHash, std::equal_to<>> pending;
+
+    public:
+        explicit dabIngressGate ( dabPipelineMetrics &metrics ) : metrics ( metrics )
+        {
+        }
+
+        // the most requests a device may have waiting or running, 0 for no limit
+        void setLimit ( size_t newLimit )
+        {
+            std::lock_guard l1 ( access );
+            limit = newLimit;
+        }
+
+        void setCoalescing ( bool enable )
+        {
+            std::lock_guard l1 ( access );
+            coalescing = enable;
+        }
+
+        // the key identical requests share, or empty if the request can't be coalesced.   device is the dab/<deviceId> prefix of topic
+        std::string coalesceKey ( std::string_view topic, std::string_view device, bool cbor, char const *payload, size_t len )
+        {
+            {
+                std::lock_guard l1 ( access );
+                if ( !coalescing )
+                {
+                    return {};
+                }
+            }
+            auto op = dabOperationRouter::find ( topic.substr ( device.size () ) );
+            if ( std::find ( std::begin ( dabReadOnlyOperations ), std::end ( dabReadOnlyOperations ), op ) == std::end ( dabReadOnlyOperations ) )
+            {
+                return {};
+            }
+            std::string key;
+            key.reserve ( topic.size () + len + 2 );
+            key.append ( topic );
+            key.push_back ( '\0' );
+            key.push_back ( cbor ? 'c' : 'j' );
+            key.append ( payload, len );
+            return key;
+        }
+
+        // called as a request arrives.  w is only used (and so need only be filled in) if the request has a coalescing key
+        admission enter ( std::string_view device, std::string_view key, waiter &&w )
+        {
+            std::lock_guard l1 ( access );
+            if ( !key.empty () )
+            {
+                if ( auto it = pending.find ( key ); it != pending.end () )
+                {
+                    it->second.push_back ( std::move ( w ) );
+                    metrics.countCoalesced ();
+                    return admission::coalesced;
+                }
+            }
+
+            auto it = depths.find ( device );
+            if ( it == depths.end () )
+            {
+                it = depths.emplace ( std::string ( device ), 0 ).first;
+            } else if ( limit && it->second >= limit )
+            {
+                metrics.countShed ();
+                return admission::rejected;
+            }
+            it->second++;
+            metrics.setQueueDepth ( ++queued );
+
+            if ( !key.empty () )
+            {
+                pending.try_emplace ( std::string ( key ) );
+            }
+            return admission::run;
+        }
+
+        // the request with coalescing key has its response.  Returns the requests waiting on it, further identical requests will be run afresh
+        std::vector<waiter> complete ( std::string_view key )
+        {
+            std::vector<waiter> waiters;
+            std::lock_guard l1 ( access );
+            if ( auto it = pending.find ( key ); it != pending.end () )
+            {
+                waiters = std::move ( it->second );
+                pending.erase ( it );
+            }
+            return waiters;
+        }
+
+        // a request admitted with enter () has been handled.   Returns anything still waiting on it if complete () was never called (the request failed)
+        std::vector<waiter> leave ( std::string_view device, std::string_view key )
+        {
+            auto waiters = key.empty () ? std::vector<waiter> () : complete ( key );
+
+            std::lock_guard l1 ( access );
+            if ( auto it = depths.find ( device ); it != depths.end () && !--it->second )
+            {
+                depths.erase ( it );
+            }
+            metrics.setQueueDepth ( --queued );
+            return waiters;
+        }
+
+        // { <deviceId>: <requests waiting or running> } for every device with any
+        jsonElement getQueueDepths ()
+        {
+            jsonElement rsp;
+            rsp.makeObject ();
+            std::lock_guard l1 ( access );
+            for ( auto const &[device, depth] : depths )
+            {
+                // without the dab/ prefix
+                rsp[std::string_view ( device ).substr ( device.starts_with ( "dab/" ) ? 4 : 0 )] = (int64_t) depth;
+            }
+            return rsp;
+        }
+    };
+}
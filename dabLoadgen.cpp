@@ -0,0 +1,373 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+// load generator for a running adapter.   It keeps a fixed number of requests in flight against one or more devices, drawn from a weighted mix of typical DAB
+// requests, issuing the next request on a slot as soon as the previous one is answered, and reports throughput and the latency of each round trip through the broker.
+// requests that aren't answered within five seconds are counted as lost and reissued.
+
+#include <charconv>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MQTTAsync.h"
+#include "dabClient.h"
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    struct request
+    {
+        int weight;
+        char const *operation;
+        char const *payload;
+    };
+
+    // roughly what a test harness sends: mostly status queries with some application control mixed in
+    constexpr request requestMix[] = {
+        { 30, "system/settings/get", "{}" },
+        { 20, "device/info", "{}" },
+        { 20, "applications/list", "{}" },
+        { 10, "operations/list", "{}" },
+        { 10, "applications/launch-with-content", R"({"appId":"YouTube","contentId":"dQw4w9WgXcQ"})" },
+        { 5, "applications/get-state", R"({"appId":"YouTube"})" },
+        { 5, "input/key-press", R"({"keyCode":"KEY_ENTER"})" }
+    };
+
+    constexpr auto REQUEST_TIMEOUT = std::chrono::seconds ( 5 );
+
+    class loadGenerator
+    {
+        // a request in flight.   seq tells a response to the current request from a late one to a request that was given up on
+        struct slot
+        {
+            uint64_t seq = 0;
+            clock::time_point sent;
+            bool busy = false;
+        };
+
+        MQTTAsync client = nullptr;
+        std::string responseTopic;
+        std::vector<std::string> devices;
+
+        std::mutex access;
+        std::vector<slot> slots;
+        std::mt19937 random{ std::random_device{} () };
+        std::discrete_distribution<size_t> pickRequest;
+        std::uniform_int_distribution<size_t> pickDevice;
+        bool stopping = false;
+
+        DAB::dabLatencyHistogram latency;
+        std::atomic<uint64_t> sent = 0;
+        std::atomic<uint64_t> received = 0;
+        std::atomic<uint64_t> errors = 0;
+        std::atomic<uint64_t> lost = 0;
+        std::atomic<uint64_t> failed = 0;
+
+        // waits for a connect or subscribe to be acknowledged
+        struct completion
+        {
+            std::promise<int> result;
+            bool subscribe = false;
+
+            static void onSuccess5 ( void *context, MQTTAsync_successData5 *response )
+            {
+                auto *comp = reinterpret_cast<completion *>(context);
+                int rc = 0;
+                if ( response && response->reasonCode >= MQTTREASONCODE_UNSPECIFIED_ERROR )
+                {
+                    rc = response->reasonCode;
+                } else if ( response && comp->subscribe && response->alt.sub.reasonCodeCount && response->alt.sub.reasonCodes[0] >= MQTTREASONCODE_UNSPECIFIED_ERROR )
+                {
+                    rc = response->alt.sub.reasonCodes[0];
+                }
+                comp->result.set_value ( rc );
+            }
+
+            static void onFailure5 ( void *context, MQTTAsync_failureData5 *response )
+            {
+                int rc = response ? (response->code ? response->code : (int) response->reasonCode) : MQTTASYNC_FAILURE;
+                reinterpret_cast<completion *>(context)->result.set_value ( rc ? rc : MQTTASYNC_FAILURE );
+            }
+
+            void wait ( char const *what )
+            {
+                if ( auto rc = result.get_future ().get () )
+                {
+                    throw DAB::dabException ( rc, what );
+                }
+            }
+        };
+
+        // issues a new request on slotNum.  access must be held
+        void issue ( size_t slotNum )
+        {
+            auto &s = slots[slotNum];
+            auto const &req = requestMix[pickRequest ( random )];
+            auto topic = "dab/" + devices[pickDevice ( random )] + "/" + req.operation;
+            auto correlation = std::to_string ( slotNum ) + ":" + std::to_string ( ++s.seq );
+
+            MQTTAsync_message msg = MQTTAsync_message_initializer;
+            msg.payload = const_cast<char *>(req.payload);
+            msg.payloadlen = (int) strlen ( req.payload );
+            msg.qos = 0;
+
+            MQTTProperty prop;
+            prop.identifier = MQTTPROPERTY_CODE_RESPONSE_TOPIC;
+            prop.value.data.data = responseTopic.data ();
+            prop.value.data.len = (int) responseTopic.size ();
+            MQTTProperties_add ( &msg.properties, &prop );
+
+            prop.identifier = MQTTPROPERTY_CODE_CORRELATION_DATA;
+            prop.value.data.data = correlation.data ();
+            prop.value.data.len = (int) correlation.size ();
+            MQTTProperties_add ( &msg.properties, &prop );
+
+            s.busy = true;
+            s.sent = clock::now ();
+            auto rc = MQTTAsync_sendMessage ( client, topic.c_str (), &msg, nullptr );
+            MQTTProperties_free ( &msg.properties );
+            if ( rc != MQTTASYNC_SUCCESS )
+            {
+                // left busy, it'll be reissued once it times out
+                failed++;
+                return;
+            }
+            sent++;
+        }
+
+        static int messageArrived ( void *context, char *topicName, int, MQTTAsync_message *message )
+        {
+            auto *self = reinterpret_cast<loadGenerator *>(context);
+            auto now = clock::now ();
+
+            if ( auto *corr = MQTTProperties_getProperty ( &message->properties, MQTTPROPERTY_CODE_CORRELATION_DATA ) )
+            {
+                // <slot>:<seq>, anything else isn't a reply to one of ours
+                auto *begin = corr->value.data.data;
+                auto *end = begin + corr->value.data.len;
+                size_t slotNum;
+                uint64_t seq;
+                auto slotEnd = std::from_chars ( begin, end, slotNum );
+                auto valid = slotEnd.ec == std::errc () && slotEnd.ptr != end && *slotEnd.ptr == ':';
+                if ( valid )
+                {
+                    auto seqEnd = std::from_chars ( slotEnd.ptr + 1, end, seq );
+                    valid = seqEnd.ec == std::errc () && seqEnd.ptr == end;
+                }
+                if ( valid )
+                {
+                    auto parsed = DAB::jsonTryParse ( (char const *) message->payload, (size_t) message->payloadlen );
+                    auto isError = !parsed || !parsed->has ( "status" ) || (int64_t) (*parsed)["status"] >= 400;
+
+                    std::lock_guard l1 ( self->access );
+                    if ( slotNum < self->slots.size () && self->slots[slotNum].busy && self->slots[slotNum].seq == seq )
+                    {
+                        self->latency.record ( now - self->slots[slotNum].sent );
+                        self->received++;
+                        self->errors += isError;
+                        self->slots[slotNum].busy = false;
+                        if ( !self->stopping )
+                        {
+                            self->issue ( slotNum );
+                        }
+                    }
+                }
+            }
+            MQTTAsync_freeMessage ( &message );
+            MQTTAsync_free ( topicName );
+            return 1;
+        }
+
+        static void connectionLost ( void *, char *cause )
+        {
+            std::cout << "connection lost" << (cause ? std::string ( ": " ) + cause : "") << std::endl;
+            MQTTAsync_free ( cause );
+        }
+
+    public:
+        loadGenerator ( std::string const &broker, std::vector<std::string> devices, size_t inFlight ) : devices ( std::move ( devices ) ), slots ( inFlight ),
+                                                                                                        pickDevice ( 0, this->devices.size () - 1 )
+        {
+            std::vector<int> weights;
+            for ( auto const &req : requestMix )
+            {
+                weights.push_back ( req.weight );
+            }
+            pickRequest = std::discrete_distribution<size_t> ( weights.begin (), weights.end () );
+
+            auto clientId = "dab_loadgen_" + std::to_string ( std::random_device{} () );
+            responseTopic = "dab/_response/" + clientId;
+
+            MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer5;
+            createOpts.maxBufferedMessages = (int) inFlight * 2;
+            if ( auto rc = MQTTAsync_createWithOptions ( &client, broker.c_str (), clientId.c_str (), MQTTCLIENT_PERSISTENCE_NONE, nullptr, &createOpts ) )
+            {
+                throw DAB::dabException ( rc, "Failed to create client" );
+            }
+            if ( auto rc = MQTTAsync_setCallbacks ( client, this, connectionLost, messageArrived, nullptr ) )
+            {
+                throw DAB::dabException ( rc, "Failed to set callbacks" );
+            }
+        }
+
+        ~loadGenerator ()
+        {
+            MQTTAsync_destroy ( &client );
+        }
+
+        void connect ()
+        {
+            {
+                completion comp;
+                MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer5;
+                opts.keepAliveInterval = 20;
+                opts.maxInflight = (int) slots.size () * 2;
+                opts.onSuccess5 = completion::onSuccess5;
+                opts.onFailure5 = completion::onFailure5;
+                opts.context = &comp;
+                if ( auto rc = MQTTAsync_connect ( client, &opts ) )
+                {
+                    throw DAB::dabException ( rc, "Failed to connect" );
+                }
+                comp.wait ( "Failed to connect" );
+            }
+
+            completion comp;
+            comp.subscribe = true;
+            MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+            opts.onSuccess5 = completion::onSuccess5;
+            opts.onFailure5 = completion::onFailure5;
+            opts.context = &comp;
+            if ( auto rc = MQTTAsync_subscribe ( client, responseTopic.c_str (), 0, &opts ) )
+            {
+                throw DAB::dabException ( rc, "Failed to subscribe" );
+            }
+            comp.wait ( "Failed to subscribe" );
+        }
+
+        void run ( std::chrono::seconds duration )
+        {
+            auto start = clock::now ();
+            {
+                std::lock_guard l1 ( access );
+                for ( size_t loop = 0; loop < slots.size (); loop++ )
+                {
+                    issue ( loop );
+                }
+            }
+
+            uint64_t lastReceived = 0;
+            while ( clock::now () - start < duration )
+            {
+                std::this_thread::sleep_for ( std::chrono::seconds ( 1 ) );
+
+                auto now = clock::now ();
+                {
+                    std::lock_guard l1 ( access );
+                    for ( size_t loop = 0; loop < slots.size (); loop++ )
+                    {
+                        if ( slots[loop].busy && now - slots[loop].sent >= REQUEST_TIMEOUT )
+                        {
+                            lost++;
+                            issue ( loop );
+                        }
+                    }
+                }
+
+                auto total = received.load ();
+                std::cout << std::chrono::duration_cast<std::chrono::seconds> ( now - start ).count () << "s: " << total - lastReceived << " msgs/s" << std::endl;
+                lastReceived = total;
+            }
+            auto elapsed = clock::now () - start;
+
+            // stop issuing and give what's outstanding a chance to come back
+            {
+                std::lock_guard l1 ( access );
+                stopping = true;
+            }
+            auto drainUntil = clock::now () + REQUEST_TIMEOUT;
+            while ( clock::now () < drainUntil )
+            {
+                {
+                    std::lock_guard l1 ( access );
+                    if ( std::none_of ( slots.begin (), slots.end (), [] ( slot const &s ) { return s.busy; } ) )
+                    {
+                        break;
+                    }
+                }
+                std::this_thread::sleep_for ( std::chrono::milliseconds ( 10 ) );
+            }
+
+            auto stats = latency.snapshot ();
+            auto seconds = std::chrono::duration<double> ( elapsed ).count ();
+            std::cout << "sent " << sent << " received " << received << " errors " << errors << " lost " << lost << " send failures " << failed << std::endl;
+            std::cout << "throughput " << (double) received / seconds << " msgs/s" << std::endl;
+            std::cout << "latency (us) p50 " << (double) stats["p50"] << " p99 " << (double) stats["p99"] << " p999 " << (double) stats["p999"] << " max "
+                      << (double) stats["max"] << std::endl;
+        }
+    };
+
+    std::vector<std::string> splitDevices ( std::string const &list )
+    {
+        std::vector<std::string> devices;
+        size_t start = 0;
+        while ( start <= list.size () )
+        {
+            auto end = std::min ( list.find ( ',', start ), list.size () );
+            if ( end > start )
+            {
+                devices.push_back ( list.substr ( start, end - start ) );
+            }
+            start = end + 1;
+        }
+        return devices;
+    }
+}
+
+int main ( int argc, char *argv[] )
+{
+    if ( argc < 3 || argc > 5 )
+    {
+        std::cout << "usage dab_loadgen <mqtt broker> <deviceId>[,<deviceId>...] [seconds (10)] [requests in flight (64)]" << std::endl;
+        return 0;
+    }
+
+    try
+    {
+        auto devices = splitDevices ( argv[2] );
+        if ( devices.empty () )
+        {
+            std::cout << "no deviceIds given" << std::endl;
+            return 1;
+        }
+        auto seconds = argc > 3 ? std::stoi ( argv[3] ) : 10;
+        auto inFlight = argc > 4 ? std::stoul ( argv[4] ) : 64;
+
+        loadGenerator gen ( argv[1], std::move ( devices ), std::max<size_t> ( inFlight, 1 ) );
+        gen.connect ();
+        gen.run ( std::chrono::seconds ( seconds ) );
+    } catch ( DAB::dabException &e )
+    {
+        std::cout << "error: " << e.errorCode << " " << e.errorText << std::endl;
+        return 1;
+    }
+    return 0;
+}
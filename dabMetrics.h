@@ -0,0 +1,357 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "Json.h"
+
+// request pipeline instrumentation.
+// a dabBridge keeps latency histograms for the stages every request passes through (parse, route, serialize and publish) and each client keeps request and error
+// counts and a latency histogram per operation for the time spent in its handlers.   Everything is recorded with relaxed atomics, so recording never takes a lock
+// and snapshots may be taken from any thread while requests are running.   Instrumentation is off until enabled, when off it costs a single flag test per stage.
+
+namespace DAB
+{
+    // a latency histogram in the style of HdrHistogram.  Values are bucketed by their power of two, each power of two split into SUB_BUCKETS linear steps,
+    // so any recorded value is known to within 1/SUB_BUCKETS of itself whatever its magnitude.   Values are in nanoseconds, anything beyond the last bucket lands in it
+    class dabLatencyHistogram
+    {
+    public:
+        static constexpr size_t SUB_BITS = 3;
+        static constexpr size_t SUB_BUCKETS = 1 << SUB_BITS;
+        static constexpr size_t OCTAVES = 40;                                  // 8 * 2^40 ns, a little over 2 hours
+        static constexpr size_t BUCKETS = (OCTAVES + 1) * SUB_BUCKETS;
+
+    private:
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+        std::atomic<uint64_t> count = 0;
+        std::atomic<uint64_t> total = 0;
+        std::atomic<uint64_t> maxValue = 0;
+
+        static constexpr size_t bucketOf ( uint64_t value )
+        {
+            if ( value < SUB_BUCKETS )
+            {
+                return (size_t) value;
+            }
+            // the leading bit picks the octave, the SUB_BITS following it the step within the octave
+            auto shift = (size_t) std::bit_width ( value ) - 1 - SUB_BITS;
+            auto bucket = (shift + 1) * SUB_BUCKETS + (size_t) ((value >> shift) & (SUB_BUCKETS - 1));
+            return std::min ( bucket, BUCKETS - 1 );
+        }
+
+        // the smallest value that lands in bucket, and the width of the bucket
+        static constexpr uint64_t bucketStart ( size_t bucket )
+        {
+            auto octave = bucket / SUB_BUCKETS;
+            auto step = bucket % SUB_BUCKETS;
+            return octave ? (uint64_t) (SUB_BUCKETS + step) << (octave - 1) : step;
+        }
+
+        static constexpr uint64_t bucketWidth ( size_t bucket )
+        {
+            auto octave = bucket / SUB_BUCKETS;
+            return octave ? (uint64_t) 1 << (octave - 1) : 1;
+        }
+
+    public:
+        void record ( std::chrono::nanoseconds duration )
+        {
+            auto value = (uint64_t) std::max<int64_t> ( duration.count (), 0 );
+            buckets[bucketOf ( value )].fetch_add ( 1, std::memory_order_relaxed );
+            count.fetch_add ( 1, std::memory_order_relaxed );
+            total.fetch_add ( value, std::memory_order_relaxed );
+
+            auto current = maxValue.load ( std::memory_order_relaxed );
+            while ( value > current && !maxValue.compare_exchange_weak ( current, value, std::memory_order_relaxed ) )
+            {
+            }
+        }
+
+        // { count, mean, p50, p90, p99, p999, max }, the times in microseconds.   Percentiles are the middle of the bucket they fall in
+        jsonElement snapshot () const
+        {
+            std::array<uint64_t, BUCKETS> counts;
+            uint64_t n = 0;
+            for ( size_t loop = 0; loop < BUCKETS; loop++ )
+            {
+                counts[loop] = buckets[loop].load ( std::memory_order_relaxed );
+                n += counts[loop];
+            }
+            auto maxNs = maxValue.load ( std::memory_order_relaxed );
+
+            auto percentile = [&] ( uint64_t perTenThousand ) {
+                auto rank = std::max<uint64_t> ( (n * perTenThousand + 9999) / 10000, 1 );
+                uint64_t seen = 0;
+                for ( size_t loop = 0; loop < BUCKETS; loop++ )
+                {
+                    seen += counts[loop];
+                    if ( seen >= rank )
+                    {
+                        return (double) std::min ( bucketStart ( loop ) + bucketWidth ( loop ) / 2, maxNs ) / 1000.0;
+                    }
+                }
+                return (double) maxNs / 1000.0;
+            };
+
+            jsonElement rsp;
+            rsp["count"] = (int64_t) n;
+            rsp["mean"] = n ? (double) total.load ( std::memory_order_relaxed ) / (double) n / 1000.0 : 0.0;
+            rsp["p50"] = n ? percentile ( 5000 ) : 0.0;
+            rsp["p90"] = n ? percentile ( 9000 ) : 0.0;
+            rsp["p99"] = n ? percentile ( 9900 ) : 0.0;
+            rsp["p999"] = n ? percentile ( 9990 ) : 0.0;
+            rsp["max"] = (double) maxNs / 1000.0;
+            return rsp;
+        }
+    };
+
+    // the stages of the request pipeline timed by dabPipelineMetrics
+    enum class dabMetricStage : uint8_t
+    {
+        parse,          // parsing the request
+        route,          // finding the device the request is for
+        serialize,      // serializing the response
+        publish,        // handing the response to the mqtt library
+        count
+    };
+
+    // request pipeline metrics, shared by every device of a bridge
+    class dabPipelineMetrics
+    {
+        static constexpr std::string_view stageNames[(size_t) dabMetricStage::count] = { "parse", "route", "serialize", "publish" };
+
+        std::atomic<bool> enabled = false;
+        std::array<dabLatencyHistogram, (size_t) dabMetricStage::count> stages;
+
+        std::atomic<uint64_t> requests = 0;
+        std::atomic<uint64_t> cacheHits = 0;
+        std::atomic<uint64_t> parseFailures = 0;
+
+        // requests waiting for or running on a worker (a gauge, so it's kept whether or not we're enabled), and those turned away or answered with another's response
+        std::atomic<int64_t> queueDepth = 0;
+        std::atomic<int64_t> maxQueueDepth = 0;
+        std::atomic<uint64_t> shed = 0;
+        std::atomic<uint64_t> coalesced = 0;
+
+    public:
+        using clock = std::chrono::steady_clock;
+
+        // times a stage from construction until stop () or destruction, whichever comes first.  Does nothing if metrics aren't enabled
+        class timer
+        {
+            dabPipelineMetrics *metrics;
+            dabMetricStage stage;
+            clock::time_point start;
+
+        public:
+            timer ( dabPipelineMetrics &metrics, dabMetricStage stage ) : metrics ( metrics.isEnabled () ? &metrics : nullptr ), stage ( stage )
+            {
+                if ( this->metrics )
+                {
+                    start = clock::now ();
+                }
+            }
+
+            timer ( timer const & ) = delete;
+            timer &operator = ( timer const & ) = delete;
+
+            void stop ()
+            {
+                if ( metrics )
+                {
+                    metrics->record ( stage, clock::now () - start );
+                    metrics = nullptr;
+                }
+            }
+
+            ~timer ()
+            {
+                stop ();
+            }
+        };
+
+        bool isEnabled () const
+        {
+            return enabled.load ( std::memory_order_relaxed );
+        }
+
+        void setEnabled ( bool enable )
+        {
+            enabled.store ( enable, std::memory_order_relaxed );
+        }
+
+        void record ( dabMetricStage stage, std::chrono::nanoseconds duration )
+        {
+            stages[(size_t) stage].record ( duration );
+        }
+
+        // a request arrived.  cached is set if it was answered from the response cache
+        void countRequest ( bool cached )
+        {
+            if ( isEnabled () )
+            {
+                requests.fetch_add ( 1, std::memory_order_relaxed );
+                if ( cached )
+                {
+                    cacheHits.fetch_add ( 1, std::memory_order_relaxed );
+                }
+            }
+        }
+
+        void countParseFailure ()
+        {
+            if ( isEnabled () )
+            {
+                parseFailures.fetch_add ( 1, std::memory_order_relaxed );
+            }
+        }
+
+        void setQueueDepth ( int64_t depth )
+        {
+            queueDepth.store ( depth, std::memory_order_relaxed );
+            auto current = maxQueueDepth.load ( std::memory_order_relaxed );
+            while ( depth > current && !maxQueueDepth.compare_exchange_weak ( current, depth, std::memory_order_relaxed ) )
+            {
+            }
+        }
+
+        // a request was refused as its device's queue was full
+        void countShed ()
+        {
+            if ( isEnabled () )
+            {
+                shed.fetch_add ( 1, std::memory_order_relaxed );
+            }
+        }
+
+        // a request joined an identical one already queued instead of being run itself
+        void countCoalesced ()
+        {
+            if ( isEnabled () )
+            {
+                coalesced.fetch_add ( 1, std::memory_order_relaxed );
+            }
+        }
+
+        jsonElement snapshot () const
+        {
+            jsonElement rsp;
+            rsp["requests"] = (int64_t) requests.load ( std::memory_order_relaxed );
+            rsp["cacheHits"] = (int64_t) cacheHits.load ( std::memory_order_relaxed );
+            rsp["parseFailures"] = (int64_t) parseFailures.load ( std::memory_order_relaxed );
+            rsp["queueDepth"] = queueDepth.load ( std::memory_order_relaxed );
+            rsp["maxQueueDepth"] = maxQueueDepth.load ( std::memory_order_relaxed );
+            rsp["shed"] = (int64_t) shed.load ( std::memory_order_relaxed );
+            rsp["coalesced"] = (int64_t) coalesced.load ( std::memory_order_relaxed );
+            for ( size_t loop = 0; loop < stages.size (); loop++ )
+            {
+                rsp["stages"][stageNames[loop]] = stages[loop].snapshot ();
+            }
+            return rsp;
+        }
+    };
+
+    // a single device's metrics.  Handler histograms are only allocated for the operations the device is actually sent
+    class dabDeviceMetrics
+    {
+        std::atomic<bool> enabled = false;
+
+        std::atomic<uint64_t> requests = 0;
+        std::atomic<uint64_t> errors = 0;
+
+        std::string_view const *opNames;
+        std::vector<std::atomic<dabLatencyHistogram *>> handlers;
+
+    public:
+        using clock = std::chrono::steady_clock;
+
+        // names holds the name of each of the count operations, it must outlive us
+        dabDeviceMetrics ( size_t count, std::string_view const *names ) : opNames ( names ), handlers ( count )
+        {
+        }
+
+        dabDeviceMetrics ( dabDeviceMetrics const & ) = delete;
+        dabDeviceMetrics &operator = ( dabDeviceMetrics const & ) = delete;
+
+        ~dabDeviceMetrics ()
+        {
+            for ( auto &handler : handlers )
+            {
+                delete handler.load ();
+            }
+        }
+
+        bool isEnabled () const
+        {
+            return enabled.load ( std::memory_order_relaxed );
+        }
+
+        void setEnabled ( bool enable )
+        {
+            enabled.store ( enable, std::memory_order_relaxed );
+        }
+
+        // the handler for op took duration and returned status
+        void record ( size_t op, std::chrono::nanoseconds duration, int64_t status )
+        {
+            requests.fetch_add ( 1, std::memory_order_relaxed );
+            if ( status >= 400 )
+            {
+                errors.fetch_add ( 1, std::memory_order_relaxed );
+            }
+
+            auto *histogram = handlers[op].load ( std::memory_order_acquire );
+            if ( !histogram )
+            {
+                // first use, if some other thread beats us to it we use theirs
+                auto fresh = std::make_unique<dabLatencyHistogram> ();
+                if ( handlers[op].compare_exchange_strong ( histogram, fresh.get (), std::memory_order_acq_rel ) )
+                {
+                    histogram = fresh.release ();
+                }
+            }
+            histogram->record ( duration );
+        }
+
+        // { requests, errors, handlers: { <operation>: histogram } } with only the operations that have been called
+        jsonElement snapshot () const
+        {
+            jsonElement rsp;
+            rsp["requests"] = (int64_t) requests.load ( std::memory_order_relaxed );
+            rsp["errors"] = (int64_t) errors.load ( std::memory_order_relaxed );
+            auto &handlerTimes = rsp["handlers"];
+            handlerTimes.makeObject ();
+            for ( size_t loop = 0; loop < handlers.size (); loop++ )
+            {
+                if ( auto *histogram = handlers[loop].load ( std::memory_order_acquire ) )
+                {
+                    // without the leading /
+                    handlerTimes[opNames[loop].substr ( opNames[loop].starts_with ( '/' ) ? 1 : 0 )] = histogram->snapshot ();
+                }
+            }
+            return rsp;
+        }
+    };
+}
@@ -0,0 +1,932 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <exception>
+#include <condition_variable>
+#include <mutex>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <string_view>
+#include <algorithm>
+
+#include "dabBridge.h"
+#include "dabIngress.h"
+#include "dabReconnect.h"
+#include "dabTopicAlias.h"
+#include "dabTopicQos.h"
+#include "dabWorkerPool.h"
+#include "MQTTAsync.h"
+#include "MQTTExportDeclarations.h"
+#include "MQTTProperties.h"
+#include "MQTTReasonCodes.h"
+#include "MQTTSubscribeOpts.h"
+#include "MQTTClientPersistence.h"
+
+
+// this is the asynchronous variant of dabMQTTInterface, built on paho-mqtt's MQTTAsync api.
+// publishes are handed to the library and complete in the background, so many can be in flight at once and neither request handlers nor telemetry ever block on the broker.
+// it is a drop in replacement for dabMQTTInterface, taking the same dabBridge and broker address and supporting the same connect/disconnect/wait calls.
+
+namespace DAB
+{
+    template< typename BRIDGE >
+    class dabMQTTAsyncInterface
+    {
+        // topics are subscribed to in batches of this many per subscribe request
+        constexpr static size_t SUBSCRIBE_BATCH = 256;
+
+        MQTTAsync client{};
+
+        BRIDGE &bridge;
+
+        std::condition_variable running;
+        std::mutex runningMutex;
+
+        // subscribe to dab/<deviceId>/# rather than each individual operation
+        bool wildcardSubscriptions = false;
+
+        // notifications (telemetry in particular) publish the same shape on a topic over and over, so their structure is serialized once per topic
+        jsonTemplateCache publishTemplates;
+
+        // publish notifications as CBOR rather than json
+        bool cborNotifications = false;
+
+        // aliases for the topics we publish on repeatedly.   sendAccess keeps an alias lookup and its publish together, so that the publish telling the broker
+        // an alias always reaches the library before any that rely on it
+        dabTopicAliases topicAliases;
+        std::mutex sendAccess;
+
+        // the qos responses and notifications are published with
+        dabTopicQos topicQos;
+
+        // maximum number of qos > 0 publishes the library will allow to be outstanding
+        int maxInflight = 65535;
+
+        // streamed responses, see dabMQTTInterface::setResponseStreaming.   The library copies everything we send, so to bound memory no more than STREAM_WINDOW
+        // chunks are handed to it before it reports them as written.   A stream whose chunks aren't reported within STREAM_TIMEOUT is abandoned
+        constexpr static size_t STREAM_WINDOW = 4;
+        constexpr static auto STREAM_TIMEOUT = std::chrono::seconds ( 30 );
+        dabStreamEncoding streamEncoding = dabStreamEncoding::none;
+        size_t streamChunkSize = 48 * 1024;
+
+        std::mutex streamAccess;
+        std::condition_variable streamCondition;
+        size_t inflightChunks = 0;
+
+        struct streamChunk
+        {
+            int64_t seq;
+            bool last;
+            bool failed;
+        };
+
+        // used by connect, subscribe and disconnect to wait for the library to call us back with the result
+        struct completion
+        {
+            std::mutex access;
+            std::condition_variable condition;
+            bool done = false;
+            int rc = MQTTASYNC_SUCCESS;
+            std::string errorText;
+            // from a connect's connack, 0 if the broker doesn't accept topic aliases
+            int topicAliasMaximum = 0;
+            // also from the connack, the broker resumed an earlier session
+            bool sessionPresent = false;
+
+            static void onSuccess5 ( void *context, MQTTAsync_successData5 *response )
+            {
+                auto *comp = reinterpret_cast<completion *>(context);
+                int rc = MQTTASYNC_SUCCESS;
+                if ( response )
+                {
+                    comp->topicAliasMaximum = std::max ( MQTTProperties_getNumericValue ( &response->properties, MQTTPROPERTY_CODE_TOPIC_ALIAS_MAXIMUM ), 0 );
+
+                    // subscribe's report a reason code per topic, anything >= 0x80 is a refusal
+                    if ( response->alt.sub.reasonCodeCount && response->alt.sub.reasonCodes )
+                    {
+                        for ( int loop = 0; loop < response->alt.sub.reasonCodeCount; loop++ )
+                        {
+                            if ( response->alt.sub.reasonCodes[loop] >= MQTTREASONCODE_UNSPECIFIED_ERROR )
+                            {
+                                rc = response->alt.sub.reasonCodes[loop];
+                            }
+                        }
+                    } else if ( response->reasonCode >= MQTTREASONCODE_UNSPECIFIED_ERROR )
+                    {
+                        rc = response->reasonCode;
+                    }
+                }
+                comp->complete ( rc, rc ? "refused by broker" : "" );
+            }
+
+            // a connect's success.   The response's alt is the connack's, not a subscribe's reason codes
+            static void onConnected5 ( void *context, MQTTAsync_successData5 *response )
+            {
+                auto *comp = reinterpret_cast<completion *>(context);
+                if ( response )
+                {
+                    comp->topicAliasMaximum = std::max ( MQTTProperties_getNumericValue ( &response->properties, MQTTPROPERTY_CODE_TOPIC_ALIAS_MAXIMUM ), 0 );
+                    comp->sessionPresent = response->alt.connect.sessionPresent != 0;
+                }
+                comp->complete ( MQTTASYNC_SUCCESS, "" );
+            }
+
+            static void onFailure5 ( void *context, MQTTAsync_failureData5 *response )
+            {
+                auto *comp = reinterpret_cast<completion *>(context);
+                int rc = response ? (response->code ? response->code : (int) response->reasonCode) : 0;
+                comp->complete ( rc ? rc : MQTTASYNC_FAILURE, response && response->message ? response->message : "" );
+            }
+
+            void complete ( int code, std::string text )
+            {
+                std::lock_guard l1 ( access );
+                rc = code;
+                errorText = std::move ( text );
+                done = true;
+                condition.notify_all ();
+            }
+
+            // waits for the callback, throwing a dabException built from what if the operation failed
+            void wait ( std::string const &what )
+            {
+                std::unique_lock l1 ( access );
+                condition.wait ( l1, [this] { return done; } );
+                if ( rc != MQTTASYNC_SUCCESS )
+                {
+                    throw DAB::dabException ( rc, what + (errorText.empty () ? "" : ": " + errorText) );
+                }
+            }
+
+            MQTTAsync_responseOptions responseOptions ()
+            {
+                MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+                opts.onSuccess5 = onSuccess5;
+                opts.onFailure5 = onFailure5;
+                opts.context = this;
+                return opts;
+            }
+        };
+
+        // the response topic in the request's properties.  The view is into the message
+        static std::string_view getResponseTopic ( MQTTAsync_message *message )
+        {
+            if ( auto *property = MQTTProperties_getProperty ( &message->properties, MQTTPROPERTY_CODE_RESPONSE_TOPIC ) )
+            {
+                return { property->value.data.data, (size_t) property->value.data.len };
+            }
+            return {};
+        }
+
+        // the calling thread's buffer for serializing responses (or notifications, a handler may publish one while its response is being built).   The library
+        // copies what we send, so the buffer is reused for the next message and once it has grown to fit, serializing allocates nothing
+        static std::string &scratchBuffer ( bool notification )
+        {
+            thread_local std::string buffers[2];
+            auto &buff = buffers[notification];
+            buff.clear ();
+            return buff;
+        }
+
+        // requests (and our responses to them) with this content type are CBOR rather than json
+        constexpr static std::string_view CBOR_CONTENT_TYPE = "application/cbor";
+
+        static bool isCbor ( MQTTAsync_message *message )
+        {
+            auto *property = MQTTProperties_getProperty ( &message->properties, MQTTPROPERTY_CODE_CONTENT_TYPE );
+            return property && std::string_view ( property->value.data.data, (size_t) property->value.data.len ) == CBOR_CONTENT_TYPE;
+        }
+
+        static bool hasCorrelationData ( MQTTAsync_message *message )
+        {
+            return  MQTTProperties_hasProperty ( &message->properties, MQTTPROPERTY_CODE_CORRELATION_DATA );
+        }
+
+        static auto *getCorrelationData ( MQTTAsync_message *message )
+        {
+            return MQTTProperties_getProperty ( &message->properties, MQTTPROPERTY_CODE_CORRELATION_DATA );
+        }
+
+        struct messageDeleter
+        {
+            void operator () ( MQTTAsync_message *message ) const
+            {
+                MQTTAsync_freeMessage ( &message );
+            }
+        };
+
+        // message arrived callback, called on the library's receive thread
+        static int messageArrived ( void *context, char *topic, int topicLen, MQTTAsync_message *message )
+        {
+            auto *mqttInterface = reinterpret_cast<dabMQTTAsyncInterface *>(context);
+
+            // topicLen is only set if the topic has embedded NUL's, otherwise it's NUL-terminated
+            std::string topicStr = topicLen ? std::string ( topic, (size_t) topicLen ) : std::string ( topic );
+            MQTTAsync_free ( topic );
+
+            std::unique_ptr<MQTTAsync_message, messageDeleter> msg ( message );
+
+            if ( mqttInterface->wildcardSubscriptions && !mqttInterface->bridge.isRequestTopic ( topicStr ) )
+            {
+                // not a request, drop it without responding
+                return 1;
+            }
+
+            if ( mqttInterface->pool && mqttInterface->pool->size () )
+            {
+                // requests are serialized per device, keyed by the dab/<deviceId> portion of the topic
+                std::string_view key ( topicStr );
+                key = key.substr ( 0, key.find ( '/', 4 ) );
+
+                // the device's queue may be full, or an identical read only request already queued.   Streamed responses go out in chunks as they're produced,
+                // so there's no one response to share
+                auto &ingress = mqttInterface->ingress;
+                auto cbor = isCbor ( message );
+                auto coalesceKey = mqttInterface->streamEncoding == dabStreamEncoding::none ? ingress.coalesceKey ( topicStr, key, cbor, (char const *) message->payload, (size_t) message->payloadlen ) : std::string ();
+                switch ( ingress.enter ( key, coalesceKey, coalesceKey.empty () ? dabIngressGate::waiter () : makeWaiter ( message ) ) )
+                {
+                    case dabIngressGate::admission::run:
+                        break;
+                    case dabIngressGate::admission::rejected:
+                        mqttInterface->sendError ( makeWaiter ( message ), cbor, 503, "device busy" );
+                        return 1;
+                    case dabIngressGate::admission::coalesced:
+                        return 1;
+                }
+
+                auto job = [mqttInterface, topicStr, coalesceKey = std::move ( coalesceKey ), cbor, msg = std::move ( msg )] ()
+                {
+                    mqttInterface->handleMessage ( topicStr.c_str (), msg.get (), coalesceKey );
+
+                    // anyone still waiting on us didn't get a response, the request must have failed
+                    std::string_view key ( topicStr );
+                    for ( auto &w : mqttInterface->ingress.leave ( key.substr ( 0, key.find ( '/', 4 ) ), coalesceKey ) )
+                    {
+                        mqttInterface->sendError ( std::move ( w ), cbor, 500, "request failed" );
+                    }
+                };
+                mqttInterface->pool->submit ( key, std::move ( job ) );
+                return 1;
+            }
+
+            mqttInterface->handleMessage ( topicStr.c_str (), msg.get () );
+            return 1;
+        }
+
+        // request execution pool.  nullptr (or a pool with no workers) handles requests on the library's receive thread
+        size_t numWorkers = 0;
+        std::unique_ptr<dabWorkerPool> pool;
+
+        // admission to the pool, with per device queue limits and coalescing of identical read only requests
+        dabIngressGate ingress;
+
+        // reconnecting and session expiry, see dabMQTTInterface::setReconnect and setSessionExpiry
+        dabReconnector reconnector;
+        std::chrono::seconds sessionExpiry{ 0 };
+
+        // where the response to message goes
+        static dabIngressGate::waiter makeWaiter ( MQTTAsync_message *message )
+        {
+            dabIngressGate::waiter w;
+            w.topic.assign ( getResponseTopic ( message ) );
+            if ( hasCorrelationData ( message ) )
+            {
+                auto corr_data_req_prop = getCorrelationData ( message );
+                w.correlationData.assign ( corr_data_req_prop->value.data.data, corr_data_req_prop->value.data.len );
+                w.hasCorrelationData = true;
+            }
+            return w;
+        }
+
+        // answers a request without handling it.   Called from the library's callback (and so mustn't throw), a failure to send is only logged
+        void sendError ( dabIngressGate::waiter &&w, bool cbor, int64_t status, char const *text ) noexcept
+        {
+            try
+            {
+                std::string payload;
+                jsonElement rsp{ { "status", status }, { "error", text } };
+                if ( cbor )
+                {
+                    rsp.serializeCBOR ( payload );
+                } else
+                {
+                    rsp.serialize ( payload, true );
+                }
+                send ( w.topic, payload, topicQos.lookup ( w.topic, false ), cbor, w.hasCorrelationData ? std::optional<std::string_view> ( w.correlationData ) : std::nullopt );
+            } catch ( DAB::dabException &e )
+            {
+                std::cout << "error (" << e.errorCode << "): " << e.errorText << std::endl;
+            } catch ( ... )
+            {
+            }
+        }
+
+        // initial size of the per-thread request arena, 0 if arena's are not being used
+        size_t arenaSize = 0;
+
+        // returns the calling thread's request arena or nullptr if they're not enabled
+        jsonArena *getArena ()
+        {
+            if ( !arenaSize )
+            {
+                return nullptr;
+            }
+            thread_local std::unique_ptr<jsonArena> arena;
+            if ( !arena )
+            {
+                arena = std::make_unique<jsonArena> ( arenaSize );
+            }
+            return arena.get ();
+        }
+
+        // parse, dispatch and respond to a single request.   coalesceKey is the request's key in ingress if identical requests may be waiting on its response
+        void handleMessage ( char const *topic, MQTTAsync_message *message, std::string_view coalesceKey = {} )
+        {
+            auto *arena = getArena ();
+            {
+                std::optional<jsonArena::scope> arenaScope;
+                if ( arena )
+                {
+                    arenaScope.emplace ( *arena );
+                }
+                processMessage ( topic, message, coalesceKey );
+            }
+            if ( arena )
+            {
+                arena->reset ();
+            }
+        }
+
+        void processMessage ( char const *topic, MQTTAsync_message *message, std::string_view coalesceKey )
+        {
+            try
+            {
+                auto &payload = scratchBuffer ( false );
+                std::optional<dabStream> stream;
+
+                std::optional<std::string_view> correlationData;
+                if ( hasCorrelationData ( message ) )
+                {
+                    auto corr_data_req_prop = getCorrelationData ( message );
+                    correlationData = std::string_view ( corr_data_req_prop->value.data.data, corr_data_req_prop->value.data.len );
+                }
+                auto responseTopic = getResponseTopic ( message );
+                auto qos = topicQos.lookup ( responseTopic, false );
+                auto cbor = isCbor ( message );
+
+                // every device answers a discovery.   Their responses are kept by the bridge and sent back to back without waiting on any of them
+                if ( !strcmp ( topic, "dab/discovery" ) )
+                {
+                    auto responses = bridge.getDiscoveryResponses ();
+                    for ( auto const &response : cbor ? responses->cbor : responses->json )
+                    {
+                        send ( responseTopic, response, qos, cbor, correlationData );
+                    }
+                    return;
+                }
+
+                // responses are in the request's format, json or CBOR
+                auto serialize = [cbor, &payload] ( jsonElement const &rsp ) {
+                    if ( cbor )
+                    {
+                        rsp.serializeCBOR ( payload );
+                    } else
+                    {
+                        rsp.serialize ( payload, true );
+                    }
+                };
+
+                // a cached response is already serialized, so it's sent as is without parsing the request or dispatching it.   They're kept as json, CBOR requests are always dispatched
+                auto &metrics = bridge.getMetrics ();
+                auto cached = !cbor && bridge.getCachedResponse ( topic, payload );
+                metrics.countRequest ( cached );
+                if ( !cached )
+                {
+                    dabPipelineMetrics::timer parseTimer ( metrics, dabMetricStage::parse );
+                    auto parsed = cbor ? cborTryParse ( (char const *) message->payload, (size_t) message->payloadlen ) : jsonTryParse ( (char const *) message->payload, (size_t) message->payloadlen );
+                    parseTimer.stop ();
+                    if ( !parsed )
+                    {
+                        metrics.countParseFailure ();
+                        serialize ( { { "status", 400 }, { "error", "unable to parse request" } } );
+                    } else
+                    {
+                        jsonElement req;
+
+                        req["payload"] = std::move ( *parsed );
+                        req["topic"] = topic;
+
+                        // BRIDGE is the bridge's actual type, so naming it calls its dispatch directly rather than through the vtable
+                        jsonElement rsp = streamEncoding != dabStreamEncoding::none ? bridge.BRIDGE::dispatch ( req, stream ) : bridge.BRIDGE::dispatch ( req );
+                        if ( stream )
+                        {
+                            rsp["stream"]["encoding"] = streamEncoding == dabStreamEncoding::base64 ? "base64" : "raw";
+                            rsp["stream"]["chunkSize"] = (int64_t) streamChunkSize;
+                        }
+
+                        dabPipelineMetrics::timer serializeTimer ( metrics, dabMetricStage::serialize );
+                        serialize ( rsp );
+                    }
+                }
+
+                send ( responseTopic, payload, qos, cbor, correlationData );
+                if ( !coalesceKey.empty () )
+                {
+                    // identical requests that arrived while we were queued or running get the same response
+                    for ( auto &w : ingress.complete ( coalesceKey ) )
+                    {
+                        send ( w.topic, payload, topicQos.lookup ( w.topic, false ), cbor, w.hasCorrelationData ? std::optional<std::string_view> ( w.correlationData ) : std::nullopt );
+                    }
+                }
+                if ( stream )
+                {
+                    sendStream ( responseTopic, qos, correlationData, *stream );
+                }
+            } catch ( DAB::dabException &e )
+            {
+                std::cout << "error (" << e.errorCode << "): " << e.errorText << std::endl;
+            } catch ( ... )
+            {
+            }
+        }
+
+        // called by the library if a publish could not be delivered
+        static void onPublishFailure5 ( void *, MQTTAsync_failureData5 *response )
+        {
+            std::cout << "error (" << (response ? response->code : MQTTASYNC_FAILURE) << "): error publishing message" << std::endl;
+        }
+
+        // called by the library once a stream chunk has been written (or couldn't be), making room in the window for another
+        static void onChunkSent5 ( void *context, MQTTAsync_successData5 * )
+        {
+            auto *mqttInterface = reinterpret_cast<dabMQTTAsyncInterface *>(context);
+            {
+                std::lock_guard l1 ( mqttInterface->streamAccess );
+                mqttInterface->inflightChunks--;
+            }
+            mqttInterface->streamCondition.notify_all ();
+        }
+
+        static void onChunkFailed5 ( void *context, MQTTAsync_failureData5 *response )
+        {
+            onPublishFailure5 ( context, response );
+            onChunkSent5 ( context, nullptr );
+        }
+
+        // sends the data of a streamed response whose header has just been sent.   Chunks are numbered from 0 in the dab-stream-seq user property, the last (which may be empty)
+        // has dab-stream-end set, and dab-stream-error too if the data couldn't be read or the library stopped reporting chunks as written
+        void sendStream ( std::string_view topic, int qos, std::optional<std::string_view> correlationData, dabStream &stream )
+        {
+            std::string buff ( streamChunkSize, '\0' );
+            std::string payload;
+            streamChunk chunk{ 0, false, false };
+            for ( ; !chunk.last; chunk.seq++ )
+            {
+                {
+                    std::unique_lock l1 ( streamAccess );
+                    if ( !streamCondition.wait_for ( l1, STREAM_TIMEOUT, [this] { return inflightChunks < STREAM_WINDOW; } ) )
+                    {
+                        chunk.failed = true;
+                    }
+                }
+
+                size_t len = 0;
+                if ( !chunk.failed )
+                {
+                    try
+                    {
+                        len = stream.read ( buff.data (), buff.size () );
+                    } catch ( ... )
+                    {
+                        chunk.failed = true;
+                    }
+                }
+                chunk.last = chunk.failed || len < buff.size ();
+
+                payload.clear ();
+                if ( streamEncoding == dabStreamEncoding::base64 )
+                {
+                    base64Encode ( buff.data (), len, payload );
+                } else
+                {
+                    payload.append ( buff.data (), len );
+                }
+                send ( topic, payload, qos, false, correlationData, &chunk );
+            }
+        }
+
+        // hands the message to the library and returns.  The payload and properties are copied by the library, so they need only live for the duration of the call.
+        // cbor sends it with the CBOR content type
+        void send ( std::string_view topic, std::string const &payload, int qos, bool cbor, std::optional<std::string_view> correlationData = {}, streamChunk const *chunk = nullptr )
+        {
+            MQTTAsync_message clientMessage = MQTTAsync_message_initializer;
+
+            clientMessage.payload = const_cast<char *>(payload.c_str ());
+            clientMessage.payloadlen = (int) payload.size ();
+            clientMessage.qos = qos;
+            clientMessage.retained = 0;
+
+            if ( correlationData )
+            {
+                MQTTProperty corr_data_resp_prop;
+                corr_data_resp_prop.identifier = MQTTPROPERTY_CODE_CORRELATION_DATA;
+                corr_data_resp_prop.value.data.data = const_cast<char *>(correlationData->data ());
+                corr_data_resp_prop.value.data.len = (int) correlationData->size ();
+
+                MQTTProperties_add ( &clientMessage.properties, &corr_data_resp_prop );
+            }
+
+            if ( cbor )
+            {
+                MQTTProperty contentTypeProp;
+                contentTypeProp.identifier = MQTTPROPERTY_CODE_CONTENT_TYPE;
+                contentTypeProp.value.data.data = const_cast<char *>(CBOR_CONTENT_TYPE.data ());
+                contentTypeProp.value.data.len = (int) CBOR_CONTENT_TYPE.size ();
+                MQTTProperties_add ( &clientMessage.properties, &contentTypeProp );
+            }
+
+            MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+            opts.onFailure5 = onPublishFailure5;
+            opts.context = this;
+
+            if ( chunk )
+            {
+                auto addUserProperty = [&clientMessage] ( char const *name, std::string const &value ) {
+                    MQTTProperty prop;
+                    prop.identifier = MQTTPROPERTY_CODE_USER_PROPERTY;
+                    prop.value.data.data = const_cast<char *>(name);
+                    prop.value.data.len = (int) strlen ( name );
+                    prop.value.value.data = const_cast<char *>(value.data ());
+                    prop.value.value.len = (int) value.size ();
+                    MQTTProperties_add ( &clientMessage.properties, &prop );
+                };
+                addUserProperty ( "dab-stream-seq", std::to_string ( chunk->seq ) );
+                if ( chunk->last )
+                {
+                    addUserProperty ( "dab-stream-end", "true" );
+                }
+                if ( chunk->failed )
+                {
+                    addUserProperty ( "dab-stream-error", "true" );
+                }
+
+                opts.onSuccess5 = onChunkSent5;
+                opts.onFailure5 = onChunkFailed5;
+                std::lock_guard l1 ( streamAccess );
+                inflightChunks++;
+            }
+
+            int rc;
+            {
+                dabPipelineMetrics::timer publishTimer ( bridge.getMetrics (), dabMetricStage::publish );
+
+                // the library wants the topic NUL-terminated, a topic from a request's properties isn't
+                thread_local std::string topicBuffer;
+                topicBuffer.assign ( topic );
+
+                std::lock_guard l1 ( sendAccess );
+                auto alias = topicAliases.lookup ( topic );
+                if ( alias.value )
+                {
+                    MQTTProperty aliasProp;
+                    aliasProp.identifier = MQTTPROPERTY_CODE_TOPIC_ALIAS;
+                    aliasProp.value.integer2 = alias.value;
+                    MQTTProperties_add ( &clientMessage.properties, &aliasProp );
+                }
+                rc = MQTTAsync_sendMessage ( client, alias.established ? "" : topicBuffer.c_str (), &clientMessage, &opts );
+                if ( rc != MQTTASYNC_SUCCESS && alias.value && !alias.established )
+                {
+                    topicAliases.failed ( topic );
+                }
+            }
+            MQTTProperties_free ( &clientMessage.properties );
+            if ( rc != MQTTASYNC_SUCCESS )
+            {
+                if ( chunk )
+                {
+                    onChunkSent5 ( this, nullptr );
+                }
+                throw DAB::dabException ( rc, "error publishing message" );
+            }
+        }
+
+        // this is the publishing call-back that we pass to the bridge object (and subsequently to the dabClient).  It's used for notifications where we send telemetry responses without a request
+        void publishCB ( jsonElement const &elem )
+        {
+            std::string const &topic = elem["topic"];
+            auto &payload = scratchBuffer ( true );
+
+            if ( cborNotifications )
+            {
+                elem["payload"].serializeCBOR ( payload );
+            } else
+            {
+                publishTemplates.serialize ( topic, elem["payload"], payload );
+            }
+
+            send ( topic, payload, topicQos.lookup ( topic, true ), cborNotifications );
+        }
+
+        // subscribes to topics, returning once the broker has accepted them
+        void subscribe ( std::vector<std::string> topics )
+        {
+            // subscriptions are coalesced into batches and all batches are sent before we wait on any of them
+            std::vector<char *> topicPtrs;
+            topicPtrs.reserve ( topics.size () );
+            for ( auto &topic : topics )
+            {
+                topicPtrs.push_back ( topic.data () );
+            }
+            std::vector<int> qos ( topics.size (), 1 );
+
+            std::vector<std::unique_ptr<completion>> comps;
+            for ( size_t start = 0; start < topics.size (); start += SUBSCRIBE_BATCH )
+            {
+                auto count = std::min ( SUBSCRIBE_BATCH, topics.size () - start );
+
+                comps.push_back ( std::make_unique<completion> () );
+                auto opts = comps.back ()->responseOptions ();
+                if ( auto rc = MQTTAsync_subscribeMany ( client, (int) count, topicPtrs.data () + start, qos.data () + start, &opts ) )
+                {
+                    comps.pop_back ();
+                    // the library may still call back on batches already sent, they need to finish before their completions go out of scope
+                    for ( auto &comp : comps )
+                    {
+                        try
+                        {
+                            comp->wait ( "" );
+                        } catch ( ... )
+                        {
+                        }
+                    }
+                    throw DAB::dabException ( rc, std::string ( "Failed to subscribe" ) );
+                }
+            }
+            std::optional<DAB::dabException> failure;
+            for ( auto &comp : comps )
+            {
+                try
+                {
+                    comp->wait ( "Failed to subscribe" );
+                } catch ( DAB::dabException &e )
+                {
+                    failure = e;
+                }
+            }
+            if ( failure )
+            {
+                throw *failure;
+            }
+        }
+
+        static void connectionLost ( void *context, char *cause )
+        {
+            auto *mqttInterface = reinterpret_cast<dabMQTTAsyncInterface *>(context);
+            if ( cause )
+            {
+                MQTTAsync_free ( cause );
+            }
+            if ( mqttInterface->reconnector.connectionLost () )
+            {
+                // wait () carries on waiting while we reconnect
+                return;
+            }
+            std::lock_guard l1 ( mqttInterface->runningMutex );
+            mqttInterface->running.notify_all ();
+        }
+
+        // connects to the broker, returning once it has accepted the connection.   The first connection starts a new session, later ones resume it if the broker
+        // still has it, in which case it also has our subscriptions and they aren't sent again
+        void establish ( bool initial )
+        {
+            completion comp;
+
+            MQTTAsync_connectOptions conn_opts = MQTTAsync_connectOptions_initializer5;
+
+            conn_opts.keepAliveInterval = 20;
+            conn_opts.maxInflight = maxInflight;
+            conn_opts.cleanstart = initial || !sessionExpiry.count ();
+            conn_opts.onSuccess5 = completion::onConnected5;
+            conn_opts.onFailure5 = completion::onFailure5;
+            conn_opts.context = &comp;
+
+            MQTTProperties connectProps = MQTTProperties_initializer;
+            if ( sessionExpiry.count () )
+            {
+                MQTTProperty expiryProp;
+                expiryProp.identifier = MQTTPROPERTY_CODE_SESSION_EXPIRY_INTERVAL;
+                expiryProp.value.integer4 = (unsigned int) std::min<int64_t> ( sessionExpiry.count (), UINT32_MAX );
+                MQTTProperties_add ( &connectProps, &expiryProp );
+                conn_opts.connectProperties = &connectProps;
+            }
+
+            {
+                // aliases belong to a connection, none are used until the broker tells us how many the new one may have
+                std::lock_guard l1 ( sendAccess );
+                topicAliases.reset ( 0 );
+            }
+
+            auto rc = MQTTAsync_connect ( client, &conn_opts );
+            MQTTProperties_free ( &connectProps );
+            if ( rc )
+            {
+                throw DAB::dabException ( rc, std::string ( "Failed to set connect" ) );
+            }
+            comp.wait ( "Failed to set connect" );
+            {
+                std::lock_guard l1 ( sendAccess );
+                topicAliases.reset ( comp.topicAliasMaximum );
+            }
+
+            if ( initial || !comp.sessionPresent )
+            {
+                subscribe ( bridge.getTopics ( wildcardSubscriptions ) );
+            }
+        }
+
+    public:
+
+        dabMQTTAsyncInterface ( BRIDGE &bridge, std::string const &brokerAddress ) : bridge ( bridge ), ingress ( bridge.getMetrics () )
+        {
+            // correlation data and response topics are MQTT 5 properties
+            MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer5;
+
+            if ( auto rc = MQTTAsync_createWithOptions ( &client, brokerAddress.c_str (), "dab", MQTTCLIENT_PERSISTENCE_NONE, nullptr, &createOpts ) )
+            {
+                throw DAB::dabException ( rc, std::string ( "Failed to create client" ) );
+            }
+
+            if ( auto rc = MQTTAsync_setCallbacks ( client, this, connectionLost, messageArrived, nullptr ) )
+            {
+                throw DAB::dabException ( rc, std::string ( "Failed to set callbacks" ) );
+            }
+            bridge.setPublishCallback ( std::function ( [this](jsonElement const &elem){ return publishCB ( elem );} ) );
+            // a stopped telemetry stream's topic won't be published on again
+            bridge.getTelemetryScheduler ().setRemovalObserver ( [this] ( std::string const &topic ) { publishTemplates.erase ( topic ); } );
+        }
+
+        ~dabMQTTAsyncInterface ()
+        {
+            reconnector.stop ();
+            bridge.getTelemetryScheduler ().setRemovalObserver ( nullptr );
+            pool.reset ();
+            MQTTAsync_destroy ( &client );
+        }
+
+        // per device request limit, see dabMQTTInterface::setDeviceQueueLimit
+        void setDeviceQueueLimit ( size_t limit )
+        {
+            ingress.setLimit ( limit );
+        }
+
+        // coalescing of identical read only requests, see dabMQTTInterface::setRequestCoalescing
+        void setRequestCoalescing ( bool enable )
+        {
+            ingress.setCoalescing ( enable );
+        }
+
+        jsonElement getQueueDepths ()
+        {
+            return ingress.getQueueDepths ();
+        }
+
+        // opt in to per-request arena allocation.  See dabMQTTInterface::setArenaSize.   Must be called before connect ().
+        void setArenaSize ( size_t initialSize )
+        {
+            arenaSize = initialSize;
+        }
+
+        // number of threads used to execute requests.  See dabMQTTInterface::setWorkerThreads.   Must be called before connect ().
+        void setWorkerThreads ( size_t numThreads )
+        {
+            numWorkers = numThreads;
+        }
+
+        // subscribe with a single dab/<deviceId>/# wildcard per device.  See dabMQTTInterface::setWildcardSubscriptions.   Must be called before connect ().
+        void setWildcardSubscriptions ( bool enable )
+        {
+            wildcardSubscriptions = enable;
+        }
+
+        // the most topic aliases to use when publishing.  See dabMQTTInterface::setTopicAliases.   Must be called before connect ().
+        void setTopicAliases ( uint16_t maximum )
+        {
+            topicAliases.setLimit ( maximum );
+        }
+
+        // maximum number of publishes allowed to be awaiting acknowledgement from the broker.   Must be called before connect ().
+        void setMaxInflight ( int inflight )
+        {
+            maxInflight = inflight;
+        }
+
+        // the qos responses and notifications are published with.  See dabMQTTInterface::setQos.   Must be called before connect ().
+        void setQos ( int responseQos, int notificationQos )
+        {
+            topicQos.setDefaults ( responseQos, notificationQos );
+        }
+
+        // publish anything on a topic matching filter with qos.  See dabMQTTInterface::setTopicQos.   Must be called before connect ().
+        void setTopicQos ( std::string filter, int qos )
+        {
+            topicQos.add ( std::move ( filter ), qos );
+        }
+
+        // publish notifications as CBOR.  See dabMQTTInterface::setCborNotifications.   Must be called before connect ().
+        void setCborNotifications ( bool enable )
+        {
+            cborNotifications = enable;
+        }
+
+        // publish responses of handlers returning a dabStream as a header followed by chunks of data.  See dabMQTTInterface::setResponseStreaming.   Must be called before connect ().
+        // a stream waits for the library to report its chunks as written, which it does on its receive thread, so with streaming on requests are always handled on
+        // worker threads (one if setWorkerThreads wasn't called)
+        void setResponseStreaming ( dabStreamEncoding encoding, size_t chunkSize = 48 * 1024 )
+        {
+            streamEncoding = encoding;
+            streamChunkSize = encoding == dabStreamEncoding::base64 ? std::max<size_t> ( chunkSize / 3 * 3, 3 ) : std::max<size_t> ( chunkSize, 1 );
+        }
+
+        // subscribe to the topics (or wildcard) of a device made after connect () was called, such as from the makeDeviceInstances ready callback.   May be called from any thread
+        void subscribeDevice ( std::string_view deviceId )
+        {
+            subscribe ( bridge.getDeviceTopics ( deviceId, wildcardSubscriptions ) );
+        }
+
+        // reconnect after losing the connection.  See dabMQTTInterface::setReconnect.   Must be called before connect ().   The library's own automatic reconnect
+        // isn't used as it would reuse the first connection's clean start, and doesn't report whether the session was resumed
+        void setReconnect ( std::chrono::milliseconds initialDelay, std::chrono::milliseconds maxDelay )
+        {
+            reconnector.setBackoff ( initialDelay, maxDelay );
+        }
+
+        // how long the broker keeps our session after the connection drops.  See dabMQTTInterface::setSessionExpiry.   Must be called before connect ().
+        void setSessionExpiry ( std::chrono::seconds expiry )
+        {
+            sessionExpiry = expiry;
+        }
+
+        // establishes the connection with the mqtt broker and subscribes to all the bridge's topics, returning once the broker has accepted them
+        auto connect ()
+        {
+            if ( (numWorkers || streamEncoding != dabStreamEncoding::none) && !pool )
+            {
+                pool = std::make_unique<dabWorkerPool> ( std::max<size_t> ( numWorkers, 1 ) );
+            }
+
+            establish ( true );
+            reconnector.start ( [this] { establish ( false ); } );
+            return 0;
+        }
+
+        // this function should be called when the client wish's to cleanly end the mqtt interface in preparation for exiting.
+        auto disconnect ()
+        {
+            reconnector.stop ();
+
+            completion comp;
+
+            MQTTAsync_disconnectOptions opts = MQTTAsync_disconnectOptions_initializer;
+            opts.timeout = 10000;
+            opts.onSuccess5 = completion::onSuccess5;
+            opts.onFailure5 = completion::onFailure5;
+            opts.context = &comp;
+
+            if ( auto rc = MQTTAsync_disconnect ( client, &opts ))
+            {
+                throw DAB::dabException ( rc, std::string ( "Failed to disconnect" ));
+            }
+            comp.wait ( "Failed to disconnect" );
+
+            std::lock_guard l1 ( runningMutex );
+            running.notify_all ();
+            return 0;
+        }
+
+        // this function will wait until the mqtt interface has been properly shut down, or errors due to connectivity loss (that isn't being recovered, see setReconnect).
+        void wait ()
+        {
+            std::unique_lock l1 ( runningMutex );
+            running.wait ( l1 );
+            return;
+        }
+    };
+};
@@ -21,8 +21,19 @@
 #include <exception>
 #include <condition_variable>
 #include <mutex>
+#include <memory>
+#include <optional>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <algorithm>
 
 #include "dabBridge.h"
+#include "dabIngress.h"
+#include "dabReconnect.h"
+#include "dabTopicAlias.h"
+#include "dabTopicQos.h"
+#include "dabWorkerPool.h"
 #include "MQTTClient.h"
 #include "MQTTExportDeclarations.h"
 #include "MQTTProperties.h"
@@ -51,16 +62,23 @@ namespace DAB
         std::condition_variable running;
         std::mutex runningMutex;
 
-        static std::string getResponseTopic ( MQTTClient_message *message )
+        // the response topic in the request's properties.  The view is into the message
+        static std::string_view getResponseTopic ( MQTTClient_message *message )
         {
-            if ( MQTTProperties_hasProperty ( &message->properties, MQTTPROPERTY_CODE_RESPONSE_TOPIC ) )
+            if ( auto *property = MQTTProperties_getProperty ( &message->properties, MQTTPROPERTY_CODE_RESPONSE_TOPIC ) )
             {
-                auto *property = MQTTProperties_getProperty ( &message->properties, MQTTPROPERTY_CODE_RESPONSE_TOPIC );
-
-                auto res = std::string ( property->value.data.data, property->value.data.len );
-                return res;
+                return { property->value.data.data, (size_t) property->value.data.len };
             }
-            return "";
+            return {};
+        }
+
+        // requests (and our responses to them) with this content type are CBOR rather than json
+        constexpr static std::string_view CBOR_CONTENT_TYPE = "application/cbor";
+
+        static bool isCbor ( MQTTClient_message *message )
+        {
+            auto *property = MQTTProperties_getProperty ( &message->properties, MQTTPROPERTY_CODE_CONTENT_TYPE );
+            return property && std::string_view ( property->value.data.data, (size_t) property->value.data.len ) == CBOR_CONTENT_TYPE;
         }
 
         static bool hasCorrelationData ( MQTTClient_message *message )
@@ -80,52 +98,500 @@ namespace DAB
         {
             auto *mqttInterface = reinterpret_cast<dabMQTTInterface *>(context);
 
-            auto &bridge = mqttInterface->bridge;
+            if ( mqttInterface->wildcardSubscriptions && !mqttInterface->bridge.isRequestTopic ( topic ) )
+            {
+                // not a request, drop it without responding
+                MQTTClient_freeMessage ( &message );
+                MQTTClient_free ( topic );
+                return 1;
+            }
+
+            if ( mqttInterface->pool && mqttInterface->pool->size () )
+            {
+                // hand the request off to the worker pool.  The job takes ownership of the message and releases it once the request has been handled
+                std::string topicStr ( topic );
+                MQTTClient_free ( topic );
+
+                // requests are serialized per device, keyed by the dab/<deviceId> portion of the topic
+                std::string_view key ( topicStr );
+                key = key.substr ( 0, key.find ( '/', 4 ) );
+
+                // the device's queue may be full, or an identical read only request already queued
+                auto &ingress = mqttInterface->ingress;
+                auto cbor = isCbor ( message );
+                // streamed responses go out in chunks as they're produced, so there's no one response to share
+                auto coalesceKey = mqttInterface->streamEncoding == dabStreamEncoding::none ? ingress.coalesceKey ( topicStr, key, cbor, (char const *) message->payload, (size_t) message->payloadlen ) : std::string ();
+                switch ( ingress.enter ( key, coalesceKey, coalesceKey.empty () ? dabIngressGate::waiter () : makeWaiter ( message ) ) )
+                {
+                    case dabIngressGate::admission::run:
+                        break;
+                    case dabIngressGate::admission::rejected:
+                        mqttInterface->sendError ( makeWaiter ( message ), cbor, 503, "device busy" );
+                        [[fallthrough]];
+                    case dabIngressGate::admission::coalesced:
+                        MQTTClient_freeMessage ( &message );
+                        return 1;
+                }
+
+                auto job = [mqttInterface, topicStr, coalesceKey = std::move ( coalesceKey ), cbor, msg = std::unique_ptr<MQTTClient_message, messageDeleter> ( message )] ()
+                {
+                    mqttInterface->handleMessage ( topicStr.c_str (), msg.get (), coalesceKey );
+
+                    // anyone still waiting on us didn't get a response, the request must have failed
+                    std::string_view key ( topicStr );
+                    for ( auto &w : mqttInterface->ingress.leave ( key.substr ( 0, key.find ( '/', 4 ) ), coalesceKey ) )
+                    {
+                        mqttInterface->sendError ( std::move ( w ), cbor, 500, "request failed" );
+                    }
+                };
+                mqttInterface->pool->submit ( key, std::move ( job ) );
+                return 1;
+            }
+
+            mqttInterface->handleMessage ( topic, message );
+
+            // returning 1 tells paho we've consumed the message, so it's up to us to release it
+            MQTTClient_freeMessage ( &message );
+            MQTTClient_free ( topic );
+            return 1;
+        }
+
+        struct messageDeleter
+        {
+            void operator () ( MQTTClient_message *message ) const
+            {
+                MQTTClient_freeMessage ( &message );
+            }
+        };
+
+        // a fully formed response or notification waiting to be published
+        struct outgoingMessage
+        {
+            std::string topic;
+            std::string payload;
+            std::string correlationData;
+            bool hasCorrelationData = false;
+            int qos = 0;
+            bool cbor = false;                  // sent with the CBOR content type
+
+            // set for the chunks of a streamed response: the chunk's sequence number, and whether it's the last one (and if so whether the stream failed)
+            int64_t chunkSeq = -1;
+            bool lastChunk = false;
+            bool streamFailed = false;
+
+            // empties the message for reuse.  The strings keep their capacity
+            void clear ()
+            {
+                topic.clear ();
+                payload.clear ();
+                correlationData.clear ();
+                hasCorrelationData = false;
+                qos = 0;
+                cbor = false;
+                chunkSeq = -1;
+                lastChunk = false;
+                streamFailed = false;
+            }
+        };
+
+        // the message the calling thread builds its responses (or notifications) in.   Once a thread's buffers have grown to fit what it publishes they are reused
+        // from one message to the next, and publish hands back a message the publisher has finished with in place of one it queues, so the steady state allocates nothing.
+        // notifications have their own as a handler may publish one while its response is being built
+        static outgoingMessage &scratchMessage ( bool notification )
+        {
+            thread_local outgoingMessage msgs[2];
+            auto &msg = msgs[notification];
+            msg.clear ();
+            return msg;
+        }
+
+        // messages the publisher has sent, waiting to be swapped for queued ones.  Guarded by publishAccess
+        constexpr static size_t MAX_SPARE_MESSAGES = 64;
+        std::vector<outgoingMessage> spareMessages;
+
+        // aliases for the topics we publish on repeatedly (telemetry, and the response topics of regular requesters)
+        dabTopicAliases topicAliases;
+
+        // the qos responses and notifications are published with
+        dabTopicQos topicQos;
+
+        // streamed responses.  The header response is followed by chunks of at most streamChunkSize bytes of data (before encoding)
+        // no more than STREAM_WINDOW chunks are ever waiting to be published, so memory use is bounded whatever the size of the data
+        constexpr static size_t STREAM_WINDOW = 4;
+        dabStreamEncoding streamEncoding = dabStreamEncoding::none;
+        size_t streamChunkSize = 48 * 1024;
+
+        // topics are subscribed to in batches of this many per subscribe request
+        constexpr static size_t SUBSCRIBE_BATCH = 256;
+
+        // subscribe to dab/<deviceId>/# rather than each individual operation
+        bool wildcardSubscriptions = false;
+
+        // notifications (telemetry in particular) publish the same shape on a topic over and over, so their structure is serialized once per topic
+        jsonTemplateCache publishTemplates;
+
+        // publish notifications as CBOR rather than json
+        bool cborNotifications = false;
+
+        // request execution pool.  nullptr (or a pool with no workers) handles requests on paho's callback thread
+        size_t numWorkers = 0;
+
+        // admission to the pool, with per device queue limits and coalescing of identical read only requests
+        dabIngressGate ingress;
+
+        // reconnects after the connection is lost, if enabled
+        dabReconnector reconnector;
+
+        // how long the broker keeps our session (and so our subscriptions) after the connection drops, 0 to discard it straight away
+        std::chrono::seconds sessionExpiry{ 0 };
+        std::unique_ptr<dabWorkerPool> pool;
+
+        // when the pool is running all publishing is done from a dedicated publisher thread so workers never block on the mqtt library
+        std::deque<outgoingMessage> publishQueue;
+        std::mutex publishAccess;
+        std::condition_variable publishCondition;
+        bool publisherExiting = false;
+        std::thread publisherThread;
+
+        // number of stream chunks in publishQueue
+        size_t queuedChunks = 0;
+        std::condition_variable chunkCondition;
+
+        void publisherTask ()
+        {
+            outgoingMessage msg;
+            bool sent = false;
+            for ( ;; )
+            {
+                {
+                    std::unique_lock l1 ( publishAccess );
+                    if ( sent && spareMessages.size () < MAX_SPARE_MESSAGES )
+                    {
+                        // keep its buffers for a thread that queues a message
+                        spareMessages.push_back ( std::move ( msg ) );
+                    }
+                    publishCondition.wait ( l1, [this] { return !publishQueue.empty () || publisherExiting; } );
+                    if ( publishQueue.empty () )
+                    {
+                        return;
+                    }
+                    msg = std::move ( publishQueue.front () );
+                    publishQueue.pop_front ();
+                }
+                sent = true;
+                try
+                {
+                    sendMessage ( msg );
+                } catch ( DAB::dabException &e )
+                {
+                    std::cout << "error (" << e.errorCode << "): " << e.errorText << std::endl;
+                }
+                if ( msg.chunkSeq >= 0 )
+                {
+                    {
+                        std::lock_guard l1 ( publishAccess );
+                        queuedChunks--;
+                    }
+                    chunkCondition.notify_all ();
+                }
+            }
+        }
+
+        // queue for the publisher, or if there isn't one publish it directly.   A queued msg is replaced by a spare (if there is one) whose buffers the caller can reuse
+        void publish ( outgoingMessage &&msg )
+        {
+            if ( !publisherThread.joinable () )
+            {
+                sendMessage ( msg );
+                return;
+            }
+            {
+                std::lock_guard l1 ( publishAccess );
+                publishQueue.push_back ( std::move ( msg ) );
+                if ( !spareMessages.empty () )
+                {
+                    msg = std::move ( spareMessages.back () );
+                    spareMessages.pop_back ();
+                }
+            }
+            publishCondition.notify_one ();
+        }
+
+        // as publish for a number of messages, which are queued together and sent back to back
+        void publishBatch ( std::vector<outgoingMessage> &&msgs )
+        {
+            if ( !publisherThread.joinable () )
+            {
+                for ( auto const &msg : msgs )
+                {
+                    sendMessage ( msg );
+                }
+                return;
+            }
+            {
+                std::lock_guard l1 ( publishAccess );
+                for ( auto &msg : msgs )
+                {
+                    publishQueue.push_back ( std::move ( msg ) );
+                }
+            }
+            publishCondition.notify_one ();
+        }
+
+        // as publish, but waits for room in the stream window before queueing the chunk
+        void publishChunk ( outgoingMessage const &chunk )
+        {
+            if ( !publisherThread.joinable () )
+            {
+                sendMessage ( chunk );
+                return;
+            }
+            {
+                std::unique_lock l1 ( publishAccess );
+                chunkCondition.wait ( l1, [this] { return queuedChunks < STREAM_WINDOW; } );
+                queuedChunks++;
+                publishQueue.push_back ( chunk );
+            }
+            publishCondition.notify_one ();
+        }
+
+        // publishes a stream's header response followed by its data.   Chunks go to the same topic with the same correlation data as the header and are numbered
+        // from 0 in the dab-stream-seq user property.   The last chunk (which may be empty) has dab-stream-end set, and dab-stream-error too if the data couldn't be read
+        void sendStream ( outgoingMessage &&header, dabStream &stream )
+        {
+            outgoingMessage chunk;
+            chunk.topic = header.topic;
+            chunk.correlationData = header.correlationData;
+            chunk.hasCorrelationData = header.hasCorrelationData;
+            chunk.qos = header.qos;
+            publish ( std::move ( header ) );
+
+            std::string buff ( streamChunkSize, '\0' );
+            for ( chunk.chunkSeq = 0; !chunk.lastChunk; chunk.chunkSeq++ )
+            {
+                size_t len;
+                try
+                {
+                    len = stream.read ( buff.data (), buff.size () );
+                } catch ( ... )
+                {
+                    len = 0;
+                    chunk.streamFailed = true;
+                }
+                chunk.lastChunk = len < buff.size ();
+
+                chunk.payload.clear ();
+                if ( streamEncoding == dabStreamEncoding::base64 )
+                {
+                    base64Encode ( buff.data (), len, chunk.payload );
+                } else
+                {
+                    chunk.payload.append ( buff.data (), len );
+                }
+                publishChunk ( chunk );
+            }
+        }
+
+        void sendMessage ( outgoingMessage const &msg )
+        {
+            MQTTClient_message clientMessage = MQTTClient_message_initializer;
+
+            clientMessage.payload = const_cast<char *>(msg.payload.c_str ());
+            clientMessage.payloadlen = (int) msg.payload.size ();
+            clientMessage.qos = msg.qos;
+            clientMessage.retained = 0;
+
+            if ( msg.hasCorrelationData )
+            {
+                MQTTProperty corr_data_resp_prop;
+                corr_data_resp_prop.identifier = MQTTPROPERTY_CODE_CORRELATION_DATA;
+                corr_data_resp_prop.value.data.data = const_cast<char *>(msg.correlationData.data ());
+                corr_data_resp_prop.value.data.len = (int) msg.correlationData.size ();
+
+                int rc = MQTTProperties_add(&clientMessage.properties, &corr_data_resp_prop);
+            }
+
+            if ( msg.cbor )
+            {
+                MQTTProperty contentTypeProp;
+                contentTypeProp.identifier = MQTTPROPERTY_CODE_CONTENT_TYPE;
+                contentTypeProp.value.data.data = const_cast<char *>(CBOR_CONTENT_TYPE.data ());
+                contentTypeProp.value.data.len = (int) CBOR_CONTENT_TYPE.size ();
+                MQTTProperties_add ( &clientMessage.properties, &contentTypeProp );
+            }
+
+            if ( msg.chunkSeq >= 0 )
+            {
+                auto addUserProperty = [&clientMessage] ( char const *name, std::string const &value ) {
+                    MQTTProperty prop;
+                    prop.identifier = MQTTPROPERTY_CODE_USER_PROPERTY;
+                    prop.value.data.data = const_cast<char *>(name);
+                    prop.value.data.len = (int) strlen ( name );
+                    prop.value.value.data = const_cast<char *>(value.data ());
+                    prop.value.value.len = (int) value.size ();
+                    MQTTProperties_add ( &clientMessage.properties, &prop );
+                };
+                addUserProperty ( "dab-stream-seq", std::to_string ( msg.chunkSeq ) );    // properties are copied in, the temporary needn't outlive the call
+                if ( msg.lastChunk )
+                {
+                    addUserProperty ( "dab-stream-end", "true" );
+                }
+                if ( msg.streamFailed )
+                {
+                    addUserProperty ( "dab-stream-error", "true" );
+                }
+            }
+
+            int rc;
+            {
+                dabPipelineMetrics::timer publishTimer ( bridge.getMetrics (), dabMetricStage::publish );
+
+                // get the mutex to serialize calls to the mqtt library.  That also keeps the alias lookup and the publish together, so the publish that tells the
+                // broker an alias always goes out before any that rely on it
+                std::lock_guard l1 ( runningMutex );
+                auto alias = topicAliases.lookup ( msg.topic );
+                if ( alias.value )
+                {
+                    MQTTProperty aliasProp;
+                    aliasProp.identifier = MQTTPROPERTY_CODE_TOPIC_ALIAS;
+                    aliasProp.value.integer2 = alias.value;
+                    MQTTProperties_add ( &clientMessage.properties, &aliasProp );
+                }
+                auto response = MQTTClient_publishMessage5 ( client, alias.established ? "" : msg.topic.c_str (), &clientMessage, nullptr );
+                rc = (int) response.reasonCode;
+                MQTTResponse_free ( response );
+                if ( rc && alias.value && !alias.established )
+                {
+                    topicAliases.failed ( msg.topic );
+                }
+            }
+            MQTTProperties_free ( &clientMessage.properties );
+            if ( rc )
+            {
+                throw DAB::dabException ( rc, "error publishing message" );
+            }
+        }
+
+        void stopWorkers ()
+        {
+            // the pool drains anything still queued, which may add to the publish queue, so it has to go first
+            pool.reset ();
+            if ( publisherThread.joinable () )
+            {
+                {
+                    std::lock_guard l1 ( publishAccess );
+                    publisherExiting = true;
+                }
+                publishCondition.notify_all ();
+                publisherThread.join ();
+                publisherExiting = false;
+            }
+        }
+
+        // initial size of the per-thread request arena, 0 if arena's are not being used
+        size_t arenaSize = 0;
+
+        // returns the calling thread's request arena or nullptr if they're not enabled
+        jsonArena *getArena ()
+        {
+            if ( !arenaSize )
+            {
+                return nullptr;
+            }
+            thread_local std::unique_ptr<jsonArena> arena;
+            if ( !arena )
+            {
+                arena = std::make_unique<jsonArena> ( arenaSize );
+            }
+            return arena.get ();
+        }
+
+        // parse, dispatch and respond to a single request.   coalesceKey is the request's key in ingress if identical requests may be waiting on its response
+        void handleMessage ( char const *topic, MQTTClient_message *message, std::string_view coalesceKey = {} )
+        {
+            // if enabled, the parsed request, the response and everything built along the way come out of this thread's arena which is reset in one go once we've published
+            auto *arena = getArena ();
+            {
+                std::optional<jsonArena::scope> arenaScope;
+                if ( arena )
+                {
+                    arenaScope.emplace ( *arena );
+                }
+                processMessage ( topic, message, coalesceKey );
+            }
+            if ( arena )
+            {
+                arena->reset ();
+            }
+        }
+
+        // the request handling proper, runs with the arena (if any) active
+        void processMessage ( char const *topic, MQTTClient_message *message, std::string_view coalesceKey )
+        {
             try
             {
-                std::string reqStr ((char const *) message->payload, message->payloadlen );
-                jsonElement req = jsonParser ( reqStr.c_str ());
-
-                // the dispatcher requires the topic to be part of the DAB request.  Add it in.
-                req["topic"] = topic;
-                // we put the payload in its own "payload" value in the json object
-                req["payload"] = jsonParser ( reqStr.c_str ());
-                // this leaves us the capability of adding other properties into the top level
-                // that might be needed by a potential handler. for instance topic is currently sent
-                // but a handler might want responseTopic for logging purposes or correlation data
-                // we currently don't send those, but you can do so by commenting out the below lines
-                // req["responseTopic"] = getResponseTopic ( message );
-                // req["correlationData"] = hasCorrelationData ( message ) ? getCorrelationData ( message ) : "";
-                // dispatch to the bridge and start get the response
-                jsonElement rsp = bridge.dispatch ( req );
-
-                MQTTClient_message clientMessage = MQTTClient_message_initializer;
-
-                std::string payload;
-
-                // serialize the json response (convert from our internal jsonElement to a string)
-                rsp.serialize ( payload, true );
-                clientMessage.payload = const_cast<char *>(payload.c_str ());
-                clientMessage.payloadlen = (int) payload.size ();
-                clientMessage.qos = 0;
-                clientMessage.retained = 0;
+                auto &msg = scratchMessage ( false );
+                std::optional<dabStream> stream;
+
+                msg.topic.assign ( getResponseTopic ( message ) );
+                msg.qos = topicQos.lookup ( msg.topic, false );
+                msg.cbor = isCbor ( message );
 
                 if ( hasCorrelationData ( message ) )
                 {
                     auto corr_data_req_prop = getCorrelationData ( message );
-                    MQTTProperty corr_data_resp_prop;
-                    corr_data_resp_prop.identifier = MQTTPROPERTY_CODE_CORRELATION_DATA;
-                    corr_data_resp_prop.value.data.data = corr_data_req_prop->value.data.data;
-                    corr_data_resp_prop.value.data.len = corr_data_req_prop->value.data.len;
+                    msg.correlationData.assign ( corr_data_req_prop->value.data.data, corr_data_req_prop->value.data.len );
+                    msg.hasCorrelationData = true;
+                }
 
-                    int rc = MQTTProperties_add(&clientMessage.properties, &corr_data_resp_prop);
+                // every device answers a discovery.   Their responses are kept by the bridge and all go out as one batch
+                if ( !strcmp ( topic, "dab/discovery" ) )
+                {
+                    auto responses = bridge.getDiscoveryResponses ();
+                    auto const &payloads = msg.cbor ? responses->cbor : responses->json;
+                    std::vector<outgoingMessage> batch ( payloads.size () );
+                    for ( size_t loop = 0; loop < batch.size (); loop++ )
+                    {
+                        batch[loop].topic = msg.topic;
+                        batch[loop].correlationData = msg.correlationData;
+                        batch[loop].hasCorrelationData = msg.hasCorrelationData;
+                        batch[loop].qos = msg.qos;
+                        batch[loop].cbor = msg.cbor;
+                        batch[loop].payload = payloads[loop];
+                    }
+                    publishBatch ( std::move ( batch ) );
+                    return;
                 }
 
-                // get the mutex to serialize calls to the mqtt library
-                std::lock_guard l1 ( mqttInterface->runningMutex );
-                if ( auto rc = MQTTClient_publishMessage ( mqttInterface->client, getResponseTopic ( message ).c_str (), &clientMessage, nullptr ))
+                // a cached response is already serialized, so it's sent as is without parsing the request or dispatching it.   They're kept as json, CBOR requests are always dispatched
+                auto cached = !msg.cbor && bridge.getCachedResponse ( topic, msg.payload );
+                bridge.getMetrics ().countRequest ( cached );
+                if ( !cached )
                 {
-                    throw DAB::dabException ( rc, "error publishing message" );
+                    buildResponse ( topic, message, msg.cbor, msg.payload, streamEncoding != dabStreamEncoding::none ? &stream : nullptr );
+                }
+
+                if ( stream )
+                {
+                    sendStream ( std::move ( msg ), *stream );
+                } else
+                {
+                    if ( !coalesceKey.empty () )
+                    {
+                        // identical requests that arrived while we were queued or running get the same response
+                        for ( auto &w : ingress.complete ( coalesceKey ) )
+                        {
+                            outgoingMessage copy;
+                            copy.topic = std::move ( w.topic );
+                            copy.correlationData = std::move ( w.correlationData );
+                            copy.hasCorrelationData = w.hasCorrelationData;
+                            copy.qos = topicQos.lookup ( copy.topic, false );
+                            copy.cbor = msg.cbor;
+                            copy.payload = msg.payload;
+                            publish ( std::move ( copy ) );
+                        }
+                    }
+                    publish ( std::move ( msg ) );
                 }
             } catch ( DAB::dabException &e )
             {
@@ -133,42 +599,215 @@ namespace DAB
             } catch ( ... )
             {
             }
-            return 1;
         }
 
-        // this is the publishing call-back that we pass to the bridge object (and subsequently to the dabClient).  It's used for notifications where we send telemetry responses without a request
-        void publishCB ( jsonElement const &elem )
+        // parse and dispatch the request, serializing the response into payload in the same format (json or CBOR) as the request.   If stream is supplied a streamed response's body is left there
+        void buildResponse ( char const *topic, MQTTClient_message *message, bool cbor, std::string &payload, std::optional<dabStream> *stream )
         {
-            MQTTClient_message clientMessage = MQTTClient_message_initializer;
+            auto serialize = [cbor, &payload] ( jsonElement const &rsp ) {
+                if ( cbor )
+                {
+                    rsp.serializeCBOR ( payload );
+                } else
+                {
+                    rsp.serialize ( payload, true );
+                }
+            };
+
+            // it's parsed once, straight out of the mqtt buffer (which is not NUL-terminated).   A malformed request is answered without throwing
+            auto &metrics = bridge.getMetrics ();
+            dabPipelineMetrics::timer parseTimer ( metrics, dabMetricStage::parse );
+            auto parsed = cbor ? cborTryParse ( (char const *) message->payload, (size_t) message->payloadlen ) : jsonTryParse ( (char const *) message->payload, (size_t) message->payloadlen );
+            parseTimer.stop ();
+            if ( !parsed )
+            {
+                metrics.countParseFailure ();
+                serialize ( { { "status", 400 }, { "error", "unable to parse request" } } );
+                return;
+            }
 
-            std::string payload;
+            jsonElement req;
+
+            // we put the payload in its own "payload" value in the json object
+            req["payload"] = std::move ( *parsed );
+            // the dispatcher requires the topic to be part of the DAB request.  Add it in.
+            req["topic"] = topic;
+            // this leaves us the capability of adding other properties into the top level
+            // that might be needed by a potential handler. for instance topic is currently sent
+            // but a handler might want responseTopic for logging purposes or correlation data
+            // we currently don't send those, but you can do so by commenting out the below lines
+            // req["responseTopic"] = getResponseTopic ( message );
+            // req["correlationData"] = hasCorrelationData ( message ) ? getCorrelationData ( message ) : "";
+            // dispatch to the bridge and start get the response.  BRIDGE is the bridge's actual type, so naming it calls its dispatch directly rather than through the vtable
+            jsonElement rsp = stream ? bridge.BRIDGE::dispatch ( req, *stream ) : bridge.BRIDGE::dispatch ( req );
+            if ( stream && *stream )
+            {
+                // tell the receiver how the chunks that follow are encoded
+                rsp["stream"]["encoding"] = streamEncoding == dabStreamEncoding::base64 ? "base64" : "raw";
+                rsp["stream"]["chunkSize"] = (int64_t) streamChunkSize;
+            }
 
-            elem["payload"].serialize ( payload, true );
+            // serialize the json response (convert from our internal jsonElement to a string)
+            dabPipelineMetrics::timer serializeTimer ( metrics, dabMetricStage::serialize );
+            serialize ( rsp );
+        }
 
-            clientMessage.payload = const_cast<char *>(payload.c_str ());
-            clientMessage.payloadlen = (int) payload.size ();
-            clientMessage.qos = 0;
-            clientMessage.retained = 0;
+        void subscribe ( std::vector<std::string> topics )
+        {
+            // subscribe in batches, each one a single round trip to the broker
+            std::vector<char *> topicPtrs;
+            topicPtrs.reserve ( topics.size () );
+            for ( auto &topic : topics )
+            {
+                topicPtrs.push_back ( topic.data () );
+            }
+            std::vector<int> qos;
 
-            std::lock_guard l1 ( runningMutex );
-            if ( auto rc = MQTTClient_publishMessage ( client, elem["topic"].operator const std::string & ().c_str (), &clientMessage, nullptr ))
+            for ( size_t start = 0; start < topics.size (); start += SUBSCRIBE_BATCH )
             {
-                throw DAB::dabException ( rc, "error publishing message" );
+                auto count = std::min ( SUBSCRIBE_BATCH, topics.size () - start );
+
+                // the broker answers with a reason code per topic (just the one if there's a single topic), anything >= 0x80 is a refusal
+                qos.assign ( count, 1 );
+                auto response = MQTTClient_subscribeMany5 ( client, (int) count, topicPtrs.data () + start, qos.data (), nullptr, nullptr );
+                int rc = (int) response.reasonCode < 0 ? (int) response.reasonCode : 0;
+                for ( int loop = 0; !rc && loop < response.reasonCodeCount; loop++ )
+                {
+                    if ( response.reasonCodes[loop] >= MQTTREASONCODE_UNSPECIFIED_ERROR )
+                    {
+                        rc = response.reasonCodes[loop];
+                    }
+                }
+                if ( !rc && !response.reasonCodeCount && response.reasonCode >= MQTTREASONCODE_UNSPECIFIED_ERROR )
+                {
+                    rc = (int) response.reasonCode;
+                }
+                MQTTResponse_free ( response );
+                if ( rc )
+                {
+                    throw DAB::dabException ( rc, std::string ( "Failed to subscribe" ) );
+                }
             }
         }
 
+        // answers a request without handling it
+        void sendError ( dabIngressGate::waiter &&w, bool cbor, int64_t status, char const *text )
+        {
+            outgoingMessage msg;
+            msg.topic = std::move ( w.topic );
+            msg.correlationData = std::move ( w.correlationData );
+            msg.hasCorrelationData = w.hasCorrelationData;
+            msg.qos = topicQos.lookup ( msg.topic, false );
+            msg.cbor = cbor;
+            jsonElement rsp{ { "status", status }, { "error", text } };
+            if ( cbor )
+            {
+                rsp.serializeCBOR ( msg.payload );
+            } else
+            {
+                rsp.serialize ( msg.payload, true );
+            }
+            publish ( std::move ( msg ) );
+        }
+
+        // where the response to message goes
+        static dabIngressGate::waiter makeWaiter ( MQTTClient_message *message )
+        {
+            dabIngressGate::waiter w;
+            w.topic.assign ( getResponseTopic ( message ) );
+            if ( hasCorrelationData ( message ) )
+            {
+                auto corr_data_req_prop = getCorrelationData ( message );
+                w.correlationData.assign ( corr_data_req_prop->value.data.data, corr_data_req_prop->value.data.len );
+                w.hasCorrelationData = true;
+            }
+            return w;
+        }
+
+        // this is the publishing call-back that we pass to the bridge object (and subsequently to the dabClient).  It's used for notifications where we send telemetry responses without a request
+        void publishCB ( jsonElement const &elem )
+        {
+            auto &msg = scratchMessage ( true );
+
+            msg.topic = elem["topic"].operator const std::string & ();
+            msg.qos = topicQos.lookup ( msg.topic, true );
+            if ( cborNotifications )
+            {
+                elem["payload"].serializeCBOR ( msg.payload );
+                msg.cbor = true;
+            } else
+            {
+                publishTemplates.serialize ( msg.topic, elem["payload"], msg.payload );
+            }
+
+            publish ( std::move ( msg ) );
+        }
+
         static void connectionLost ( void *context, char * )
         {
             auto *mqttInterface = reinterpret_cast<dabMQTTInterface *>(context);
+            if ( mqttInterface->reconnector.connectionLost () )
+            {
+                // wait () carries on waiting while we reconnect
+                return;
+            }
             std::lock_guard l1 ( mqttInterface->runningMutex );
             mqttInterface->running.notify_all ();
         }
 
+        // connects to the broker.   The first connection starts a new session, later ones resume it if the broker still has it, in which case it also has our
+        // subscriptions and they aren't sent again
+        void establish ( bool initial )
+        {
+            MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer5;
+            conn_opts.keepAliveInterval = 20;
+            conn_opts.cleanstart = initial || !sessionExpiry.count ();
+
+            MQTTProperties connectProps = MQTTProperties_initializer;
+            if ( sessionExpiry.count () )
+            {
+                MQTTProperty expiryProp;
+                expiryProp.identifier = MQTTPROPERTY_CODE_SESSION_EXPIRY_INTERVAL;
+                expiryProp.value.integer4 = (unsigned int) std::min<int64_t> ( sessionExpiry.count (), UINT32_MAX );
+                MQTTProperties_add ( &connectProps, &expiryProp );
+            }
+
+            {
+                // aliases belong to a connection, none are used until the broker tells us how many the new one may have
+                std::lock_guard l1 ( runningMutex );
+                topicAliases.reset ( 0 );
+            }
+
+            auto response = MQTTClient_connect5 ( client, &conn_opts, &connectProps, nullptr );
+            MQTTProperties_free ( &connectProps );
+            if ( auto rc = (int) response.reasonCode )
+            {
+                MQTTResponse_free ( response );
+                throw DAB::dabException ( rc, std::string ( "Failed to set connect" ) );
+            }
+            // the broker tells us how many topic aliases it will accept in the connack
+            auto aliasMaximum = response.properties ? MQTTProperties_getNumericValue ( response.properties, MQTTPROPERTY_CODE_TOPIC_ALIAS_MAXIMUM ) : 0;
+            {
+                std::lock_guard l1 ( runningMutex );
+                topicAliases.reset ( std::max ( aliasMaximum, 0 ) );
+            }
+            MQTTResponse_free ( response );
+
+            if ( initial || !conn_opts.returned.sessionPresent )
+            {
+                subscribe ( bridge.getTopics ( wildcardSubscriptions ) );
+            }
+        }
+
     public:
 
-        dabMQTTInterface ( BRIDGE &bridge, std::string const &brokerAddress ) : bridge ( bridge )
+        dabMQTTInterface ( BRIDGE &bridge, std::string const &brokerAddress ) : bridge ( bridge ), ingress ( bridge.getMetrics () )
         {
-            if ( auto rc = MQTTClient_create(&client, brokerAddress.c_str(), "dab", MQTTCLIENT_PERSISTENCE_NONE, nullptr) )
+            // correlation data, response topics and topic aliases are MQTT 5 properties
+            MQTTClient_createOptions createOpts = MQTTClient_createOptions_initializer;
+            createOpts.MQTTVersion = MQTTVERSION_5;
+
+            if ( auto rc = MQTTClient_createWithOptions(&client, brokerAddress.c_str(), "dab", MQTTCLIENT_PERSISTENCE_NONE, nullptr, &createOpts) )
             {
                 throw DAB::dabException ( rc, std::string ( "Failed to create client" ) );
             }
@@ -178,38 +817,131 @@ namespace DAB
                 throw DAB::dabException ( rc, std::string ( "Failed to set callbacks" ) );
             }
             bridge.setPublishCallback ( std::function ( [this](jsonElement const &elem){ return publishCB ( elem );} ) );
+            // a stopped telemetry stream's topic won't be published on again
+            bridge.getTelemetryScheduler ().setRemovalObserver ( [this] ( std::string const &topic ) { publishTemplates.erase ( topic ); } );
         }
 
         ~dabMQTTInterface ()
         {
+            reconnector.stop ();
+            bridge.getTelemetryScheduler ().setRemovalObserver ( nullptr );
+            stopWorkers ();
             MQTTClient_destroy ( &client );
         }
 
-        // this is the method to actually establish a connection with the mqtt broker.  At this point any initialization that needs to be done should have finished
-        auto connect() {
-            MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
+        // number of threads used to execute requests.   Requests for the same deviceId are always executed in the order they arrived, different devices run in parallel.
+        // 0 (the default) executes requests directly on the mqtt library's callback thread.   Must be called before connect ().
+        void setWorkerThreads ( size_t numThreads )
+        {
+            numWorkers = numThreads;
+        }
 
-            conn_opts.keepAliveInterval = 20;
+        // the most requests any one device may have waiting for or running on a worker thread.  Requests beyond that are answered with a 503 "device busy"
+        // without being run, so a device that's flooded with requests only delays its own.   0 (the default) doesn't limit them.   Only applies with worker threads
+        void setDeviceQueueLimit ( size_t limit )
+        {
+            ingress.setLimit ( limit );
+        }
 
-            if ( auto rc = MQTTClient_connect(client, &conn_opts) )
-            {
-                throw DAB::dabException ( rc, std::string ( "Failed to set connect" ) );
-            }
+        // a read only request (a get or list, see dabReadOnlyOperations) identical to one already waiting or running isn't queued, it's sent the earlier request's
+        // response when that completes.   Off by default.   Only applies with worker threads
+        void setRequestCoalescing ( bool enable )
+        {
+            ingress.setCoalescing ( enable );
+        }
 
-            auto topics = bridge.getTopics ();
+        // the number of requests waiting or running for each device that has any, as { <deviceId>: <count> }
+        jsonElement getQueueDepths ()
+        {
+            return ingress.getQueueDepths ();
+        }
 
-            for ( auto const &topic : topics )
+        // opt in to per-request arena allocation.  Each thread handling requests gets an arena (starting at initialSize bytes) that holds the request and response
+        // json and is released in one shot after the response is published.   Must be called before connect ().  0 goes back to the default allocator.
+        void setArenaSize ( size_t initialSize )
+        {
+            arenaSize = initialSize;
+        }
+
+        // subscribe with a single dab/<deviceId>/# wildcard per device instead of one subscription per supported operation.  Requests for operations the device
+        // doesn't support then receive a 501 response and anything else under the device's topic is ignored.   Must be called before connect ().
+        void setWildcardSubscriptions ( bool enable )
+        {
+            wildcardSubscriptions = enable;
+        }
+
+        // the most topic aliases to use when publishing (the broker may allow fewer).  Each recurring topic, such as a telemetry topic or the response topic of a client
+        // sending regular requests, is then published as a two byte alias after its first use with an alias.  0 sends every topic in full.   Must be called before connect ().
+        void setTopicAliases ( uint16_t maximum )
+        {
+            topicAliases.setLimit ( maximum );
+        }
+
+        // the qos responses and notifications (telemetry) are published with, both 0 by default.   Must be called before connect ().
+        void setQos ( int responseQos, int notificationQos )
+        {
+            topicQos.setDefaults ( responseQos, notificationQos );
+        }
+
+        // publish anything on a topic matching filter (which may use the + and # wildcards) with qos, whether it's a response or a notification.
+        // Filters are tried in the order they were set and the first match wins.   Must be called before connect ().
+        void setTopicQos ( std::string filter, int qos )
+        {
+            topicQos.add ( std::move ( filter ), qos );
+        }
+
+        // publish notifications (telemetry) as CBOR, with the application/cbor content type, rather than json.   Responses always use the format of their request.
+        // Must be called before connect ().
+        void setCborNotifications ( bool enable )
+        {
+            cborNotifications = enable;
+        }
+
+        // publish responses of handlers returning a dabStream as a header followed by chunks of data rather than one (potentially enormous) response.
+        // dabStreamEncoding::none (the default) sends them as a single response.   With base64 the chunk size is rounded down to a multiple of 3 so the chunks concatenate into the encoding of the whole
+        void setResponseStreaming ( dabStreamEncoding encoding, size_t chunkSize = 48 * 1024 )
+        {
+            streamEncoding = encoding;
+            streamChunkSize = encoding == dabStreamEncoding::base64 ? std::max<size_t> ( chunkSize / 3 * 3, 3 ) : std::max<size_t> ( chunkSize, 1 );
+        }
+
+        // subscribe to the topics (or wildcard) of a device made after connect () was called, such as from the makeDeviceInstances ready callback.   May be called from any thread
+        void subscribeDevice ( std::string_view deviceId )
+        {
+            subscribe ( bridge.getDeviceTopics ( deviceId, wildcardSubscriptions ) );
+        }
+
+        // reconnect whenever the connection to the broker is lost, waiting a random time of up to initialDelay before the first attempt and doubling that after
+        // each failure up to maxDelay.   wait () then only returns after disconnect ().   Telemetry carries on through the outage, publishes that can't be made
+        // are dropped.  A maxDelay of 0 (the default) doesn't reconnect.   Must be called before connect ().
+        void setReconnect ( std::chrono::milliseconds initialDelay, std::chrono::milliseconds maxDelay )
+        {
+            reconnector.setBackoff ( initialDelay, maxDelay );
+        }
+
+        // ask the broker to keep our session for expiry after the connection drops.   A reconnect within that time resumes the session, with our subscriptions
+        // (and any qos 1 requests that arrived meanwhile) intact, so it's a single round trip.   0 (the default) starts afresh every time.   Must be called before connect ().
+        void setSessionExpiry ( std::chrono::seconds expiry )
+        {
+            sessionExpiry = expiry;
+        }
+
+        // this is the method to actually establish a connection with the mqtt broker.  At this point any initialization that needs to be done should have finished
+        auto connect() {
+            if ( numWorkers && !pool )
             {
-                if ( auto rc = MQTTClient_subscribe(client, topic.c_str(), 1) )
-                {
-                    throw DAB::dabException ( rc, std::string ( "Failed to subscribe" ) );
-                }
+                publisherThread = std::thread ( &dabMQTTInterface::publisherTask, this );
+                pool = std::make_unique<dabWorkerPool> ( numWorkers );
             }
+
+            establish ( true );
+            reconnector.start ( [this] { establish ( false ); } );
             return 0;
         }
         // this function should be called when the client wish's to cleanly end the mqtt interface in preparation for exiting.
         auto disconnect ()
         {
+            reconnector.stop ();
             if ( auto rc = MQTTClient_disconnect ( client, 10000 ))
             {
                 throw DAB::dabException ( rc, std::string ( "Failed to disconnect" ));
@@ -219,7 +951,7 @@ namespace DAB
             return 0;
         }
 
-        // this function will wait until the mqtt interface has been properly shut down, or errors due to connectivity loss.
+        // this function will wait until the mqtt interface has been properly shut down, or errors due to connectivity loss (that isn't being recovered, see setReconnect).
         void wait ()
         {
             std::unique_lock l1 ( runningMutex );
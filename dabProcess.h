@@ -0,0 +1,336 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <tlhelp32.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <libproc.h>
+#endif
+
+extern char **environ;
+#endif
+
+// running commands and listing processes for handlers.
+// commands are started with posix_spawn (CreateProcess on windows) rather than popen, which avoids copying the page tables of a large adapter process on every call.
+// output is read from the pipe in large chunks, and a command can be given a timeout and a limit on how much output it may produce, either of which kills it.
+
+namespace DAB
+{
+    struct dabProcessOptions
+    {
+        // 0 waits for as long as the command takes
+        std::chrono::milliseconds timeout{ 0 };
+        // the command is killed once its output exceeds this
+        size_t maxOutput = 16 * 1024 * 1024;
+    };
+
+    struct dabProcessResult
+    {
+        // the exit status of the command, -1 if it was killed by a signal
+        int exitCode = 0;
+        // everything the command wrote to stdout (up to maxOutput)
+        std::string output;
+        bool timedOut = false;
+        bool truncated = false;
+    };
+
+    struct dabProcessInfo
+    {
+        uint64_t pid;
+        std::string name;
+    };
+
+    // runs cmd through the shell and waits for it to finish.  Fails with the system error code (errno, or GetLastError () on windows) if it couldn't be started
+    inline std::expected<dabProcessResult, int> runProcess ( std::string const &cmd, dabProcessOptions const &options = {} )
+    {
+        dabProcessResult result;
+        char buff[64 * 1024];
+
+        auto deadline = std::chrono::steady_clock::now () + options.timeout;
+
+        // appends what was read, returns false once we've read all we're allowed to
+        auto append = [&] ( size_t len ) {
+            auto room = options.maxOutput - result.output.size ();
+            if ( len > room )
+            {
+                result.output.append ( buff, room );
+                result.truncated = true;
+                return false;
+            }
+            result.output.append ( buff, len );
+            return true;
+        };
+
+#ifdef _WIN32
+        SECURITY_ATTRIBUTES sa{ sizeof ( sa ), nullptr, TRUE };
+        HANDLE readPipe;
+        HANDLE writePipe;
+        if ( !CreatePipe ( &readPipe, &writePipe, &sa, 0 ) )
+        {
+            return std::unexpected ( (int) GetLastError () );
+        }
+        // only the write end is inherited by the child
+        SetHandleInformation ( readPipe, HANDLE_FLAG_INHERIT, 0 );
+
+        STARTUPINFOA si{};
+        si.cb = sizeof ( si );
+        si.dwFlags = STARTF_USESTDHANDLES;
+        si.hStdInput = GetStdHandle ( STD_INPUT_HANDLE );
+        si.hStdOutput = writePipe;
+        si.hStdError = GetStdHandle ( STD_ERROR_HANDLE );
+
+        PROCESS_INFORMATION pi{};
+        std::string cmdLine = "cmd.exe /c " + cmd;
+        if ( !CreateProcessA ( nullptr, cmdLine.data (), nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi ) )
+        {
+            auto error = (int) GetLastError ();
+            CloseHandle ( readPipe );
+            CloseHandle ( writePipe );
+            return std::unexpected ( error );
+        }
+        CloseHandle ( writePipe );
+        CloseHandle ( pi.hThread );
+
+        // anonymous pipes can't be waited on with a timeout, so the pipe is drained by a reader while we wait for the process
+        std::thread reader ( [&] {
+            DWORD len;
+            while ( ReadFile ( readPipe, buff, sizeof ( buff ), &len, nullptr ) && len )
+            {
+                if ( !append ( len ) )
+                {
+                    TerminateProcess ( pi.hProcess, 1 );
+                    break;
+                }
+            }
+        } );
+
+        if ( WaitForSingleObject ( pi.hProcess, options.timeout.count () ? (DWORD) options.timeout.count () : INFINITE ) == WAIT_TIMEOUT )
+        {
+            TerminateProcess ( pi.hProcess, 1 );
+            WaitForSingleObject ( pi.hProcess, INFINITE );
+            result.timedOut = true;
+        }
+        // anything the command started may still hold the pipe open, don't wait on it
+        CancelSynchronousIo ( reader.native_handle () );
+        reader.join ();
+
+        DWORD exitCode = 0;
+        GetExitCodeProcess ( pi.hProcess, &exitCode );
+        result.exitCode = (int) exitCode;
+
+        CloseHandle ( pi.hProcess );
+        CloseHandle ( readPipe );
+#else
+        int fds[2];
+        if ( pipe ( fds ) )
+        {
+            return std::unexpected ( errno );
+        }
+        fcntl ( fds[0], F_SETFD, FD_CLOEXEC );
+        fcntl ( fds[1], F_SETFD, FD_CLOEXEC );
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init ( &actions );
+        posix_spawn_file_actions_adddup2 ( &actions, fds[1], STDOUT_FILENO );
+
+        // the command gets its own process group so that killing it takes anything the shell started along with it
+        posix_spawnattr_t attr;
+        posix_spawnattr_init ( &attr );
+        posix_spawnattr_setflags ( &attr, POSIX_SPAWN_SETPGROUP );
+        posix_spawnattr_setpgroup ( &attr, 0 );
+
+        char const *argv[] = { "sh", "-c", cmd.c_str (), nullptr };
+        pid_t pid;
+        auto rc = posix_spawn ( &pid, "/bin/sh", &actions, &attr, const_cast<char **>(argv), environ );
+        posix_spawn_file_actions_destroy ( &actions );
+        posix_spawnattr_destroy ( &attr );
+        close ( fds[1] );
+        if ( rc )
+        {
+            close ( fds[0] );
+            return std::unexpected ( rc );
+        }
+
+        for ( ;; )
+        {
+            int wait = -1;
+            if ( options.timeout.count () )
+            {
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds> ( deadline - std::chrono::steady_clock::now () ).count ();
+                if ( remaining <= 0 )
+                {
+                    result.timedOut = true;
+                    break;
+                }
+                wait = (int) remaining;
+            }
+
+            pollfd pfd{ fds[0], POLLIN, 0 };
+            auto ready = poll ( &pfd, 1, wait );
+            if ( ready < 0 && errno == EINTR )
+            {
+                continue;
+            }
+            if ( !ready )
+            {
+                continue;       // timed out, caught at the top
+            }
+
+            auto len = read ( fds[0], buff, sizeof ( buff ) );
+            if ( len < 0 && errno == EINTR )
+            {
+                continue;
+            }
+            if ( len <= 0 || !append ( (size_t) len ) )
+            {
+                break;
+            }
+        }
+        close ( fds[0] );
+
+        // the command may have closed (or redirected) its stdout and still be running, so the timeout carries on applying once the pipe is done with
+        int status = 0;
+        pid_t waited = 0;
+        while ( !result.timedOut && !result.truncated && options.timeout.count () )
+        {
+            waited = waitpid ( pid, &status, WNOHANG );
+            if ( waited < 0 && errno == EINTR )
+            {
+                continue;
+            }
+            if ( waited )
+            {
+                break;
+            }
+            if ( std::chrono::steady_clock::now () >= deadline )
+            {
+                result.timedOut = true;
+                break;
+            }
+            std::this_thread::sleep_for ( std::min<std::chrono::steady_clock::duration> ( deadline - std::chrono::steady_clock::now (), std::chrono::milliseconds ( 10 ) ) );
+        }
+        if ( result.timedOut || result.truncated )
+        {
+            kill ( -pid, SIGKILL );
+        }
+        while ( !waited && waitpid ( pid, &status, 0 ) < 0 && errno == EINTR )
+        {
+        }
+        result.exitCode = WIFEXITED ( status ) ? WEXITSTATUS ( status ) : -1;
+#endif
+        return result;
+    }
+
+    // runProcess on a thread of its own so the caller can carry on (or run several commands at once) while the command runs
+    inline std::future<std::expected<dabProcessResult, int>> runProcessAsync ( std::string cmd, dabProcessOptions const &options = {} )
+    {
+        return std::async ( std::launch::async, [cmd = std::move ( cmd ), options] { return runProcess ( cmd, options ); } );
+    }
+
+    // the processes currently running, read directly from the system rather than by running ps or tasklist
+    inline std::vector<dabProcessInfo> listProcesses ()
+    {
+        std::vector<dabProcessInfo> processes;
+#ifdef _WIN32
+        auto snapshot = CreateToolhelp32Snapshot ( TH32CS_SNAPPROCESS, 0 );
+        if ( snapshot == INVALID_HANDLE_VALUE )
+        {
+            return processes;
+        }
+        PROCESSENTRY32W entry{};
+        entry.dwSize = sizeof ( entry );
+        for ( auto more = Process32FirstW ( snapshot, &entry ); more; more = Process32NextW ( snapshot, &entry ) )
+        {
+            char name[MAX_PATH * 3];
+            auto len = WideCharToMultiByte ( CP_UTF8, 0, entry.szExeFile, -1, name, sizeof ( name ), nullptr, nullptr );
+            if ( len > 0 )
+            {
+                processes.push_back ( { entry.th32ProcessID, std::string ( name, (size_t) len - 1 ) } );
+            }
+        }
+        CloseHandle ( snapshot );
+#elif defined ( __APPLE__ )
+        std::vector<pid_t> pids ( (size_t) std::max ( proc_listallpids ( nullptr, 0 ), 0 ) + 64 );
+        auto count = proc_listallpids ( pids.data (), (int) (pids.size () * sizeof ( pid_t )) );
+        char name[2 * MAXCOMLEN + 1];
+        for ( int loop = 0; loop < count; loop++ )
+        {
+            if ( proc_name ( pids[loop], name, sizeof ( name ) ) > 0 )
+            {
+                processes.push_back ( { (uint64_t) pids[loop], name } );
+            }
+        }
+#else
+        // linux, each process has a /proc/<pid>/comm holding its name
+        auto *dir = opendir ( "/proc" );
+        if ( !dir )
+        {
+            return processes;
+        }
+        while ( auto *entry = readdir ( dir ) )
+        {
+            char *end;
+            auto pid = strtoull ( entry->d_name, &end, 10 );
+            if ( !pid || *end )
+            {
+                continue;
+            }
+
+            char path[64];
+            snprintf ( path, sizeof ( path ), "/proc/%s/comm", entry->d_name );
+            auto fd = open ( path, O_RDONLY | O_CLOEXEC );
+            if ( fd < 0 )
+            {
+                // it's exited since we read the directory
+                continue;
+            }
+            char name[256];
+            auto len = read ( fd, name, sizeof ( name ) );
+            close ( fd );
+            if ( len > 0 )
+            {
+                processes.push_back ( { pid, std::string ( name, name[len - 1] == '\n' ? (size_t) len - 1 : (size_t) len ) } );
+            }
+        }
+        closedir ( dir );
+#endif
+        return processes;
+    }
+}
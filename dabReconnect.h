@@ -0,0 +1,151 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "dabClient.h"
+
+// reconnects the mqtt interfaces after the broker connection is lost.
+// the library tells us of the loss on its own thread, which mustn't block, so attempts are made from a thread of our own.   Attempts are spaced with
+// exponential backoff (doubling from the initial delay up to the maximum) and each delay is a random time up to that, so that a fleet of bridges losing
+// the same broker doesn't come back at it all at once.
+
+namespace DAB
+{
+    class dabReconnector
+    {
+        std::chrono::milliseconds initialDelay{ 0 };
+        std::chrono::milliseconds maxDelay{ 0 };
+
+        std::function<void ()> attempt;
+
+        std::mutex access;
+        std::condition_variable condition;
+        bool lost = false;
+        bool stopping = false;
+        std::thread worker;
+
+        void reconnectTask ()
+        {
+            std::minstd_rand rand ( std::random_device{} () );
+            std::unique_lock l1 ( access );
+            for ( ;; )
+            {
+                condition.wait ( l1, [this] { return lost || stopping; } );
+                for ( auto delay = initialDelay; !stopping; delay = std::min ( delay * 2, maxDelay ) )
+                {
+                    auto jittered = std::chrono::milliseconds ( std::uniform_int_distribution<int64_t> ( 0, delay.count () ) ( rand ) );
+                    if ( condition.wait_for ( l1, jittered, [this] { return stopping; } ) )
+                    {
+                        break;
+                    }
+
+                    // cleared beforehand so that losing the new connection straight away starts another round
+                    lost = false;
+                    l1.unlock ();
+                    bool connected = false;
+                    try
+                    {
+                        attempt ();
+                        connected = true;
+                    } catch ( DAB::dabException &e )
+                    {
+                        std::cout << "error (" << e.errorCode << "): " << e.errorText << std::endl;
+                    } catch ( ... )
+                    {
+                    }
+                    l1.lock ();
+                    if ( connected )
+                    {
+                        break;
+                    }
+                }
+                if ( stopping )
+                {
+                    return;
+                }
+            }
+        }
+
+    public:
+        ~dabReconnector ()
+        {
+            stop ();
+        }
+
+        // attempts start after a random delay of up to initial, and the delay doubles after each failure until it reaches maximum.   A zero maximum disables
+        // reconnecting.   Must be called before start ()
+        void setBackoff ( std::chrono::milliseconds initial, std::chrono::milliseconds maximum )
+        {
+            initialDelay = std::max ( initial, std::chrono::milliseconds ( 1 ) );
+            maxDelay = maximum.count () ? std::max ( maximum, initialDelay ) : maximum;
+        }
+
+        bool isEnabled () const
+        {
+            return maxDelay.count () != 0;
+        }
+
+        // reconnect calls fn, which throws a dabException if the attempt fails.   Does nothing if reconnecting is disabled or already started
+        void start ( std::function<void ()> fn )
+        {
+            std::lock_guard l1 ( access );
+            if ( !isEnabled () || worker.joinable () )
+            {
+                return;
+            }
+            attempt = std::move ( fn );
+            stopping = false;
+            lost = false;
+            worker = std::thread ( &dabReconnector::reconnectTask, this );
+        }
+
+        // the connection has been lost.   Returns false if nothing will be done about it, the caller is then on its own
+        bool connectionLost ()
+        {
+            std::lock_guard l1 ( access );
+            if ( !worker.joinable () || stopping )
+            {
+                return false;
+            }
+            lost = true;
+            condition.notify_all ();
+            return true;
+        }
+
+        // abandons any attempt in progress (once the current one has returned) and makes no more
+        void stop ()
+        {
+            {
+                std::lock_guard l1 ( access );
+                stopping = true;
+                condition.notify_all ();
+            }
+            if ( worker.joinable () && worker.get_id () != std::this_thread::get_id () )
+            {
+                worker.join ();
+            }
+        }
+    };
+}
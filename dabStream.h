@@ -0,0 +1,193 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <algorithm>
+
+#include "Json.h"
+
+// streamed responses.   A handler that returns a dabStream rather than a jsonElement has its data read a chunk at a time instead of being built up in memory.
+// interfaces that support streaming publish a header response describing the stream followed by the data in sequenced chunks.   Everywhere else the data is read in full
+// and returned base64 encoded as a data url (data:<contentType>;base64,...) in a single response value, which is what /output/image expects.
+
+namespace DAB
+{
+    // appends the base64 encoding of len bytes of data to out.  As long as len is a multiple of 3, consecutive chunks encode to the same text as the whole
+    inline void base64Encode ( char const *data, size_t len, std::string &out )
+    {
+        static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        auto start = out.size ();
+        out.resize ( start + (len + 2) / 3 * 4 );
+        auto *p = out.data () + start;
+        auto const *in = (uint8_t const *) data;
+
+        size_t loop = 0;
+        for ( ; loop + 3 <= len; loop += 3 )
+        {
+            uint32_t v = (uint32_t) in[loop] << 16 | (uint32_t) in[loop + 1] << 8 | in[loop + 2];
+            *p++ = alphabet[(v >> 18) & 0x3F];
+            *p++ = alphabet[(v >> 12) & 0x3F];
+            *p++ = alphabet[(v >> 6) & 0x3F];
+            *p++ = alphabet[v & 0x3F];
+        }
+        if ( loop < len )
+        {
+            uint32_t v = (uint32_t) in[loop] << 16 | (loop + 1 < len ? (uint32_t) in[loop + 1] << 8 : 0);
+            *p++ = alphabet[(v >> 18) & 0x3F];
+            *p++ = alphabet[(v >> 12) & 0x3F];
+            *p++ = loop + 1 < len ? alphabet[(v >> 6) & 0x3F] : '=';
+            *p++ = '=';
+        }
+    }
+
+    // how interfaces send a streamed response.  none collects the whole body into a single response
+    enum class dabStreamEncoding
+    {
+        none,
+        base64,
+        raw
+    };
+
+    class dabStream
+    {
+    public:
+        // fills up to len bytes of buff and returns the number of bytes written, 0 once there is nothing left.  May return short counts before then
+        using producer = std::function<size_t ( char *buff, size_t len )>;
+
+    private:
+        producer produce;
+        std::string contentType;
+        std::optional<size_t> totalSize;
+
+        // name of the response value the data is returned in when it isn't streamed
+        std::string fieldName = "outputImage";
+
+    public:
+        dabStream ( producer generator, std::string contentType, std::optional<size_t> size = {} ) : produce ( std::move ( generator ) ), contentType ( std::move ( contentType ) ), totalSize ( size )
+        {
+        }
+
+        // streams a file from disk
+        static dabStream fromFile ( std::string const &path, std::string contentType )
+        {
+            std::shared_ptr<FILE> file ( fopen ( path.c_str (), "rb" ), [] ( FILE *f ) { if ( f ) fclose ( f ); } );
+            if ( !file )
+            {
+                throw std::pair<int, std::string> ( 500, std::string ( "unable to open \"" ) + path + "\"" );
+            }
+
+            std::optional<size_t> size;
+            if ( !fseek ( file.get (), 0, SEEK_END ) )
+            {
+                if ( auto end = ftell ( file.get () ); end >= 0 )
+                {
+                    size = (size_t) end;
+                }
+                rewind ( file.get () );
+            }
+
+            return { [file] ( char *buff, size_t len ) { return fread ( buff, 1, len, file.get () ); }, std::move ( contentType ), size };
+        }
+
+        // streams len bytes of already mapped memory (for instance an mmap'd file or a frame buffer).  owner keeps the memory alive until the stream is done with it, its deleter can unmap it
+        static dabStream fromMemory ( std::shared_ptr<void const> owner, size_t len, std::string contentType )
+        {
+            size_t pos = 0;
+            return { [owner = std::move ( owner ), len, pos] ( char *buff, size_t bufLen ) mutable {
+                auto count = std::min ( bufLen, len - pos );
+                memcpy ( buff, (char const *) owner.get () + pos, count );
+                pos += count;
+                return count;
+            }, std::move ( contentType ), len };
+        }
+
+        // set the name of the response value that carries the data when it isn't streamed
+        dabStream &setField ( std::string name )
+        {
+            fieldName = std::move ( name );
+            return *this;
+        }
+
+        std::optional<size_t> size () const
+        {
+            return totalSize;
+        }
+
+        // fills buff completely unless the data runs out, returning the number of bytes read
+        size_t read ( char *buff, size_t len )
+        {
+            size_t count = 0;
+            while ( count < len )
+            {
+                auto got = produce ( buff + count, len - count );
+                if ( !got )
+                {
+                    break;
+                }
+                count += got;
+            }
+            return count;
+        }
+
+        // the response sent ahead of the chunks
+        jsonElement header () const
+        {
+            jsonElement rsp;
+            auto &desc = rsp["stream"];
+            desc["field"] = fieldName;
+            desc["contentType"] = contentType;
+            if ( totalSize )
+            {
+                desc["size"] = (int64_t) *totalSize;
+            }
+            return rsp;
+        }
+
+        // reads everything and returns it as a single response
+        jsonElement collect ()
+        {
+            std::string data = "data:" + contentType + ";base64,";
+            if ( totalSize )
+            {
+                data.reserve ( data.size () + (*totalSize + 2) / 3 * 4 );
+            }
+
+            char buff[3 * 4096];
+            for ( ;; )
+            {
+                auto len = read ( buff, sizeof ( buff ) );
+                base64Encode ( buff, len, data );
+                if ( len < sizeof ( buff ) )
+                {
+                    break;
+                }
+            }
+
+            jsonElement rsp;
+            rsp[std::string_view ( fieldName )] = std::move ( data );
+            return rsp;
+        }
+    };
+}
@@ -0,0 +1,680 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <optional>
+
+#include "Json.h"
+#include "dabWorkerPool.h"
+
+// the telemetry scheduler is shared by every dabClient (a dabBridge owns one for all of its devices, clients used outside of a bridge share a process wide default).
+// a single thread tracks when each active telemetry stream is next due and hands the collection off to a small pool of workers.  Thread count and memory therefore
+// scale with the number of active streams rather than the number of devices.   Collections for different streams overlap, a single stream never has more than one running.
+// collected telemetry is queued for a dedicated publisher thread, so neither the scheduler nor a collector waits on the transport and no lock is held while user code runs.
+// the publisher can optionally coalesce samples, publishing everything collected over a window as one message per device (or one for the whole scheduler)
+// rather than one message per sample.
+
+namespace DAB
+{
+    class dabTelemetryScheduler
+    {
+    public:
+        using clock = std::chrono::steady_clock;
+        using collector = std::function<jsonElement ()>;
+        using publisher = std::function<void ( jsonElement const & )>;
+        // told the topic of each stream as it's removed
+        using removalObserver = std::function<void ( std::string const & )>;
+
+        // what to do when a stream misses one or more deadlines (the scheduler woke late, or the previous collection was still running)
+        //      skip    -   the missed firings are dropped and the stream carries on at its next deadline
+        //      catchUp -   the missed firings (up to maxCatchUp of them) are run back to back as soon as possible
+        // either way deadlines stay on the stream's original grid of start + n * interval, so they never drift
+        enum class latePolicy
+        {
+            skip,
+            catchUp
+        };
+
+        // how batched samples are grouped, see setBatching
+        //      device  -   a batch per device, published on dab/<deviceId>/telemetry-batch
+        //      bridge  -   a single batch for every stream, published on dab/adapter/telemetry-batch
+        enum class batchScope
+        {
+            device,
+            bridge
+        };
+
+        // a collection starting this far past its deadline is counted as late
+        constexpr static auto LATE_THRESHOLD = std::chrono::milliseconds ( 1 );
+
+    private:
+        struct stream;
+
+        // keyed by the time the stream is next due.  a multimap as streams across many devices are bound to come due at the same instant
+        using scheduleType = std::multimap<clock::time_point, std::shared_ptr<stream>>;
+
+        // a single telemetry stream.   These are shared with any worker that is currently running its callback so that removing a stream never has to wait for one
+        struct stream
+        {
+            void const *owner;                      // the client that registered the stream
+            std::string key;                        // the owning deviceId
+            std::string id;                         // appId for application telemetry, empty for device telemetry
+            std::string topic;                      // topic to publish on
+            std::chrono::milliseconds interval;
+            collector collect;
+            publisher publish;
+
+            // all guarded by the scheduler's access mutex
+            bool active = true;
+            bool inFlight = false;
+            size_t owed = 0;                        // catchUp firings waiting for the current collection to complete
+            size_t running = 0;                     // collections (including abandoned ones) and publishes outstanding that reference this stream
+            uint64_t generation = 0;                // bumped when a collection is abandoned so that its result, if it ever arrives, is dropped
+            std::string poolKey;                    // key we submit under, changed along with generation so new collections don't queue behind an abandoned one
+            clock::time_point collectionStart{};
+            clock::time_point lastDeadline{};
+            scheduleType::iterator position{};      // our node in schedule, kept up to date whenever we're rescheduled
+
+            // statistics, also guarded by access
+            uint64_t firings = 0;
+            uint64_t lateFirings = 0;
+            uint64_t skipped = 0;
+            uint64_t timeouts = 0;
+            clock::duration maxLateness{};
+            clock::duration lastDuration{};
+            clock::duration maxDuration{};
+        };
+
+        std::mutex access;
+        std::condition_variable condition;          // wakes the scheduler thread when the schedule changes
+        std::condition_variable idleCondition;      // signalled whenever a stream's running count drops
+
+        scheduleType schedule;
+
+        // index of every scheduled stream by owner and then id so that add/remove never have to scan the schedule
+        std::map<void const *, std::map<std::string, std::shared_ptr<stream>, std::less<>>> index;
+
+        size_t numWorkers;
+        latePolicy policy = latePolicy::skip;
+        size_t maxCatchUp = 5;
+        std::chrono::milliseconds collectionTimeout{ 0 };
+        std::unique_ptr<dabWorkerPool> pool;
+        std::thread schedulerThread;
+        bool exiting = false;
+
+        // guarded by observerAccess rather than access, so clearing it waits for a call that's in progress
+        std::mutex observerAccess;
+        removalObserver onRemoval;
+
+        void notifyRemoved ( std::vector<std::string> const &topics )
+        {
+            std::lock_guard l1 ( observerAccess );
+            if ( onRemoval )
+            {
+                for ( auto const &topic : topics )
+                {
+                    onRemoval ( topic );
+                }
+            }
+        }
+
+        // collected telemetry waiting to be published, guarded by access
+        std::deque<std::pair<std::shared_ptr<stream>, jsonElement>> publishQueue;
+        std::condition_variable publishCondition;
+        std::thread publisherThread;
+
+        // samples being coalesced by the publisher, keyed by deviceId ("" for bridge scope).   Each sample holds a running count on its stream until it's published or dropped.
+        // guarded by access, but only ever changed by the publisher thread
+        struct batch
+        {
+            clock::time_point due;                  // the first sample's arrival plus the batch window
+            std::vector<std::pair<std::shared_ptr<stream>, jsonElement>> samples;
+        };
+        using batchMap = std::map<std::string, batch, std::less<>>;
+
+        std::chrono::milliseconds batchWindow{ 0 };     // 0 publishes every sample on its own
+        size_t batchLimit = 0;                          // a batch is published early once it holds this many samples, 0 for no limit
+        batchScope scope = batchScope::device;
+        batchMap batches;
+        bool purgeBatches = false;                      // a stream has been removed, its samples are to be dropped from the batches
+
+        // the threads and the pool are only started once the first stream is added
+        void start ()
+        {
+            if ( !schedulerThread.joinable () )
+            {
+                pool = std::make_unique<dabWorkerPool> ( numWorkers ? numWorkers : 1 );
+                schedulerThread = std::thread ( &dabTelemetryScheduler::schedulerTask, this );
+                publisherThread = std::thread ( &dabTelemetryScheduler::publisherTask, this );
+            }
+        }
+
+        static std::string makePoolKey ( stream const &s )
+        {
+            return s.key + "/" + s.id + "#" + std::to_string ( s.generation );
+        }
+
+        // called with access held
+        void release ( stream &s )
+        {
+            s.running--;
+            idleCondition.notify_all ();
+        }
+
+        void submit ( std::shared_ptr<stream> const &s, clock::time_point deadline )
+        {
+            s->inFlight = true;
+            s->running++;
+            s->collectionStart = clock::now ();
+            pool->submit ( s->poolKey, [this, s = s, deadline, generation = s->generation] () { run ( s, deadline, generation ); } );
+        }
+
+        void schedulerTask ()
+        {
+            std::unique_lock l1 ( access );
+            while ( !exiting )
+            {
+                if ( schedule.empty () )
+                {
+                    // nothing to schedule so just wait until our condition variable gets notified
+                    condition.wait ( l1 );
+                } else
+                {
+                    // wait until either something is added, removed or we're exiting, or until our next scheduled telemetry is due.  The deadline is
+                    // copied, wait_until holds on to it and remove () may free the entry while we wait
+                    auto due = schedule.begin ()->first;
+                    condition.wait_until ( l1, due );
+                }
+                auto now = clock::now ();
+                while ( !exiting && !schedule.empty () && schedule.begin ()->first <= now )
+                {
+                    // extract the node entry, calculate a new key value (execution time) and reinsert (no reallocation or copying, just some pointer manipulation)
+                    auto nodeHandle = schedule.extract ( schedule.begin () );
+                    auto &s = nodeHandle.mapped ();
+                    auto deadline = nodeHandle.key ();
+
+                    if ( s->inFlight && collectionTimeout.count () && now - s->collectionStart >= collectionTimeout )
+                    {
+                        // the collection has been running too long, abandon it.   it can't be interrupted, but whatever it returns will be dropped and
+                        // further collections go ahead (under a new pool key, so they don't queue up behind it) without waiting for it
+                        s->timeouts++;
+                        s->generation++;
+                        s->poolKey = makePoolKey ( *s );
+                        s->inFlight = false;
+                        s->owed = 0;
+                    }
+
+                    if ( !s->inFlight )
+                    {
+                        submit ( s, deadline );
+                    } else if ( policy == latePolicy::catchUp && s->owed < maxCatchUp )
+                    {
+                        // the worker running the current collection will run this one as soon as it's done
+                        s->owed++;
+                    } else
+                    {
+                        s->skipped++;
+                    }
+
+                    // the next deadline is always relative to this one, not to when we actually got around to it, so the stream doesn't drift
+                    s->lastDeadline = deadline;
+                    auto next = deadline + s->interval;
+                    if ( next <= now && policy == latePolicy::skip )
+                    {
+                        // we've missed one or more deadlines entirely, skip to the first one still in the future
+                        auto missed = (now - deadline) / s->interval;
+                        s->skipped += missed;
+                        next = deadline + (missed + 1) * s->interval;
+                    }
+                    nodeHandle.key () = next;
+                    s->position = schedule.insert ( std::move ( nodeHandle ) );
+                }
+            }
+        }
+
+        // runs on a pool worker, collects the telemetry and queues it for the publisher.   The lock is only held while updating the stream's state
+        void run ( std::shared_ptr<stream> const &s, clock::time_point deadline, uint64_t generation )
+        {
+            std::unique_lock l1 ( access );
+            for ( ;; )
+            {
+                if ( !s->active || s->generation != generation )
+                {
+                    break;
+                }
+
+                auto start = clock::now ();
+                auto lateness = start - deadline;
+                s->firings++;
+                if ( lateness >= LATE_THRESHOLD )
+                {
+                    s->lateFirings++;
+                }
+                s->maxLateness = std::max ( s->maxLateness, lateness );
+                s->collectionStart = start;
+
+                l1.unlock ();
+                std::optional<jsonElement> rsp;
+                try
+                {
+                    // get the telemetry data (calling the callback passed in when the stream was added)
+                    rsp = s->collect ();
+                } catch ( ... )
+                {
+                }
+                auto duration = clock::now () - start;
+                l1.lock ();
+
+                if ( s->generation != generation )
+                {
+                    // we were abandoned while collecting, drop the result
+                    break;
+                }
+
+                s->lastDuration = duration;
+                s->maxDuration = std::max ( s->maxDuration, duration );
+
+                if ( rsp && s->active )
+                {
+                    s->running++;
+                    publishQueue.emplace_back ( s, std::move ( *rsp ) );
+                    publishCondition.notify_one ();
+                }
+
+                if ( !s->owed )
+                {
+                    break;
+                }
+                // a firing we owe from while we were busy
+                s->owed--;
+                deadline += s->interval;
+            }
+            if ( s->generation == generation )
+            {
+                s->inFlight = false;
+                s->owed = 0;
+            }
+            release ( *s );
+        }
+
+        // publishes one of our samples.  Called without access held
+        static void publishSample ( stream const &s, jsonElement &&rsp )
+        {
+            try
+            {
+                // call the publish callback to send the telemetry data to any subscribers
+                s.publish ( { { "topic", s.topic }, { "payload", std::move ( rsp ) } } );
+            } catch ( ... )
+            {
+            }
+        }
+
+        std::string batchKey ( stream const &s ) const
+        {
+            return scope == batchScope::device ? s.key : std::string{};
+        }
+
+        static std::string batchTopic ( std::string_view key )
+        {
+            return key.empty () ? std::string ( "dab/adapter/telemetry-batch" ) : "dab/" + std::string ( key ) + "/telemetry-batch";
+        }
+
+        // called with access held (and returns with it held), drops the samples of streams that have been removed
+        void purge ()
+        {
+            purgeBatches = false;
+            for ( auto it = batches.begin (); it != batches.end (); )
+            {
+                auto &samples = it->second.samples;
+                auto removed = std::remove_if ( samples.begin (), samples.end (), [] ( auto const &sample ) { return !sample.first->active; } );
+                for ( auto sample = removed; sample != samples.end (); sample++ )
+                {
+                    release ( *sample->first );
+                }
+                samples.erase ( removed, samples.end () );
+                it = samples.empty () ? batches.erase ( it ) : std::next ( it );
+            }
+        }
+
+        // publishes a batch as a single message whose payload has a member per stream topic holding that stream's samples in the order they were collected.   It goes
+        // out through the first sample's publish callback (a bridge's streams all share one).   Called with access held, which is released while publishing
+        void flush ( std::unique_lock<std::mutex> &l1, batchMap::iterator it )
+        {
+            auto node = batches.extract ( it );
+            auto &samples = node.mapped ().samples;
+
+            jsonElement payload;
+            payload.makeObject ();
+            stream const *via = nullptr;
+            for ( auto &[s, rsp] : samples )
+            {
+                if ( s->active )
+                {
+                    auto &series = payload[std::string_view ( s->topic )];
+                    if ( !series.isArray () )
+                    {
+                        series.makeArray ();
+                    }
+                    series.push_back ( std::move ( rsp ) );
+                    via = via ? via : s.get ();
+                }
+            }
+
+            if ( via )
+            {
+                l1.unlock ();
+                try
+                {
+                    via->publish ( { { "topic", batchTopic ( node.key () ) }, { "payload", std::move ( payload ) } } );
+                } catch ( ... )
+                {
+                }
+                l1.lock ();
+            }
+            for ( auto &sample : samples )
+            {
+                release ( *sample.first );
+            }
+        }
+
+        // publishes collected telemetry in the order it was collected, or if batching adds it to its batch
+        void publisherTask ()
+        {
+            std::unique_lock l1 ( access );
+            for ( ;; )
+            {
+                auto ready = [this] { return !publishQueue.empty () || exiting || purgeBatches; };
+                if ( batches.empty () )
+                {
+                    publishCondition.wait ( l1, ready );
+                } else
+                {
+                    // wait_until holds on to the deadline, so it's copied out of the batch a flush may destroy
+                    auto due = std::min_element ( batches.begin (), batches.end (), [] ( auto const &a, auto const &b ) { return a.second.due < b.second.due; } )->second.due;
+                    publishCondition.wait_until ( l1, due, ready );
+                }
+
+                if ( purgeBatches || exiting )
+                {
+                    purge ();
+                }
+
+                if ( !publishQueue.empty () )
+                {
+                    auto [s, rsp] = std::move ( publishQueue.front () );
+                    publishQueue.pop_front ();
+
+                    if ( !s->active )
+                    {
+                        // a stream that has been stopped publishes nothing further
+                        release ( *s );
+                    } else if ( batchWindow.count () )
+                    {
+                        auto it = batches.try_emplace ( batchKey ( *s ) ).first;
+                        if ( it->second.samples.empty () )
+                        {
+                            it->second.due = clock::now () + batchWindow;
+                        }
+                        it->second.samples.emplace_back ( std::move ( s ), std::move ( rsp ) );
+                        if ( batchLimit && it->second.samples.size () >= batchLimit )
+                        {
+                            flush ( l1, it );
+                        }
+                    } else
+                    {
+                        l1.unlock ();
+                        publishSample ( *s, std::move ( rsp ) );
+                        l1.lock ();
+                        release ( *s );
+                    }
+                } else if ( exiting )
+                {
+                    return;
+                }
+
+                // anything whose window has closed, even while the queue is busy.   Only this thread touches batches, so next survives flush unlocking
+                auto now = clock::now ();
+                for ( auto it = batches.begin (); it != batches.end (); )
+                {
+                    auto next = std::next ( it );
+                    if ( it->second.due <= now )
+                    {
+                        flush ( l1, it );
+                    }
+                    it = next;
+                }
+            }
+        }
+
+    public:
+
+        explicit dabTelemetryScheduler ( size_t numWorkers = 2 ) : numWorkers ( numWorkers )
+        {
+        }
+
+        ~dabTelemetryScheduler ()
+        {
+            {
+                std::lock_guard l1 ( access );
+                exiting = true;
+                for ( auto &it: schedule )
+                {
+                    it.second->active = false;
+                }
+                schedule.clear ();
+                index.clear ();
+            }
+            condition.notify_all ();
+            publishCondition.notify_all ();
+            if ( schedulerThread.joinable () )
+            {
+                schedulerThread.join ();
+            }
+            // waits for anything still in flight, which will see its stream is no longer active and return
+            pool.reset ();
+            if ( publisherThread.joinable () )
+            {
+                publisherThread.join ();
+            }
+        }
+
+        dabTelemetryScheduler ( dabTelemetryScheduler const & ) = delete;
+        dabTelemetryScheduler &operator = ( dabTelemetryScheduler const & ) = delete;
+
+        // scheduler used by clients that haven't been given one (e.g. those not created through a dabBridge)
+        static dabTelemetryScheduler &getDefault ()
+        {
+            static dabTelemetryScheduler scheduler;
+            return scheduler;
+        }
+
+        // sets how a stream that has missed deadlines behaves, see latePolicy.
+        void setLatePolicy ( latePolicy newPolicy, size_t newMaxCatchUp = 5 )
+        {
+            std::lock_guard l1 ( access );
+            policy = newPolicy;
+            maxCatchUp = newMaxCatchUp;
+        }
+
+        // collections running longer than timeout are abandoned, their result is dropped and the stream's next collection goes ahead without waiting for them.
+        // 0 (the default) never abandons a collection.   Note an abandoned collection still occupies a worker until it returns.
+        void setCollectionTimeout ( std::chrono::milliseconds timeout )
+        {
+            std::lock_guard l1 ( access );
+            collectionTimeout = timeout;
+        }
+
+        // coalesce samples, publishing all those collected over window as a single message (see flush) grouped by scope.  A batch goes out early once it holds
+        // maxSamples samples (0 for no limit).   A window of 0 (the default) publishes every sample on its own topic as it's collected.
+        void setBatching ( std::chrono::milliseconds window, size_t maxSamples = 0, batchScope newScope = batchScope::device )
+        {
+            std::lock_guard l1 ( access );
+            batchWindow = window;
+            batchLimit = maxSamples;
+            scope = newScope;
+        }
+
+        // returns an array with the timing statistics of every active stream
+        jsonElement getStatistics ()
+        {
+            auto toUs = [] ( clock::duration d ) { return (int64_t) std::chrono::duration_cast<std::chrono::microseconds> ( d ).count (); };
+
+            std::lock_guard l1 ( access );
+
+            jsonElement streams;
+            streams.makeArray ();
+            for ( auto const &[owner, owned] : index )
+            {
+                for ( auto const &[id, s] : owned )
+                {
+                    streams.push_back ( {
+                                            { "deviceId", s->key },
+                                            { "topic", s->topic },
+                                            { "intervalMs", (int64_t) s->interval.count () },
+                                            { "firings", (int64_t) s->firings },
+                                            { "lateFirings", (int64_t) s->lateFirings },
+                                            { "skipped", (int64_t) s->skipped },
+                                            { "timeouts", (int64_t) s->timeouts },
+                                            { "maxLatenessUs", toUs ( s->maxLateness ) },
+                                            { "lastCallbackUs", toUs ( s->lastDuration ) },
+                                            { "maxCallbackUs", toUs ( s->maxDuration ) }
+                                        } );
+                }
+            }
+            return streams;
+        }
+
+        // number of threads used to run telemetry callbacks.   Only has effect if called before the first stream is added.
+        void setWorkerThreads ( size_t numThreads )
+        {
+            std::lock_guard l1 ( access );
+            numWorkers = numThreads;
+        }
+
+        // add a telemetry stream, the first collection is done after firstDelay (immediately by default) and its deadlines follow on from there.  If the owner
+        // already has a stream with this id its interval is updated instead and it is rescheduled to the new interval after its last deadline (or now, if that's already passed)
+        void add ( void const *owner, std::string const &key, std::string const &id, std::string const &topic, std::chrono::milliseconds interval, collector collect, publisher publish,
+                   std::chrono::milliseconds firstDelay = std::chrono::milliseconds ( 0 ) )
+        {
+            std::lock_guard l1 ( access );
+
+            auto &owned = index[owner];
+            if ( auto it = owned.find ( id ); it != owned.end () )
+            {
+                auto &s = it->second;
+                s->interval = interval;
+
+                auto nodeHandle = schedule.extract ( s->position );
+                nodeHandle.key () = std::max ( s->lastDeadline + interval, clock::now () );
+                s->position = schedule.insert ( std::move ( nodeHandle ) );
+                condition.notify_all ();
+                return;
+            }
+
+            auto s = std::make_shared<stream> ( owner, key, id, topic, interval, std::move ( collect ), std::move ( publish ) );
+            s->poolKey = makePoolKey ( *s );
+            s->position = schedule.insert ( { clock::now () + firstDelay, s } );
+            owned.emplace ( id, std::move ( s ) );
+            start ();
+            condition.notify_all ();
+        }
+
+        // called with the topic of every stream removed from now on, outside of any of our locks.   Once this returns the previous observer is no longer being called
+        void setRemovalObserver ( removalObserver observer )
+        {
+            std::lock_guard l1 ( observerAccess );
+            onRemoval = std::move ( observer );
+        }
+
+        // pretty self-explanatory, if it exists delete it.   This does not wait for a callback that is currently running
+        void remove ( void const *owner, std::string const &id )
+        {
+            std::unique_lock l1 ( access );
+
+            auto ownerIt = index.find ( owner );
+            if ( ownerIt == index.end () )
+            {
+                return;
+            }
+            if ( auto it = ownerIt->second.find ( id ); it != ownerIt->second.end () )
+            {
+                std::vector<std::string> topics{ it->second->topic };
+                it->second->active = false;
+                schedule.erase ( it->second->position );
+                ownerIt->second.erase ( it );
+                if ( ownerIt->second.empty () )
+                {
+                    index.erase ( ownerIt );
+                }
+                purgeBatches = !batches.empty ();
+                condition.notify_all ();
+                publishCondition.notify_one ();
+                l1.unlock ();
+                notifyRemoved ( topics );
+            }
+        }
+
+        // removes every stream belonging to owner and waits for any of their callbacks that are running, abandoned or not, and any queued publishes to complete.
+        // Used when a client is destroyed, as those all reference it
+        void removeAll ( void const *owner )
+        {
+            std::unique_lock l1 ( access );
+
+            std::vector<std::shared_ptr<stream>> removed;
+            std::vector<std::string> topics;
+            if ( auto ownerIt = index.find ( owner ); ownerIt != index.end () )
+            {
+                for ( auto &[id, s] : ownerIt->second )
+                {
+                    topics.push_back ( s->topic );
+                    s->active = false;
+                    schedule.erase ( s->position );
+                    removed.push_back ( std::move ( s ) );
+                }
+                index.erase ( ownerIt );
+            }
+            // any of their samples waiting in a batch are dropped rather than waiting for the batch to be published
+            purgeBatches = !batches.empty ();
+            condition.notify_all ();
+            publishCondition.notify_one ();
+
+            idleCondition.wait ( l1, [&removed] {
+                for ( auto &s: removed )
+                {
+                    if ( s->running )
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            } );
+            l1.unlock ();
+            notifyRemoved ( topics );
+        }
+    };
+}
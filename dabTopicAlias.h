@@ -0,0 +1,128 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+// MQTT 5 topic aliases for the topics we publish on.
+// the first publish on a topic that has been given an alias carries both the topic and the alias, which tells the broker what the alias stands for; every publish
+// after that carries only the two byte alias.   Aliases belong to a connection, so the table is reset with the broker's Topic Alias Maximum on each connect.
+// only topics that recur get one: the broker allows a limited number and a response topic used for a single request would waste it.
+
+namespace DAB
+{
+    class dabTopicAliases
+    {
+        struct stringHash
+        {
+            using is_transparent = void;
+            size_t operator () ( std::string_view str ) const
+            {
+                return std::hash<std::string_view>{} ( str );
+            }
+        };
+
+        // topics published on once so far.  Cleared when it reaches this size, so a stream of one-off response topics can't grow it without bound
+        constexpr static size_t MAX_SEEN = 4096;
+
+        std::mutex access;
+        uint16_t limit;
+        uint16_t maximum = 0;
+        // topic -> its alias, and whether the broker has been told it
+        std::unordered_map<std::string, std::pair<uint16_t, bool>, stringHash, std::equal_to<>> aliases;
+        std::unordered_set<std::string, stringHash, std::equal_to<>> seenOnce;
+
+    public:
+        struct alias
+        {
+            // 0 if the topic has no alias
+            uint16_t value = 0;
+            // the broker already knows the alias, so the topic can be left out
+            bool established = false;
+        };
+
+        // limit caps how many aliases we'll use whatever the broker allows.  0 disables them
+        explicit dabTopicAliases ( uint16_t limit = 64 ) : limit ( limit )
+        {
+        }
+
+        void setLimit ( uint16_t newLimit )
+        {
+            std::lock_guard l1 ( access );
+            limit = newLimit;
+        }
+
+        // a new connection.   brokerMaximum is the Topic Alias Maximum from the connack, 0 (or absent) if the broker doesn't accept aliases
+        void reset ( int brokerMaximum )
+        {
+            std::lock_guard l1 ( access );
+            maximum = (uint16_t) std::clamp<int> ( brokerMaximum, 0, limit );
+            aliases.clear ();
+            seenOnce.clear ();
+        }
+
+        // the alias to publish topic with.  The caller must hand the publish to the mqtt library before anyone else looks up the same topic, as once an alias
+        // has been returned for the first time every later lookup assumes the broker has it
+        alias lookup ( std::string_view topic )
+        {
+            std::lock_guard l1 ( access );
+            if ( !maximum || topic.empty () )
+            {
+                return {};
+            }
+            if ( auto it = aliases.find ( topic ); it != aliases.end () )
+            {
+                alias rsp{ it->second.first, it->second.second };
+                it->second.second = true;
+                return rsp;
+            }
+            if ( aliases.size () >= maximum )
+            {
+                return {};
+            }
+            if ( auto it = seenOnce.find ( topic ); it != seenOnce.end () )
+            {
+                // second time round, it's recurring
+                seenOnce.erase ( it );
+                auto value = (uint16_t) (aliases.size () + 1);
+                aliases.emplace ( std::string ( topic ), std::pair ( value, true ) );
+                return { value, false };
+            }
+            if ( seenOnce.size () >= MAX_SEEN )
+            {
+                seenOnce.clear ();
+            }
+            seenOnce.emplace ( topic );
+            return {};
+        }
+
+        // the publish that was to establish topic's alias failed, so the broker may not know it.   The next publish on the topic sends the topic along with the alias again
+        void failed ( std::string_view topic )
+        {
+            std::lock_guard l1 ( access );
+            if ( auto it = aliases.find ( topic ); it != aliases.end () )
+            {
+                it->second.second = false;
+            }
+        }
+    };
+}
@@ -0,0 +1,97 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// the qos each message we publish goes out with.   Responses and notifications each have a default, and topic filters (using the usual mqtt + and # wildcards)
+// override it for the topics they match, so for instance control responses can be acknowledged at qos 1 while bulk telemetry stays at qos 0.
+// the table is only changed before connecting, lookups are made from every publishing thread without locking
+
+namespace DAB
+{
+    class dabTopicQos
+    {
+        int responseQos = 0;
+        int notificationQos = 0;
+        std::vector<std::pair<std::string, int>> filters;
+
+        static int validQos ( int qos )
+        {
+            return std::clamp ( qos, 0, 2 );
+        }
+
+    public:
+        // true if topic matches the mqtt topic filter
+        static bool matches ( std::string_view filter, std::string_view topic )
+        {
+            for ( ;; )
+            {
+                auto filterEnd = filter.find ( '/' );
+                auto level = filter.substr ( 0, filterEnd );
+                if ( level == "#" )
+                {
+                    return true;
+                }
+                auto topicEnd = topic.find ( '/' );
+                if ( level != "+" && level != topic.substr ( 0, topicEnd ) )
+                {
+                    return false;
+                }
+                if ( filterEnd == std::string_view::npos || topicEnd == std::string_view::npos )
+                {
+                    // both must run out together.   "a/#" also matches "a"
+                    return filterEnd == topicEnd || (topicEnd == std::string_view::npos && filter.substr ( filterEnd + 1 ) == "#");
+                }
+                filter.remove_prefix ( filterEnd + 1 );
+                topic.remove_prefix ( topicEnd + 1 );
+            }
+        }
+
+        void setDefaults ( int response, int notification )
+        {
+            responseQos = validQos ( response );
+            notificationQos = validQos ( notification );
+        }
+
+        // messages published on topics matching filter go out with qos.   Filters are tried in the order they were added, the first to match is used
+        void add ( std::string filter, int qos )
+        {
+            filters.emplace_back ( std::move ( filter ), validQos ( qos ) );
+        }
+
+        void clear ()
+        {
+            filters.clear ();
+        }
+
+        int lookup ( std::string_view topic, bool notification ) const
+        {
+            for ( auto const &[filter, qos] : filters )
+            {
+                if ( matches ( filter, topic ) )
+                {
+                    return qos;
+                }
+            }
+            return notification ? notificationQos : responseQos;
+        }
+    };
+}
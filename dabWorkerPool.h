@@ -0,0 +1,240 @@
+/**
+ Copyright 2023 Amazon.com, Inc. or its affiliates.
+ Copyright 2023 Netflix Inc.
+ Copyright 2023 Google LLC
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ http://www.apache.org/licenses/LICENSE-2.0
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// a small work-stealing thread pool used to execute requests.
+// jobs are submitted against a key (the deviceId).  Jobs with the same key run one at a time in submission order, jobs with different keys run in parallel.
+// each worker owns a deque of keys that have work ready.  A worker services its own deque from the front (oldest first) and, when that runs dry, steals from the back of the others.
+
+namespace DAB
+{
+    // transparent hash so unordered_map's keyed by std::string can be searched with a string_view without building a key
+    struct dabStringHash
+    {
+        using is_transparent = void;
+
+        size_t operator () ( std::string_view str ) const noexcept
+        {
+            return std::hash<std::string_view>{} ( str );
+        }
+    };
+
+    class dabWorkerPool
+    {
+    public:
+        using job = std::move_only_function<void ()>;
+
+    private:
+        // the pending jobs for a single key.   A key is only present in keys while it has work, during which time it is either sitting in exactly one
+        // ready deque or being run by a worker, so a key is only ever being serviced by one worker
+        struct keyQueue
+        {
+            std::deque<job> jobs;
+            std::string_view name;      // our key in keys so we can remove ourselves once we run dry
+        };
+
+        struct worker
+        {
+            std::mutex access;
+            std::deque<keyQueue *> ready;
+            std::thread thread;
+        };
+
+        // guards keys and the jobs of every keyQueue
+        std::mutex keysAccess;
+        std::unordered_map<std::string, keyQueue, dabStringHash, std::equal_to<>> keys;
+
+        std::vector<std::unique_ptr<worker>> workers;
+
+        // number of keyQueues sitting in ready deques across all workers.  a worker that decrements this is guaranteed to find one
+        std::mutex idleAccess;
+        std::condition_variable idleCondition;
+        size_t readyCount = 0;
+        bool exiting = false;
+
+        // round robin for distribution of newly readied keys from submit ()
+        size_t nextWorker = 0;
+
+        // ready deques are serviced oldest first by their owner so that no key can be starved by a stream of newly readied ones
+        void makeReady ( size_t workerNum, keyQueue *queue )
+        {
+            {
+                std::lock_guard l1 ( workers[workerNum]->access );
+                workers[workerNum]->ready.push_back ( queue );
+            }
+            {
+                std::lock_guard l1 ( idleAccess );
+                readyCount++;
+            }
+            idleCondition.notify_one ();
+        }
+
+        // pull a key off our own deque, or steal one from another worker
+        keyQueue *getReady ( size_t workerNum )
+        {
+            for ( ;; )
+            {
+                for ( size_t loop = 0; loop < workers.size (); loop++ )
+                {
+                    auto &w = *workers[(workerNum + loop) % workers.size ()];
+                    std::lock_guard l1 ( w.access );
+                    if ( !w.ready.empty () )
+                    {
+                        keyQueue *queue;
+                        if ( !loop )
+                        {
+                            queue = w.ready.front ();
+                            w.ready.pop_front ();
+                        } else
+                        {
+                            queue = w.ready.back ();
+                            w.ready.pop_back ();
+                        }
+                        return queue;
+                    }
+                }
+                // another worker took the entry we reserved out from under our scan.  There's still one out there for us, go round again
+                std::this_thread::yield ();
+            }
+        }
+
+        void workerTask ( size_t workerNum )
+        {
+            for ( ;; )
+            {
+                {
+                    std::unique_lock l1 ( idleAccess );
+                    idleCondition.wait ( l1, [this] { return readyCount || exiting; } );
+                    if ( !readyCount )
+                    {
+                        // we only exit once everything queued has been run
+                        return;
+                    }
+                    readyCount--;
+                }
+
+                auto *queue = getReady ( workerNum );
+
+                job j;
+                {
+                    std::lock_guard l1 ( keysAccess );
+                    j = std::move ( queue->jobs.front () );
+                    queue->jobs.pop_front ();
+                }
+
+                try
+                {
+                    j ();
+                } catch ( ... )
+                {
+                }
+                j = nullptr;
+
+                bool more;
+                {
+                    std::lock_guard l1 ( keysAccess );
+                    more = !queue->jobs.empty ();
+                    if ( !more )
+                    {
+                        // nothing else references an idle key so it can go, keys only use memory while they have work
+                        keys.erase ( keys.find ( queue->name ) );
+                    }
+                }
+                if ( more )
+                {
+                    // back of our own deque so other keys get a turn before this one runs again
+                    makeReady ( workerNum, queue );
+                }
+            }
+        }
+
+    public:
+        // numWorkers of 0 runs every job inline from submit ()
+        explicit dabWorkerPool ( size_t numWorkers )
+        {
+            for ( size_t loop = 0; loop < numWorkers; loop++ )
+            {
+                workers.push_back ( std::make_unique<worker> () );
+            }
+            for ( size_t loop = 0; loop < numWorkers; loop++ )
+            {
+                workers[loop]->thread = std::thread ( &dabWorkerPool::workerTask, this, loop );
+            }
+        }
+
+        // runs whatever is still queued and then stops the workers
+        ~dabWorkerPool ()
+        {
+            {
+                std::lock_guard l1 ( idleAccess );
+                exiting = true;
+            }
+            idleCondition.notify_all ();
+            for ( auto &w: workers )
+            {
+                w->thread.join ();
+            }
+        }
+
+        dabWorkerPool ( dabWorkerPool const & ) = delete;
+        dabWorkerPool &operator = ( dabWorkerPool const & ) = delete;
+
+        size_t size () const
+        {
+            return workers.size ();
+        }
+
+        void submit ( std::string_view key, job j )
+        {
+            if ( workers.empty () )
+            {
+                j ();
+                return;
+            }
+
+            keyQueue *queue;
+            size_t workerNum;
+            {
+                std::lock_guard l1 ( keysAccess );
+                auto it = keys.find ( key );
+                if ( it != keys.end () )
+                {
+                    // a worker already owns this key, it will get to this job in order
+                    it->second.jobs.push_back ( std::move ( j ) );
+                    return;
+                }
+                it = keys.emplace ( std::string ( key ), keyQueue{} ).first;
+                it->second.name = it->first;
+                queue = &it->second;
+                queue->jobs.push_back ( std::move ( j ) );
+                workerNum = nextWorker++ % workers.size ();
+            }
+            makeReady ( workerNum, queue );
+        }
+    };
+}